@@ -0,0 +1,318 @@
+#ifndef BLOCK_VECTOR_H
+#define BLOCK_VECTOR_H
+// *****************************************************************************
+// block_vector.h                                                  Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Vector of fixed-size blocks that does not relocate its items
+//
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+#include <QMutex>
+#include <QMutexLocker>
+#include <algorithm>
+#include <new>
+#include <vector>
+
+
+template <class T>
+class BlockVector
+// ----------------------------------------------------------------------------
+//    A vector made of fixed-size blocks, to grow without copying items
+// ----------------------------------------------------------------------------
+//    A std::vector needs room for both old and new items each time it grows,
+//    and copies them all. Here, growing only adds a block, so the memory used
+//    stays close to the size of the data, and pointers to items remain
+//    valid. Items are contiguous within a block only: use span() or bytes()
+//    to access them by ranges. Released blocks are kept in a small arena
+//    shared by all vectors of the same type, so that loading clouds
+//    repeatedly does not go through the allocator for each block.
+//    So that small clouds and load batches do not cost a whole block, the
+//    first block starts with MIN_BLOCK items and doubles until it reaches
+//    BLOCK items, like a std::vector. Items are only relocated then, while
+//    there are less than BLOCK of them.
+{
+public:
+    typedef T value_type;
+    enum { BLOCK_SHIFT = 16, BLOCK = 1 << BLOCK_SHIFT, ARENA = 16,
+           MIN_BLOCK = 256 };
+
+public:
+    BlockVector() : count(0), first(0) {}
+    BlockVector(const BlockVector &o) : count(0), first(0) { append(o); }
+    ~BlockVector() { clear(); }
+    BlockVector &operator =(const BlockVector &o)
+    {
+        if (this != &o)
+        {
+            clear();
+            append(o);
+        }
+        return *this;
+    }
+
+public:
+    size_t      size() const   { return count; }
+    bool        empty() const  { return count == 0; }
+    T &         operator[](size_t i)
+    {
+        return blocks[i >> BLOCK_SHIFT][i & (BLOCK - 1)];
+    }
+    const T &   operator[](size_t i) const
+    {
+        return blocks[i >> BLOCK_SHIFT][i & (BLOCK - 1)];
+    }
+    T &         back()         { return (*this)[count - 1]; }
+    size_t      blockCount() const      { return blocks.size(); }
+    const T *   block(size_t b) const   { return blocks[b]; }
+
+    void push_back(const T &value)
+    {
+        if (count < BLOCK)
+        {
+            if (count == first)
+                grow(2 * count);
+        }
+        else if ((count & (BLOCK - 1)) == 0)
+        {
+            blocks.push_back(allocate(BLOCK));
+        }
+        new (&(*this)[count]) T(value);
+        count++;
+    }
+
+    void pop_back()
+    {
+        count--;
+        (*this)[count].~T();
+        if ((count & (BLOCK - 1)) == 0)
+        {
+            release(blocks.back(), count ? size_t(BLOCK) : first);
+            blocks.pop_back();
+            if (!count)
+                first = 0;
+        }
+    }
+
+    void resize(size_t n, const T &value = T())
+    {
+        while (count > n)
+            pop_back();
+        if (count < n)
+            reserve(n);
+        while (count < n)
+            push_back(value);
+    }
+
+    void reserve(size_t n)
+    {
+        // Size the first block for n items at once, other blocks come later
+        if (n > first && first < BLOCK)
+            grow(n);
+        blocks.reserve((n + BLOCK - 1) >> BLOCK_SHIFT);
+    }
+
+    void clear()
+    {
+        while (count)
+            pop_back();
+        if (!blocks.empty())
+            release(blocks[0], first);      // Reserved, but never used
+        first = 0;
+        std::vector<T *>().swap(blocks);
+    }
+
+    void swap(BlockVector &o)
+    {
+        blocks.swap(o.blocks);
+        std::swap(count, o.count);
+        std::swap(first, o.first);
+    }
+
+    void append(const T *first, const T *last)
+    {
+        for (const T *p = first; p != last; p++)
+            push_back(*p);
+    }
+
+    void append(const BlockVector &o)
+    {
+        size_t n = 0;
+        for (size_t i = 0; i < o.count; i += n)
+        {
+            n = o.count - i;
+            const T *items = o.span(i, n);
+            append(items, items + n);
+        }
+    }
+
+    void splice(BlockVector &o)
+    {
+        // Move the items of o to the end, leaving it empty. Blocks are
+        // moved if this vector ends on a block boundary, else items are
+        // copied, as they are if o has less than BLOCK items
+        if (!o.count)
+            return;
+        if (!count)
+        {
+            clear();
+            swap(o);
+            return;
+        }
+        if ((count & (BLOCK - 1)) || o.first != BLOCK)
+        {
+            append(o);
+            o.clear();
+            return;
+        }
+        blocks.insert(blocks.end(), o.blocks.begin(), o.blocks.end());
+        count += o.count;
+        o.blocks.clear();
+        o.count = o.first = 0;
+    }
+
+    void spliceBlocks(BlockVector &o)
+    {
+        // Move the full blocks of o to the end, o keeps its last items
+        size_t full = o.count & ~size_t(BLOCK - 1);
+        if (full == 0 || full == o.count)
+        {
+            if (full)
+                splice(o);
+            return;
+        }
+        BlockVector head;
+        head.blocks.assign(o.blocks.begin(), o.blocks.end() - 1);
+        head.count = full;
+        head.first = BLOCK;
+        o.blocks.erase(o.blocks.begin(), o.blocks.end() - 1);
+        o.count -= full;
+        splice(head);
+    }
+
+    void assign(const T *first, const T *last)
+    {
+        clear();
+        append(first, last);
+    }
+
+    // Items from index on, n is reduced to those contiguous in memory
+    T *span(size_t index, size_t &n)
+    {
+        size_t left = BLOCK - (index & (BLOCK - 1));
+        if (n > left)
+            n = left;
+        return &(*this)[index];
+    }
+
+    const T *span(size_t index, size_t &n) const
+    {
+        return const_cast<BlockVector *>(this)->span(index, n);
+    }
+
+    // Raw bytes from offset on, n is reduced to those contiguous in memory
+    char *bytes(size_t offset, size_t &n)
+    {
+        size_t left = BLOCK * sizeof(T) - offset % (BLOCK * sizeof(T));
+        if (n > left)
+            n = left;
+        return (char *) blocks[offset / (BLOCK * sizeof(T))]
+            + offset % (BLOCK * sizeof(T));
+    }
+
+protected:
+    void grow(size_t n)
+    {
+        // Move the items to a larger first block, for n items up to BLOCK
+        size_t capacity = first ? first : size_t(MIN_BLOCK);
+        while (capacity < n && capacity < BLOCK)
+            capacity <<= 1;
+        T *block = allocate(capacity);
+        if (blocks.empty())
+        {
+            blocks.push_back(block);
+        }
+        else
+        {
+            T *old = blocks[0];
+            for (size_t i = 0; i < count; i++)
+            {
+                new (&block[i]) T(old[i]);
+                old[i].~T();
+            }
+            release(old, first);
+            blocks[0] = block;
+        }
+        first = capacity;
+    }
+
+    static T *allocate(size_t size)
+    {
+        if (size == BLOCK)
+        {
+            QMutexLocker locker(&arenaMutex);
+            if (!arena.empty())
+            {
+                T *block = arena.back();
+                arena.pop_back();
+                return block;
+            }
+        }
+        return (T *) ::operator new(size * sizeof(T));
+    }
+
+    static void release(T *block, size_t size)
+    {
+        if (size == BLOCK)
+        {
+            QMutexLocker locker(&arenaMutex);
+            if (arena.size() < ARENA)
+            {
+                arena.push_back(block);
+                return;
+            }
+        }
+        ::operator delete(block);
+    }
+
+protected:
+    std::vector<T *>            blocks;
+    size_t                      count;
+    size_t                      first;  // Items in the first block, to BLOCK
+
+    static QMutex               arenaMutex;
+    static std::vector<T *>     arena;  // Free blocks, at most ARENA
+};
+
+
+template <class T> QMutex           BlockVector<T>::arenaMutex;
+template <class T> std::vector<T *> BlockVector<T>::arena;
+
+#endif // BLOCK_VECTOR_H
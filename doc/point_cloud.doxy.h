@@ -203,6 +203,47 @@ cloud_add(name:text, x:real, y:real, z:real);
  */
 cloud_add(name:text, x:real, y:real, z:real, r:real, g:real, b:real, a:real);
 
+/**
+ * @~english
+ * Adds many points to a cloud in one call.
+ * @p xyz is a comma-separated list of numbers, three per point. This is
+ * much faster than calling @ref cloud_add for each point, since the cloud
+ * is looked up once and the new points are sent to the graphic card
+ * after the others. The cloud is created if it does not exist. An error
+ * is reported if the list contains anything other than numbers, or if
+ * the cloud is optimized.
+ * @~french
+ * Ajoute de nombreux points à un nuage en un seul appel.
+ * @p xyz est une liste de nombres séparés par des virgules, trois par
+ * point. C'est beaucoup plus rapide que d'appeler @ref cloud_add pour
+ * chaque point, car le nuage n'est recherché qu'une fois et les nouveaux
+ * points sont envoyés à la carte graphique à la suite des autres. Le nuage
+ * est créé s'il n'existe pas. Une erreur est signalée si la liste contient
+ * autre chose que des nombres, ou si le nuage est optimisé.
+ * @~
+@code
+cloud_add_batch "Line", 0, 0, 0, 10, 0, 0, 20, 0, 0
+@endcode
+ * @since 1.021
+ */
+cloud_add_batch(name:text, xyz:tree);
+
+/**
+ * @~english
+ * Adds many colored points to a cloud in one call.
+ * @p rgba is a comma-separated list of four numbers per point, which are
+ * the red, green, blue and alpha components of the point. If the cloud
+ * exists but does not contain colored points, the colors are ignored.
+ * @~french
+ * Ajoute de nombreux points colorés à un nuage en un seul appel.
+ * @p rgba est une liste de quatre nombres par point, séparés par des
+ * virgules, qui sont les composantes rouge, verte, bleue et alpha du
+ * point. Si le nuage existe, mais ne contient pas des points colorés, les
+ * couleurs sont ignorées.
+ * @since 1.021
+ */
+cloud_add_batch(name:text, xyz:tree, rgba:tree);
+
 /**
  * @~english
  * Creates a point cloud from a data file in text format.
@@ -217,8 +258,11 @@ cloud_add(name:text, x:real, y:real, z:real, r:real, g:real, b:real, a:real);
  * the format is <tt>z,y,x</tt> you would pass <tt>xi = 3</tt>,
  * <tt>yi = 2</tt> and <tt>zi = 1</tt>. @n
  * File load occurs in the background. Use @ref cloud_loaded to know when
- * load is complete.@n
- * If the file changes after being loaded, it is reloaded automatically.
+ * load is complete. Points are displayed as they are loaded.@n
+ * If the file changes after being loaded, it is reloaded automatically, and
+ * the previous points remain displayed until the new ones are loaded.
+ * When lines were only added at the end of a text file, only these lines are
+ * loaded.
  * @~french
  * Crée un nuage de points à partir d'un fichier de valeurs numériques.
  * Le nuage est créé s'il n'existe pas. Mais s'il existe, les points qu'il
@@ -233,9 +277,12 @@ cloud_add(name:text, x:real, y:real, z:real, r:real, g:real, b:real, a:real);
  * valeurs correctes sont <tt>xi = 3</tt>, <tt>yi = 2</tt> et <tt>zi = 1</tt>.
  * @n
  * Le chargement s'effectue en tâche de fond. Utilisez @ref cloud_loaded pour
- * savoir si le chargement est terminé.@n
+ * savoir si le chargement est terminé. Les points sont affichés au fur et à
+ * mesure de leur chargement.@n
  * Si le fichier est modifié après avoir été chargé, il est rechargé
- * automatiquement.
+ * automatiquement, et les points précédents restent affichés jusqu'à ce que
+ * les nouveaux soient chargés. Si des lignes ont seulement été ajoutées à la fin d'un
+ * fichier texte, seules ces lignes sont chargées.
  * @~
  * @see cloud_loaded
  */
@@ -279,6 +326,77 @@ cloud_load_data(name:text, file:text, sep:text, xi:integer, yi:integer, zi:integ
 cloud_load_data(name:text, file:text, sep:text, xi:integer, yi:integer, zi:integer,
                 scale:real, ri:real, gi:real, bi:real, ai:real);
 
+/**
+ * @~english
+ * Creates a point cloud from a binary data file.
+ * The file format is detected from the contents of the file. Binary
+ * formats describe their own layout, so no separator or column index is
+ * needed. Currently supported:
+ * - the native format written by @ref cloud_save,
+ * - binary PLY files (little or big endian), using the @c x, @c y, @c z
+ *   vertex properties and, when present, @c red, @c green, @c blue and
+ *   @c alpha (8-bit integer or floating-point values),
+ * - uncompressed LAS 1.2 to 1.4 files, with point data formats 0 to 3
+ *   and 6 to 8. Scale and offset are applied to the coordinates, and RGB
+ *   values are used as colors when present. RGB values are 16-bit, but
+ *   some files store 8-bit values in them: when a local file is loaded,
+ *   4096 points spread across the file are checked, and colors are read
+ *   as 8-bit values only if none of these points has a value above 255.
+ *   Files loaded from a URL are always read as 16-bit colors. @n
+ * Native files are memory-mapped and copied only once, into the cloud
+ * itself, so they load at the speed of the disk instead of the speed of
+ * text parsing.
+ * @~french
+ * Crée un nuage de points à partir d'un fichier binaire.
+ * Le format du fichier est détecté d'après son contenu. Les formats
+ * binaires décrivent eux-mêmes leur structure, il n'est donc pas
+ * nécessaire de préciser de séparateur ou d'indice de colonne. Formats
+ * reconnus :
+ * - le format natif écrit par @ref cloud_save,
+ * - les fichiers PLY binaires (little ou big endian), en utilisant les
+ *   propriétés @c x, @c y, @c z des sommets et, si elles sont présentes,
+ *   @c red, @c green, @c blue et @c alpha (entiers 8 bits ou valeurs
+ *   flottantes),
+ * - les fichiers LAS 1.2 à 1.4 non compressés, avec les formats de
+ *   points 0 à 3 et 6 à 8. L'échelle et le décalage sont appliqués aux
+ *   coordonnées, et les valeurs RGB sont utilisées comme couleurs quand
+ *   elles sont présentes. Les valeurs RGB sont sur 16 bits, mais certains
+ *   fichiers y stockent des valeurs sur 8 bits : pour un fichier local,
+ *   4096 points répartis dans tout le fichier sont examinés, et les
+ *   couleurs sont lues sur 8 bits seulement si aucun de ces points n'a
+ *   de valeur supérieure à 255. Les fichiers chargés depuis une URL sont
+ *   toujours lus avec des couleurs sur 16 bits. @n
+ * Les fichiers natifs sont projetés en mémoire et copiés une seule fois,
+ * directement dans le nuage :
+ * leur chargement est limité par la vitesse du disque et non par
+ * l'analyse du texte.
+ * @~
+ * @see cloud_loaded
+ * @since 1.021
+ */
+cloud_load_data(name:text, file:text);
+
+/**
+ * @~english
+ * Saves a point cloud to a file in native binary format.
+ * The file contains a header (number of points, colored or not, bounding
+ * box and data layout) followed by the point and color arrays. It can be
+ * loaded back with @ref cloud_load_data much faster than a text file. @n
+ * Relative paths are relative to the document folder. The file is written
+ * each time the primitive is evaluated.
+ * @~french
+ * Enregistre un nuage de points dans un fichier au format binaire natif.
+ * Le fichier contient un en-tête (nombre de points, présence de
+ * couleurs, boîte englobante et organisation des données) suivi des
+ * tableaux de points et de couleurs. Il peut être rechargé avec
+ * @ref cloud_load_data beaucoup plus rapidement qu'un fichier texte. @n
+ * Les chemins relatifs sont relatifs au dossier du document. Le fichier
+ * est écrit à chaque évaluation de la primitive.
+ * @~
+ * @since 1.021
+ */
+cloud_save(name:text, file:text);
+
 /**
  * @~english
  * Returns progress information about cloud_load_data.
@@ -304,15 +422,18 @@ cloud_loaded(name:text);
  * in main memory to allow for new points to be added to the cloud
  * (@ref cloud_add). @n
  * This function will free the point data from the main memory and keep only
- * the data in the Vertex Buffer Objects. @n
+ * the data in the Vertex Buffer Objects, and a losslessly compressed copy
+ * of the points in main memory. @n
  * This function does nothing if:
  * - VBOs are not supported, or
  * - the point cloud is currently being loaded from a file, or
  * - some points have been added with @ref cloud_add. They cannot be deleted
  * otherwise they would be lost when the OpenGL context changes (switching
  * to/from quad buffer stereoscopic mode). @n
- * If a cloud has been optimized and the GL context changes, the cloud is
- * re-created in the new context (that is, @ref cloud_random or
+ * If a cloud has been optimized and the GL context changes, the compressed
+ * copy is decompressed in parallel and uploaded in the new context, so that
+ * the file is not read again and random points keep their values. Only
+ * if this fails is the cloud re-created (that is, @ref cloud_random or
  * @ref cloud_random_colored or @ref cloud_load_data is executed again).
  * @~french
  * Essaie de réduire l'utilisation mémoire d'un nuage de points.
@@ -326,16 +447,20 @@ cloud_loaded(name:text);
  * Cependant, les points sont tout de même conservés dans la mémoire
  * principale pour permettre l'ajout de nouveaux points (@ref cloud_add). @n
  * Cette fonction détruit les données qui sont en mémoire pour ne conserver que
- * celles qui sont dans les VBOs. @n
+ * celles qui sont dans les VBOs, et une copie des points compressée sans
+ * perte en mémoire principale. @n
  * Cette fonction en fait rien si :
  * - la carte graphique ne permet pas d'utiliser les VBOs, ou si
  * - le nuage est en cours de chargement (@ref cloud_load_data), ou si
  * - des points ont été ajoutés par @ref cloud_add. En effet, ces points
  * seraient perdus lors d'un changement de contexte OpenGL (passage en mode
  * quad buffer par exemple). @n
- * Si un nuage a été optimisé, et le context GL change, alors le nuage est
- * recréé. C'est à dire, @ref cloud_random ou @ref cloud_random_colored ou
- * @ref cloud_load_data est exécuté de nouveau).
+ * Si un nuage a été optimisé, et le context GL change, alors la copie
+ * compressée est décompressée en parallèle et envoyée dans le nouveau
+ * contexte, de sorte que le fichier n'est pas relu et que les points
+ * aléatoires gardent leurs valeurs. C'est seulement en cas d'échec que le
+ * nuage est recréé (c'est à dire, @ref cloud_random ou
+ * @ref cloud_random_colored ou @ref cloud_load_data est exécuté de nouveau).
  */
 cloud_optimize(name:text);
 
@@ -398,6 +523,226 @@ glEnable(GL_PROGRAM_POINT_SIZE);
  */
 cloud_point_sprites(name:text, on:boolean);
 
+/**
+ * @~english
+ * Stores point coordinates as 16-bit integers in video memory.
+ * Each coordinate is quantized relative to the bounding box of the cloud,
+ * which reduces the size of a point from 12 to 6 bytes. The precision is
+ * 1/65534 of the size of the box along each axis. The setting applies the
+ * next time points are sent to the graphic card, it is best set before
+ * @ref cloud_load_data. The points kept in main memory are not changed.
+ * Has no effect when vertex buffer objects are not supported.
+ * @~french
+ * Stocke les coordonnées des points sous forme d'entiers 16 bits en
+ * mémoire vidéo.
+ * Chaque coordonnée est quantifiée par rapport à la boîte englobante du
+ * nuage, ce qui réduit la taille d'un point de 12 à 6 octets. La précision
+ * est de 1/65534 de la taille de la boîte selon chaque axe. Le réglage
+ * s'applique au prochain envoi des points à la carte graphique, il est
+ * préférable de l'utiliser avant @ref cloud_load_data. Les points conservés
+ * en mémoire centrale ne sont pas modifiés.
+ * Sans effet lorsque les vertex buffer objects ne sont pas supportés.
+ * @since 1.021
+ */
+cloud_compact_points(name:text, on:boolean);
+
+/**
+ * @~english
+ * Stores point colors as 8-bit RGBA values in video memory.
+ * This reduces the size of a color from 16 to 4 bytes. Components are
+ * clamped to [0.0, 1.0]. The setting applies like
+ * @ref cloud_compact_points.
+ * @~french
+ * Stocke les couleurs des points sous forme de valeurs RGBA 8 bits en
+ * mémoire vidéo.
+ * La taille d'une couleur passe ainsi de 16 à 4 octets. Les composantes
+ * sont limitées à [0.0, 1.0]. Le réglage s'applique comme pour
+ * @ref cloud_compact_points.
+ * @since 1.021
+ */
+cloud_compact_colors(name:text, on:boolean);
+
+/**
+ * @~english
+ * Stores positions and colors of a cloud in a single buffer.
+ * When enabled, the color of each point follows its position in one
+ * vertex buffer object, which is uploaded and read by the graphic card
+ * in a single pass. During an asynchronous load, vertices are interleaved
+ * by the loader thread. Uncolored clouds are not affected.
+ * The setting applies like @ref cloud_compact_points.
+ * @~french
+ * Stocke les positions et les couleurs d'un nuage dans un seul tampon.
+ * Lorsque ce mode est actif, la couleur de chaque point suit sa position
+ * dans un même vertex buffer object, qui est transféré et lu par la carte
+ * graphique en une seule passe. Pendant un chargement asynchrone, les
+ * sommets sont entrelacés par le thread de chargement. Les nuages sans
+ * couleur ne sont pas concernés.
+ * Le réglage s'applique comme pour @ref cloud_compact_points.
+ * @since 1.021
+ */
+cloud_interleaved(name:text, on:boolean);
+
+/**
+ * @~english
+ * Limits the number of points drawn per frame.
+ * Large clouds are indexed in the background, and each part of the index
+ * keeps a representative subset of its points. When @p budget is not 0,
+ * the parts of the cloud that appear largest on screen are drawn in more
+ * detail first, until @p budget points are drawn or the points are less
+ * than a point size apart. Distant parts are drawn with fewer points, so
+ * that the frame rate does not depend on the size of the cloud. Points
+ * added after the index was built are always drawn.
+ * With 0 (the default), all visible points are drawn.
+ * Only applies when vertex buffer objects are supported.
+ * @~french
+ * Limite le nombre de points affichés à chaque image.
+ * Les grands nuages sont indexés en tâche de fond, et chaque partie de
+ * l'index conserve un sous-ensemble représentatif de ses points. Lorsque
+ * @p budget n'est pas 0, les parties du nuage qui apparaissent les plus
+ * grandes à l'écran sont affichées en premier avec plus de détails,
+ * jusqu'à ce que @p budget points soient affichés ou que les points soient
+ * espacés de moins d'une taille de point. Les parties éloignées sont
+ * affichées avec moins de points, de sorte que la fréquence d'affichage
+ * ne dépend pas de la taille du nuage. Les points ajoutés après la
+ * construction de l'index sont toujours affichés.
+ * Avec 0 (la valeur par défaut), tous les points visibles sont affichés.
+ * Sans effet lorsque les vertex buffer objects ne sont pas supportés.
+ * @since 1.021
+ */
+cloud_point_budget(name:text, budget:integer);
+
+/**
+ * @~english
+ * Converts a cloud too large for memory to a tree file, and draws it.
+ * The points of @p file are read as with @ref cloud_load_data, in the
+ * background, and written to @p tree, which stores an octree of the cloud
+ * with a subset of the points at each level. The cloud is then drawn from
+ * @p tree: only the parts in view are read from disk, at the level of
+ * detail given by @ref cloud_point_budget, and the parts used least
+ * recently are released as set by @ref cloud_tree_memory. @n
+ * If @p tree is already newer than @p file, it is drawn right away
+ * without converting @p file again. A tree file can also be drawn
+ * directly with @ref cloud_load_data.
+ * @~french
+ * Convertit un nuage trop grand pour la mémoire en fichier arbre, et
+ * l'affiche.
+ * Les points de @p file sont lus comme avec @ref cloud_load_data, en
+ * tâche de fond, et écrits dans @p tree, qui contient un octree du nuage
+ * avec un sous-ensemble des points à chaque niveau. Le nuage est ensuite
+ * affiché à partir de @p tree : seules les parties visibles sont lues
+ * sur le disque, au niveau de détail fixé par @ref cloud_point_budget, et
+ * les parties utilisées le moins récemment sont libérées selon
+ * @ref cloud_tree_memory. @n
+ * Si @p tree est plus récent que @p file, il est affiché immédiatement
+ * sans convertir @p file de nouveau. Un fichier arbre peut aussi être
+ * affiché directement avec @ref cloud_load_data.
+ * @~
+ * @see cloud_loaded
+ * @since 1.021
+ */
+cloud_build_tree(name:text, file:text, tree:text, sep:text,
+                 xi:integer, yi:integer, zi:integer);
+
+/**
+ * @~english
+ * Limits the memory used to draw a cloud from a tree file.
+ * At most @p memory megabytes of the parts of the tree are kept in main
+ * memory, and @p video megabytes in video memory. The parts used least
+ * recently are released first. Defaults are 1024 and 512.
+ * @~french
+ * Limite la mémoire utilisée pour afficher un nuage à partir d'un
+ * fichier arbre.
+ * Au plus @p memory mégaoctets des parties de l'arbre sont conservés en
+ * mémoire centrale, et @p video mégaoctets en mémoire vidéo. Les parties
+ * utilisées le moins récemment sont libérées en premier. Les valeurs par
+ * défaut sont 1024 et 512.
+ * @~
+ * @see cloud_build_tree
+ * @since 1.021
+ */
+cloud_tree_memory(name:text, memory:integer, video:integer);
+
+/**
+ * @~english
+ * Limits the data sent to the graphic card per frame.
+ * Points loaded or added are sent to vertex buffer objects at most
+ * @p megabytes at a time, and the rest in the next frames, so that
+ * loading a large cloud does not stall drawing. Only the points already
+ * sent are drawn. A change of @ref cloud_compact_points,
+ * @ref cloud_compact_colors or @ref cloud_interleaved is applied the same
+ * way, and the cloud is drawn in the previous format meanwhile.
+ * With 0, all points are sent at once. The default is 16.
+ * @~french
+ * Limite les données envoyées à la carte graphique à chaque image.
+ * Les points chargés ou ajoutés sont envoyés dans les vertex buffer
+ * objects par paquets d'au plus @p megabytes mégaoctets, le reste aux
+ * images suivantes, de sorte que le chargement d'un grand nuage ne bloque
+ * pas l'affichage. Seuls les points déjà envoyés sont affichés. Un
+ * changement de @ref cloud_compact_points, @ref cloud_compact_colors ou
+ * @ref cloud_interleaved est appliqué de la même façon, et le nuage est
+ * affiché dans le format précédent en attendant.
+ * Avec 0, tous les points sont envoyés en une fois. La valeur par défaut
+ * est 16.
+ * @since 1.021
+ */
+cloud_upload_budget(name:text, megabytes:integer);
+
+/**
+ * @~english
+ * Draws a cloud with shaders and a vertex array object.
+ * When enabled, the vertex buffer objects of the cloud are described
+ * once in a vertex array object, and drawn by a small built-in shader
+ * program. Compact positions are decoded, and the point size and point
+ * sprites are applied by the shaders, so that less OpenGL state changes
+ * for each cloud and each frame. The shaders only need GLSL 1.20. @n
+ * The fixed-function path is used instead when the document has set its
+ * own shader, or when vertex array objects are not supported.
+ * @~french
+ * Affiche un nuage avec des shaders et un vertex array object.
+ * Lorsque ce mode est actif, les vertex buffer objects du nuage sont
+ * décrits une fois pour toutes dans un vertex array object, et affichés
+ * par un petit programme de shaders intégré. Les positions compactes sont
+ * décodées, et la taille des points et les point sprites sont appliqués
+ * par les shaders, de sorte que moins d'états OpenGL changent pour chaque
+ * nuage et à chaque image. Les shaders ne nécessitent que GLSL 1.20. @n
+ * Le pipeline fixe est utilisé à la place lorsque le document a défini
+ * son propre shader, ou lorsque les vertex array objects ne sont pas
+ * supportés.
+ * @since 1.021
+ */
+cloud_shaders(name:text, on:boolean);
+
+/**
+ * @~english
+ * Displays several point clouds together.
+ * The clouds are given as a comma-separated list of names, for instance
+ * <tt>clouds "sensor1", "sensor2", "sensor3"</tt>. Clouds that do not
+ * exist are ignored. @n
+ * Unlike a sequence of @ref cloud, the OpenGL state (point size, point
+ * sprites, color arrays, shaders) is set up only once for all the clouds
+ * drawn with the same settings, which is much faster with many small
+ * clouds. When blending is enabled or the depth test is disabled, clouds
+ * are drawn in the order of the list, and only consecutive clouds with the
+ * same settings share their setup. Otherwise, the order in which clouds
+ * are drawn does not change the result, and they are grouped by settings.
+ * @~french
+ * Affiche plusieurs nuages de points ensemble.
+ * Les nuages sont donnés par une liste de noms séparés par des virgules,
+ * par exemple <tt>clouds "capteur1", "capteur2", "capteur3"</tt>. Les
+ * nuages qui n'existent pas sont ignorés. @n
+ * Contrairement à une suite de @ref cloud, l'état OpenGL (taille des
+ * points, point sprites, tableaux de couleurs, shaders) n'est préparé
+ * qu'une fois pour tous les nuages affichés avec les mêmes réglages, ce
+ * qui est bien plus rapide avec de nombreux petits nuages. Lorsque la
+ * transparence est activée ou le test de profondeur désactivé, les nuages
+ * sont affichés dans l'ordre de la liste, et seuls les nuages consécutifs
+ * ayant les mêmes réglages partagent leur préparation. Sinon, l'ordre
+ * d'affichage ne change pas le résultat, et les nuages sont regroupés par
+ * réglages.
+ * @since 1.021
+ */
+clouds(names:tree);
+
 /**
  * @}
  */
@@ -39,22 +39,46 @@
 
 #include "point_cloud.h"
 #include "point_cloud_factory.h"
+#include "point_cloud_file.h"
+#include "point_cloud_index.h"
+#include "point_cloud_las.h"
+#include "point_cloud_parser.h"
+#include "point_cloud_ply.h"
+#include "point_cloud_shader.h"
+#include "point_cloud_stream.h"
+#include "point_cloud_tree.h"
+#include "point_cloud_view.h"
 #include "tao/tao_gl.h"
 #include "tao/graphic_state.h"
+#include <QCoreApplication>
 #include <QDir>
+#include <QElapsedTimer>
 #include <QFile>
 #include <QFileInfo>
 #include <QRegExp>
-#include <QTextStream>
+#include <QSaveFile>
+#include <QThread>
+#include <algorithm>
+#include <float.h>
 
 
 PointCloud::PointCloud(text name)
 // ----------------------------------------------------------------------------
 //   Constructor
 // ----------------------------------------------------------------------------
-    : loaded(-1.0), pointSize(-1.0), pointSprites(false), name(name),
-      fileMonitor(0),
-      network(NULL), networkReply(NULL),
+    : loaded(-1.0), pointSize(-1.0), pointSprites(false),
+      compactPoints(false), compactColors(false), interleaved(false),
+      pointBudget(0), treeMemory(1024), treeVideoMemory(512),
+      uploadBudget(16), shaders(false),
+      name(name),
+      expected(0), shadowing(false), shadowReload(false),
+      loadExpected(0), loadReset(false), loadShadow(false),
+      appendOffset(-1), appendChecksum(0), batches(NULL),
+      indexer(NULL), octree(NULL), indexing(false),
+      tailLo(FLT_MAX, FLT_MAX, FLT_MAX), tailHi(-FLT_MAX, -FLT_MAX, -FLT_MAX),
+      tailScanned(0), tree(NULL), treeBuilder(NULL),
+      fileMonitor(0), appendable(false), appending(false),
+      network(NULL), stream(NULL),
       nbRandom(0), coloredRandom(false)
 {}
 
@@ -65,11 +89,21 @@ PointCloud::~PointCloud()
 // ----------------------------------------------------------------------------
 {
     interrupt();
+    closeStream();
+    delete indexer;
+    delete octree;
+    delete tree;
+    delete treeBuilder;
+    Batch *batch = batches.fetchAndStoreAcquire(NULL);
+    while (batch)
+    {
+        Batch *next = batch->next;
+        delete batch;
+        batch = next;
+    }
     PointCloudFactory::instance()->tao->deleteFileMonitor(fileMonitor);
     if (network)
         network->deleteLater();
-    if (networkReply)
-        networkReply->deleteLater();
 }
 
 
@@ -78,8 +112,7 @@ unsigned PointCloud::size()
 //   Number of points in the cloud
 // ----------------------------------------------------------------------------
 {
-    if (loadInProgress())
-        return 0;
+    fetchBatches();
     if (colored())
     {
         XL_ASSERT(points.size() == colors.size());
@@ -103,6 +136,21 @@ bool PointCloud::addPoint(const Point &p, Color c)
 }
 
 
+bool PointCloud::addPoints(point_vec &p, color_vec &c)
+// ----------------------------------------------------------------------------
+//   Add many points to the cloud at once, with one color each or none
+// ----------------------------------------------------------------------------
+//   The items of p and c are moved into the cloud, leaving them empty.
+{
+    XL_ASSERT(c.empty() || c.size() == p.size());
+    XL_ASSERT(c.empty() ? !colored() || p.empty() : colored() || !size());
+
+    points.splice(p);
+    colors.splice(c);
+    return true;
+}
+
+
 
 void PointCloud::removePoints(unsigned n)
 // ----------------------------------------------------------------------------
@@ -112,6 +160,7 @@ void PointCloud::removePoints(unsigned n)
     if (n >= size())
         return clear();
 
+    dropIndex();
     while (n--)
     {
         points.pop_back();
@@ -126,49 +175,169 @@ void PointCloud::draw()
 //   Draw cloud
 // ----------------------------------------------------------------------------
 {
-    if (points.size() == 0 || loadInProgress())
+    if (!prepareDraw())
+        return;
+    Style s = style(documentProgram());
+    beginStyle(s);
+    drawStyled(s);
+    endStyle(s);
+}
+
+
+bool PointCloud::prepareDraw()
+// ----------------------------------------------------------------------------
+//   Bring the cloud up to date before drawing, false if nothing to draw
+// ----------------------------------------------------------------------------
+{
+    if (size() == 0 && !tree)
+        return false;
+    if (!tree)
+        checkIndex();
+    return true;
+}
+
+
+PointCloud::Style PointCloud::style(bool documentProgram)
+// ----------------------------------------------------------------------------
+//   GL state the cloud is drawn with
+// ----------------------------------------------------------------------------
+//   documentProgram tells if the document has bound its own shaders, as
+//   returned by documentProgram() once for all the clouds drawn.
+{
+    Q_UNUSED(documentProgram);
+    Style s;
+    s.pointSize = pointSize;
+    s.sprites = pointSprites;
+    s.programmable = pointProgrammableSize;
+    s.colored = tree ? tree->colored() : colored();
+    s.shaders = false;
+    return s;
+}
+
+
+void PointCloud::drawStyled(const Style &s)
+// ----------------------------------------------------------------------------
+//   Draw the points, with the state of beginStyle() already set
+// ----------------------------------------------------------------------------
+{
+    if (tree)
+    {
+        // Only the nodes in view are read, as they are needed
+        PointCloudFactory * fact = PointCloudFactory::instance();
+        PointCloudView view;
+        view.load(pointSize);
+        tree->budget[PointCloudTree::CPU] = size_t(treeMemory) << 20;
+        tree->budget[PointCloudTree::GPU] = size_t(treeVideoMemory) << 20;
+        tree->draw(view, pointBudget, fact->vboSupported);
+        loaded = tree->progress();
         return;
+    }
+
+    // Points are contiguous within blocks only, draw them block by block
+    size_t count = size(), n = 0;
+    for (size_t i = 0; i < count; i += n)
+    {
+        n = count - i;
+        GL.VertexPointer(3, GL_FLOAT, sizeof(Point), points.span(i, n));
+        if (s.colored)
+            GL.ColorPointer(4, GL_FLOAT, sizeof(Color), colors.span(i, n));
+        GL.DrawArrays(GL_POINTS, 0, n);
+    }
+}
+
+
+bool PointCloud::documentProgram()
+// ----------------------------------------------------------------------------
+//   Check if the document has bound a program of its own
+// ----------------------------------------------------------------------------
+{
+    if (!PointCloudFactory::instance()->shadersSupported)
+        return false;
+    GLint program = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    return program != 0;
+}
+
 
+void PointCloud::beginStyle(const Style &s)
+// ----------------------------------------------------------------------------
+//   Set up the state shared by clouds drawn with a style
+// ----------------------------------------------------------------------------
+//   With shaders, the point size is a uniform, sprites are textured by the
+//   fragment shader, and vertex arrays are described by VAOs.
+{
     PointCloudFactory * fact = PointCloudFactory::instance();
-    if (!colored())
+    if (!s.colored)
     {
         // Activate current document color
         fact->tao->SetFillColor();
+        if (s.shaders)
+        {
+            GLfloat color[4];
+            glGetFloatv(GL_CURRENT_COLOR, color);
+            glVertexAttrib4fv(PointCloudShader::COLOR, color);
+        }
     }
 
-    if (pointSize > 0)
+    if (s.shaders)
+    {
+        fact->shader->bind();
+        GL.Enable(GL_VERTEX_PROGRAM_POINT_SIZE);
+    }
+    else
     {
-        glPushAttrib(GL_POINT_BIT);
-        GL.PointSize(pointSize * fact->tao->DevicePixelRatio());
+        if (s.pointSize > 0)
+        {
+            glPushAttrib(GL_POINT_BIT);
+            GL.PointSize(s.pointSize * fact->tao->DevicePixelRatio());
+        }
+        if (s.programmable)
+            GL.Enable(GL_VERTEX_PROGRAM_POINT_SIZE);
+        GL.EnableClientState(GL_VERTEX_ARRAY);
+        if (s.colored)
+            GL.EnableClientState(GL_COLOR_ARRAY);
     }
-    if (pointSprites)
+
+    if (s.sprites)
     {
         GL.Enable(GL_POINT_SPRITE);
-        GL.TexEnv(GL_POINT_SPRITE, GL_COORD_REPLACE, GL_TRUE);
+        if (!s.shaders)
+            GL.TexEnv(GL_POINT_SPRITE, GL_COORD_REPLACE, GL_TRUE);
         GL.PointParameter(GL_POINT_SPRITE_COORD_ORIGIN, GL_LOWER_LEFT);
         fact->tao->SetTextures();
     }
-    if (pointProgrammableSize)
-        GL.Enable(GL_VERTEX_PROGRAM_POINT_SIZE);
+}
 
-    GL.EnableClientState(GL_VERTEX_ARRAY);
-    GL.EnableClientState(GL_COLOR_ARRAY);
-    GL.VertexPointer(3, GL_FLOAT, sizeof(Point), &points[0].x);
-    GL.ColorPointer(4, GL_FLOAT, sizeof(Color), &colors[0].r);
-    GL.DrawArrays(GL_POINTS, 0, size());
-    GL.DisableClientState(GL_VERTEX_ARRAY);
-    GL.DisableClientState(GL_COLOR_ARRAY);
 
-    if (pointProgrammableSize)
-        GL.Disable(GL_VERTEX_PROGRAM_POINT_SIZE);
-    if (pointSprites)
+void PointCloud::endStyle(const Style &s)
+// ----------------------------------------------------------------------------
+//   Restore the state changed by beginStyle()
+// ----------------------------------------------------------------------------
+{
+    if (s.sprites)
     {
         GL.Disable(GL_POINT_SPRITE);
-        GL.TexEnv(GL_POINT_SPRITE, GL_COORD_REPLACE, GL_FALSE);
+        if (!s.shaders)
+            GL.TexEnv(GL_POINT_SPRITE, GL_COORD_REPLACE, GL_FALSE);
         GL.PointParameter(GL_POINT_SPRITE_COORD_ORIGIN, GL_UPPER_LEFT);
     }
-    if (pointSize > 0)
-        glPopAttrib();
+
+    if (s.shaders)
+    {
+        GL.Disable(GL_VERTEX_PROGRAM_POINT_SIZE);
+        glBindVertexArray(0);
+        PointCloudFactory::instance()->shader->unbind();
+    }
+    else
+    {
+        GL.DisableClientState(GL_VERTEX_ARRAY);
+        if (s.colored)
+            GL.DisableClientState(GL_COLOR_ARRAY);
+        if (s.programmable)
+            GL.Disable(GL_VERTEX_PROGRAM_POINT_SIZE);
+        if (s.pointSize > 0)
+            glPopAttrib();
+    }
 }
 
 
@@ -177,8 +346,11 @@ void PointCloud::clear()
 //   Remove all points
 // ----------------------------------------------------------------------------
 {
+    dropIndex();
+    dropTree();
     points.clear();
     colors.clear();
+    appendable = false;
 }
 
 
@@ -237,33 +409,32 @@ bool PointCloud::loadData(text file, text sep, int xi, int yi, int zi,
 {
     if (file == this->file)
         return false;
+
+    // Stop the load in progress before changing what is loaded
+    interrupt();
+    closeStream();
     loadDataParm = LoadDataParm(file, sep, xi, yi, zi, colorScale,
                                 ri, gi, bi, ai);
+    loadDataParm.tree = buildTarget;
+    buildTarget = "";
 
     XL_ASSERT(folder != "");
-    if (xi < 1 || yi < 1 || zi < 1)
-    {
-        error = "Invalid coordinate index value";
-        return false;
-    }
 
+    // URLs are parsed in a loader thread while they download
+    PointCloudFactory * fact = PointCloudFactory::instance();
     if (file.find("://") != file.npos)
     {
         if (!network)
             network = new QNetworkAccessManager;
-        if (!networkReply)
-        {
-            QUrl url(+file);
-            QNetworkRequest req(url);
-            networkReply = network->get(req);
-        }
+        QUrl url(+file);
+        QNetworkRequest req(url);
+        stream = new PointCloudStream(network->get(req), this);
+        this->file = file;
+        startLoad();
         return true;
     }
 
-    QString qf = QString::fromUtf8(folder.data(), folder.length());
-    QString qn = QString::fromUtf8(file.data(), file.length());
-    QFileInfo inf(QDir(qf), qn);
-    text path = +QDir::toNativeSeparators(inf.absoluteFilePath());
+    text path = absolutePath(file);
     QFile f(+path);
     if (!f.open(QIODevice::ReadOnly))
     {
@@ -272,7 +443,15 @@ bool PointCloud::loadData(text file, text sep, int xi, int yi, int zi,
         return false;
     }
 
-    PointCloudFactory * fact = PointCloudFactory::instance();
+    // Column indices are only meaningful for text files
+    PointCloudFile::Format format = PointCloudFile::format(&f);
+    f.close();
+    if (format == PointCloudFile::TEXT && (xi < 1 || yi < 1 || zi < 1))
+    {
+        error = "Invalid coordinate index value";
+        return false;
+    }
+
     if (!fileMonitor)
     {
         fileMonitor = fact->tao->newFileMonitor(0, fileChanged, 0, this,
@@ -281,25 +460,159 @@ bool PointCloud::loadData(text file, text sep, int xi, int yi, int zi,
         fact->tao->fileMonitorAddPath(fileMonitor, path);
     }
 
-    if (async)
+    // Trees are drawn from the file, nodes are read only when in view
+    if (format == PointCloudFile::TREE)
     {
-        fact->pool.start(this);
-        return true;
+        clear();
+        shadowReload = false;
+        this->file = file;
+        return openTree(path);
     }
 
-    // colored attribute can't be changed if cloud already exists
-    if (size())
-        colorScale = colored() ? 1.0 : 0.0;
+    this->file = file;
+    if (async)
+        startLoad();
+    else
+        loadLocal();
+
+    return true;
+}
+
+
+void PointCloud::loadLocal()
+// ----------------------------------------------------------------------------
+//   Load the local file given to loadData()
+// ----------------------------------------------------------------------------
+{
+    text path = absolutePath(loadDataParm.file);
+    QFile f(+path);
+    if (!f.open(QIODevice::ReadOnly))
+    {
+        beginLoad();
+        loadError = +QString("File not found or unreadable: $1\n"
+                             "File path: %1").arg(+path);
+        endLoad();
+        return;
+    }
 
     IFTRACE(pointcloud)
         debug() << "Loading " << path << "\n";
 
-    loadFromStream(&f);
+    QElapsedTimer timer;
+    timer.start();
 
-    this->file = file;
-    f.close();
+    qint64 fsize = f.size();
+    loadFile(f);
 
-    return true;
+    IFTRACE(pointcloud)
+    {
+        qint64 ms = timer.elapsed();
+        debug() << "Read " << fsize << " bytes in " << ms << " ms ("
+                << (ms ? fsize / 1000.0 / ms : 0.0) << " MB/s)\n";
+    }
+}
+
+
+void PointCloud::loadFile(QFile &f)
+// ----------------------------------------------------------------------------
+//   Load a local file, in place when it can be memory-mapped
+// ----------------------------------------------------------------------------
+{
+    appendOffset = -1;
+    qint64 fsize = f.size();
+    uchar *data = fsize > 0 ? f.map(0, fsize) : NULL;
+    if (!data)
+        return loadFromStream(&f);
+
+    const char *begin = (const char *) data;
+    const char *end = begin + fsize;
+    switch(PointCloudFile::format(&f))
+    {
+    case PointCloudFile::NATIVE:
+        loadNative(begin, end);
+        break;
+    case PointCloudFile::PLY:
+    {
+        PointCloudPly ply;
+        loadRecords(ply, begin, end);
+        break;
+    }
+    case PointCloudFile::LAS:
+    {
+        PointCloudLas las;
+        loadRecords(las, begin, end);
+        break;
+    }
+    case PointCloudFile::TREE:
+        beginLoad();
+        loadError = "Point cloud trees can only be loaded from local files";
+        endLoad();
+        break;
+    default:
+        // If lines are added later, only they will need to be loaded
+        if (PointCloudParser::lastLine(begin, end) == end)
+        {
+            appendOffset = fsize;
+            appendChecksum = checksum(begin, appendOffset);
+        }
+        loadFromMemory(begin, end);
+        break;
+    }
+    f.unmap(data);
+}
+
+
+void PointCloud::loadAppended()
+// ----------------------------------------------------------------------------
+//   Load the lines added to a text file since it was loaded
+// ----------------------------------------------------------------------------
+//   The file is reloaded completely if it was modified before the end of
+//   the lines already loaded. Only complete lines are loaded, in case the
+//   last one is being written.
+{
+    text path = absolutePath(loadDataParm.file);
+    QFile f(+path);
+    if (!f.open(QIODevice::ReadOnly))
+        return;
+
+    qint64 offset = appendOffset;
+    qint64 fsize = f.size();
+    uchar *data = fsize > 0 ? f.map(0, fsize) : NULL;
+    const char *begin = (const char *) data;
+    if (!data || fsize < offset || checksum(begin, offset) != appendChecksum)
+    {
+        IFTRACE(pointcloud)
+            debug() << "File was rewritten, reloading all of it\n";
+        if (data)
+            f.unmap(data);
+        return loadFile(f);
+    }
+
+    const char *end = PointCloudParser::lastLine(begin + offset,
+                                                 begin + fsize);
+    IFTRACE(pointcloud)
+        debug() << "Loading " << end - begin - offset
+                << " bytes added at offset " << offset << "\n";
+
+    appendOffset = end - begin;
+    appendChecksum = checksum(begin, appendOffset);
+    loadFromMemory(begin + offset, end, true);
+    f.unmap(data);
+}
+
+
+quint64 PointCloud::checksum(const char *begin, qint64 offset)
+// ----------------------------------------------------------------------------
+//   Checksum of the last bytes of a file before offset (64-bit FNV-1a)
+// ----------------------------------------------------------------------------
+{
+    const qint64 tailSize = 4096;
+    const uchar *p = (const uchar *) begin + qMax(offset - tailSize, 0LL);
+    const uchar *end = (const uchar *) begin + offset;
+    quint64 hash = Q_UINT64_C(14695981039346656037);
+    while (p < end)
+        hash = (hash ^ *p++) * Q_UINT64_C(1099511628211);
+    return hash;
 }
 
 
@@ -308,28 +621,46 @@ void PointCloud::loadFromStream(QIODevice *io)
 //   Load data from a given I/O device (file or network reply)
 // ----------------------------------------------------------------------------
 {
-    clear();
-    QTextStream t(io);
-    QString line;
-    unsigned count = 0;
+    switch(PointCloudFile::format(io))
+    {
+    case PointCloudFile::NATIVE:
+        return loadNativeStream(io);
+    case PointCloudFile::PLY:
+    {
+        PointCloudPly ply;
+        return loadRecordsStream(ply, io);
+    }
+    case PointCloudFile::LAS:
+    {
+        PointCloudLas las;
+        return loadRecordsStream(las, io);
+    }
+    case PointCloudFile::TREE:
+        beginLoad();
+        loadError = "Point cloud trees can only be loaded from local files";
+        return endLoad();
+    default:
+        break;
+    }
+
+    beginLoad();
+    LoadDataParm &p(loadDataParm);
+    if (p.xi < 1 || p.yi < 1 || p.zi < 1)
+    {
+        loadError = "Invalid coordinate index value";
+        endLoad();
+        return;
+    }
+    PointCloudParser parser(loadDataParm);
 
-    QString separator = +loadDataParm.sep;
-    int xi = loadDataParm.xi;
-    int yi = loadDataParm.yi;
-    int zi = loadDataParm.zi;
-    float ri = loadDataParm.ri;
-    float gi = loadDataParm.gi;
-    float bi = loadDataParm.bi;
-    float ai = loadDataParm.ai;
-    float colorScale = loadDataParm.colorScale;
-
-    int maxp = qMax(qMax(xi, yi), zi);
-    float maxc = qMax(qMax(ri, gi), qMax(bi, ai));
-    int max  = qMax(maxp, (int)maxc);
+    // Read large blocks and parse the complete lines they contain
+    const int blockSize = 1 << 20;
+    QByteArray buffer;
+    int kept = 0;
     double sz = io->bytesAvailable();
     double pos = 0.0;
     loaded = 0.0;
-    do
+    for (;;)
     {
         if (interrupted())
         {
@@ -338,113 +669,933 @@ void PointCloud::loadFromStream(QIODevice *io)
             return;
         }
 
-        line = t.readLine();
-        pos += line.size() + 1;
-        if (sz)
-            loaded = pos/sz;
-        QStringList values = line.split(separator);
-        if (values.size() < max)
-            continue;
-        bool xok, yok, zok;
-        float x = values[xi-1].toFloat(&xok);
-        float y = values[yi-1].toFloat(&yok);
-        float z = values[zi-1].toFloat(&zok);
-        bool colorok = true;
-        Color color;
-        if (colorScale)
-        {
-            bool rok = true;
-            bool gok = true;
-            bool bok = true;
-            bool aok = true;
-            float r = (ri > 0) ? values[ri-1].toFloat(&rok) * colorScale : -ri;
-            float g = (gi > 0) ? values[gi-1].toFloat(&gok) * colorScale : -gi;
-            float b = (bi > 0) ? values[bi-1].toFloat(&bok) * colorScale : -bi;
-            float a = (ai > 0) ? values[ai-1].toFloat(&aok) * colorScale : -ai;
-            colorok = rok && gok && bok && aok;
-            if (colorok)
-                color = Color(r, g, b, a);
-        }
-        size();
-        if (xok && yok && zok && colorok)
+        buffer.resize(kept + blockSize);
+        qint64 n = io->read(buffer.data() + kept, blockSize);
+        bool atEnd = n <= 0;
+        if (n < 0)
+            n = 0;
+
+        const char *begin = buffer.constData();
+        const char *end = begin + kept + n;
+        const char *stop = atEnd ? end : PointCloudParser::lastLine(begin, end);
+        if (pos == 0.0 && sz)
         {
-            addPoint(Point(x, y, z), color);
-            count++;
+            // Guess the size of the cloud from the lines of the first block
+            loadExpected = PointCloudParser::estimateLines(begin, stop, sz);
+            IFTRACE(pointcloud)
+                debug() << "Expecting about " << loadExpected << " points\n";
         }
-        size();
+        const char *done = parser.parse(begin, stop, loadPoints, loadColors);
+        kept = end - done;
+        memmove(buffer.data(), done, kept);
+        publish();
+
+        pos += done - begin;
+        if (sz)
+            loaded = pos/sz;
+        if (atEnd)
+            break;
     }
-    while (!line.isNull());
-    loaded = 1.0;
+    endLoad();
 
     IFTRACE(pointcloud)
-        debug() << "Loaded " << count << " points\n";
+        debug() << "Loaded " << parser.count << " points\n";
 }
 
 
-void PointCloud::replyFinished(QNetworkReply *reply)
+void PointCloud::loadFromMemory(const char *begin, const char *end,
+                                bool append)
 // ----------------------------------------------------------------------------
-//   A network reply completed - Process it
+//   Load data from memory (typically a memory-mapped file)
 // ----------------------------------------------------------------------------
 {
+    beginLoad(append);
+
+    // Size storage and VBOs once from a sample of line lengths
+    if (!append)
+    {
+        loadExpected = PointCloudParser::estimateLines(begin, end,
+                                                       end - begin);
+        IFTRACE(pointcloud)
+            debug() << "Expecting about " << loadExpected << " points\n";
+    }
+
+    // Large files are split across worker threads
+    const size_t chunkSize = 16 << 20;
+    PointCloudFactory * fact = PointCloudFactory::instance();
+    if (size_t(end - begin) >= 2 * chunkSize &&
+        fact->workers.maxThreadCount() > 1)
+        return loadChunks(begin, end);
+
+    PointCloudParser parser(loadDataParm);
+
+    // Parse in slices ending on a line boundary to report progress
+    const size_t sliceSize = 1 << 20;
+    double sz = end - begin;
+    const char *pos = begin;
+    loaded = 0.0;
+    while (pos < end)
+    {
+        if (interrupted())
+        {
+            IFTRACE(pointcloud)
+                debug() << "loadData interrupted\n";
+            return;
+        }
+
+        const char *stop = PointCloudParser::slice(pos, end, sliceSize);
+        pos = parser.parse(pos, stop, loadPoints, loadColors);
+        loaded = (pos - begin) / sz;
+        publish();
+    }
+    endLoad();
+
     IFTRACE(pointcloud)
-        debug() << "Loading from network reply\n";
-    if (reply == networkReply)
-        networkReply = NULL;
-    loadFromStream(reply);
-    reply->deleteLater();
+        debug() << "Loaded " << parser.count << " points\n";
 }
 
 
-void PointCloud::run()
+void PointCloud::loadChunks(const char *begin, const char *end)
 // ----------------------------------------------------------------------------
-//   Called in a separate thread to load data asynchronously
+//   Parse chunks of the data in parallel, then append them in file order
 // ----------------------------------------------------------------------------
 {
-    LoadDataParm &p(loadDataParm);
-    loadData(p.file, p.sep, p.xi, p.yi, p.zi, p.colorScale,
-             p.ri, p.gi, p.bi, p.ai, false);
-}
+    PointCloudFactory * fact = PointCloudFactory::instance();
+    ThreadPool &workers = fact->workers;
 
+    // Several chunks per thread balance the load, but keep them reasonable
+    const size_t maxChunkSize = 256 << 20;
+    size_t sz = end - begin;
+    size_t nchunks = 4 * workers.maxThreadCount();
+    if (sz / nchunks > maxChunkSize)
+        nchunks = sz / maxChunkSize + 1;
 
-std::ostream & PointCloud::debug()
-// ----------------------------------------------------------------------------
-//   Convenience method to log with a common prefix
-// ----------------------------------------------------------------------------
-{
-    std::cerr << "[PointCloud] \"" << name << "\" " << (void*)this << " ";
-    return std::cerr;
+    // Split at line boundaries
+    QSemaphore done;
+    QAtomicInt cancel(0);
+    std::vector<PointCloudChunk *> chunks;
+    const char *start = begin;
+    for (size_t i = 1; i <= nchunks && start < end; i++)
+    {
+        const char *stop = i == nchunks ? end
+            : PointCloudParser::nextLine(begin + sz / nchunks * i, end);
+        if (stop <= start)
+            continue;
+        chunks.push_back(new PointCloudChunk(loadDataParm, start, stop,
+                                             done, cancel));
+        start = stop;
+    }
+
+    IFTRACE(pointcloud)
+        debug() << "Parsing " << chunks.size() << " chunks with "
+                << workers.maxThreadCount() << " threads\n";
+
+    int n = chunks.size();
+    for (int i = 0; i < n; i++)
+        workers.start(chunks[i]);
+
+    // Publish chunks in file order as they complete, forwarding interrupts
+    loaded = 0.0;
+    unsigned count = 0;
+    int next = 0;
+    bool finished = false;
+    while (!finished)
+    {
+        finished = done.tryAcquire(n, 50);
+        if (interrupted())
+            cancel.storeRelease(1);
+        if (cancel.loadAcquire())
+            continue;
+
+        qint64 parsed = 0;
+        for (int i = 0; i < n; i++)
+            parsed += chunks[i]->parsed.loadAcquire();
+        loaded = qMin(parsed / double(sz), 0.999);
+
+        while (next < n && chunks[next]->finished.loadAcquire())
+        {
+            PointCloudChunk *chunk = chunks[next++];
+            count += chunk->parser.count;
+            loadPoints.splice(chunk->points);
+            loadColors.splice(chunk->colors);
+            publish();
+        }
+    }
+
+    bool ok = !cancel.loadAcquire();
+    for (int i = 0; i < n; i++)
+        delete chunks[i];
+    if (!ok)
+    {
+        IFTRACE(pointcloud)
+            debug() << "loadData interrupted\n";
+        return;
+    }
+    endLoad();
+
+    IFTRACE(pointcloud)
+        debug() << "Loaded " << count << " points\n";
 }
 
-bool PointCloud::loadInProgress()
+
+void PointCloud::loadNative(const char *begin, const char *end)
 // ----------------------------------------------------------------------------
-//   Is a file currently being loaded?
+//   Load data in native format from memory (typically a memory-mapped file)
 // ----------------------------------------------------------------------------
 {
-    if (networkReply)
+    beginLoad();
+    loaded = 0.0;
+
+    typedef PointCloudFile::Header Header;
+    const Header &h = *((const Header *) begin);
+    if (!PointCloudFile::check(h, end - begin, loadError))
+    {
+        endLoad();
+        return;
+    }
+
+    // Data is stored as in memory, copy it in slices to report progress.
+    // Slices are whole blocks, so publish() and fetchBatches() move them
+    // into the cloud: the mapped data is copied only once.
+    const size_t slice = 1 << 20;
+    size_t count = h.count;
+    const Point *pts = (const Point *) (begin + h.pointOffset);
+    const Color *cols = h.colorFormat
+        ? (const Color *) (begin + h.colorOffset) : NULL;
+    loadExpected = count;
+    for (size_t done = 0; done < count; done += slice)
     {
-        if (networkReply->isRunning())
-            return true;
-        if (networkReply->isFinished())
+        if (interrupted())
         {
-            replyFinished(networkReply);
-            return false;
+            IFTRACE(pointcloud)
+                debug() << "loadData interrupted\n";
+            return;
         }
+
+        size_t n = qMin(slice, count - done);
+        loadPoints.append(pts + done, pts + done + n);
+        if (cols)
+            loadColors.append(cols + done, cols + done + n);
+        loaded = double(done + n) / (count + 1);
+        publish();
     }
+    endLoad();
 
-    return (loaded >= 0 && loaded < 1.0);
+    IFTRACE(pointcloud)
+        debug() << "Loaded " << count << " points (native format)\n";
 }
 
 
-void PointCloud::reload()
+void PointCloud::loadNativeStream(QIODevice *io)
 // ----------------------------------------------------------------------------
-//   Reload data from file
+//   Load data in native format from an I/O device
 // ----------------------------------------------------------------------------
 {
-    IFTRACE(pointcloud)
-        debug() << "Reloading\n";
+    beginLoad();
+    loaded = 0.0;
 
-    clear();
+    typedef PointCloudFile::Header Header;
+    Header h;
+    qint64 sz = io->bytesAvailable();
+    if (io->read((char *) &h, sizeof(h)) != sizeof(h) ||
+        !PointCloudFile::check(h, sz, loadError))
+    {
+        if (loadError == "")
+            loadError = "Invalid point cloud file header";
+        endLoad();
+        return;
+    }
+
+    // Arrays are read directly into place, skipping any padding.
+    // Colors follow all points, so the cloud is published only once at end.
+    qint64 pos = sizeof(h);
+    size_t count = h.count;
+    loadPoints.resize(count, Point(0, 0, 0));
+    if (h.colorFormat)
+        loadColors.resize(count);
+    struct { qint64 offset; bool colors; qint64 size; } arrays[2] =
+    {
+        { qint64(h.pointOffset), false, qint64(count * sizeof(Point)) },
+        { qint64(h.colorOffset), true,
+          h.colorFormat ? qint64(count * sizeof(Color)) : 0 }
+    };
+    if (arrays[1].size && arrays[1].offset < arrays[0].offset)
+        std::swap(arrays[0], arrays[1]);
+
+    const qint64 blockSize = 1 << 20;
+    for (int a = 0; a < 2; a++)
+    {
+        if (!arrays[a].size)
+            continue;
+        while (pos < arrays[a].offset)
+        {
+            qint64 skip = qMin(blockSize, arrays[a].offset - pos);
+            qint64 n = io->read(skip).size();
+            if (n <= 0)
+                return truncatedStream();
+            pos += n;
+        }
+        for (qint64 done = 0; done < arrays[a].size; )
+        {
+            if (interrupted())
+            {
+                IFTRACE(pointcloud)
+                    debug() << "loadData interrupted\n";
+                return;
+            }
+            // Storage is contiguous within blocks only
+            size_t room = qMin(blockSize, arrays[a].size - done);
+            char *data = arrays[a].colors
+                ? loadColors.bytes(done, room)
+                : loadPoints.bytes(done, room);
+            qint64 n = io->read(data, room);
+            if (n <= 0)
+                return truncatedStream();
+            done += n;
+            pos += n;
+            if (sz)
+                loaded = qMin(double(pos) / sz, 0.999);
+        }
+    }
+    endLoad();
+
+    IFTRACE(pointcloud)
+        debug() << "Loaded " << count << " points (native format)\n";
+}
+
+
+void PointCloud::truncatedStream()
+// ----------------------------------------------------------------------------
+//   Abort a native stream load that ended before all its data was read
+// ----------------------------------------------------------------------------
+{
+    loadError = "Point cloud file is truncated";
+    loadPoints.clear();
+    loadColors.clear();
+    endLoad();
+}
+
+
+void PointCloud::loadRecords(PointCloudDecoder &dec,
+                             const char *begin, const char *end)
+// ----------------------------------------------------------------------------
+//   Load records of a binary file from memory (typically memory-mapped)
+// ----------------------------------------------------------------------------
+{
+    beginLoad();
+    loaded = 0.0;
+
+    size_t hsize = dec.headerSize(begin, end);
+    if (!hsize)
+        loadError = +QString("Invalid %1 file header").arg(dec.name());
+    if (!hsize || !dec.header(begin, begin + hsize, loadError))
+    {
+        endLoad();
+        return;
+    }
+
+    const char *pos = begin + hsize;
+    if (quint64(end - pos) < dec.skip)
+        pos = end;
+    else
+        pos += dec.skip;
+
+    loadExpected = qMin(dec.count, quint64((end - pos) / dec.stride));
+    dec.sample(pos, end);
+
+    // Decode in slices of whole records to report progress
+    size_t slice = qMax(size_t(1), size_t(1 << 20) / dec.stride) * dec.stride;
+    double sz = end - begin;
+    while (!dec.done() && size_t(end - pos) >= dec.stride)
+    {
+        if (interrupted())
+        {
+            IFTRACE(pointcloud)
+                debug() << "loadData interrupted\n";
+            return;
+        }
+        const char *stop = size_t(end - pos) > slice ? pos + slice : end;
+        pos = dec.decode(pos, stop, loadPoints, loadColors);
+        loaded = qMin((pos - begin) / sz, 0.999);
+        publish();
+    }
+    if (!dec.done())
+        loadError = +QString("%1 file is truncated").arg(dec.name());
+    endLoad();
+
+    IFTRACE(pointcloud)
+        debug() << "Loaded " << dec.decoded << " points ("
+                << dec.name() << " format)\n";
+}
+
+
+void PointCloud::loadRecordsStream(PointCloudDecoder &dec, QIODevice *io)
+// ----------------------------------------------------------------------------
+//   Load records of a binary file from an I/O device, in large blocks
+// ----------------------------------------------------------------------------
+{
+    beginLoad();
+    loaded = 0.0;
+
+    const int blockSize = 1 << 20;
+    const int maxHeaderSize = 1 << 16;
+    double sz = io->bytesAvailable();
+    double pos = 0.0;
+
+    // Read until we have the whole header
+    QByteArray buffer;
+    size_t hsize = 0;
+    while (!hsize)
+    {
+        QByteArray block = io->read(blockSize);
+        if (block.isEmpty() || buffer.size() > maxHeaderSize)
+            break;
+        buffer.append(block);
+        hsize = dec.headerSize(buffer.constData(),
+                               buffer.constData() + buffer.size());
+    }
+    if (!hsize)
+        loadError = +QString("Invalid %1 file header").arg(dec.name());
+    if (!hsize || !dec.header(buffer.constData(),
+                              buffer.constData() + hsize, loadError))
+    {
+        endLoad();
+        return;
+    }
+    buffer.remove(0, hsize);
+    pos += hsize;
+    loadExpected = qMin(dec.count, quint64(sz / dec.stride));
+
+    // Decode complete records in each block, keep the remainder
+    quint64 skip = dec.skip;
+    while (!dec.done())
+    {
+        if (interrupted())
+        {
+            IFTRACE(pointcloud)
+                debug() << "loadData interrupted\n";
+            return;
+        }
+
+        if (skip)
+        {
+            int drop = qMin(quint64(buffer.size()), skip);
+            buffer.remove(0, drop);
+            skip -= drop;
+            pos += drop;
+        }
+        if (!skip)
+        {
+            const char *begin = buffer.constData();
+            const char *end = begin + buffer.size();
+            const char *done = dec.decode(begin, end, loadPoints, loadColors);
+            buffer.remove(0, done - begin);
+            pos += done - begin;
+            publish();
+        }
+        if (sz)
+            loaded = qMin(pos / sz, 0.999);
+        if (dec.done())
+            break;
+
+        int kept = buffer.size();
+        buffer.resize(kept + blockSize);
+        qint64 n = io->read(buffer.data() + kept, blockSize);
+        buffer.resize(kept + qMax(n, qint64(0)));
+        if (n <= 0)
+            break;
+    }
+    if (!dec.done())
+        loadError = +QString("%1 file is truncated").arg(dec.name());
+    endLoad();
+
+    IFTRACE(pointcloud)
+        debug() << "Loaded " << dec.decoded << " points ("
+                << dec.name() << " format)\n";
+}
+
+
+void PointCloud::beginLoad(bool append)
+// ----------------------------------------------------------------------------
+//   Start a load, the first batch published replaces existing points
+// ----------------------------------------------------------------------------
+{
+    loadPoints.clear();
+    loadColors.clear();
+    loadError.clear();
+    loadExpected = 0;
+    loadReset = !append;
+    loadShadow = !append && shadowReload;
+    shadowReload = false;
+
+    // Points of a conversion go to the tree file instead of the cloud
+    delete treeBuilder;
+    treeBuilder = NULL;
+    if (loadDataParm.tree != "" && !append)
+        treeBuilder = new PointCloudTreeBuilder(absolutePath(loadDataParm.tree),
+                                                this);
+}
+
+
+void PointCloud::publish()
+// ----------------------------------------------------------------------------
+//   Publish the points decoded so far by the loader
+// ----------------------------------------------------------------------------
+{
+    publish(loadPoints, loadColors);
+}
+
+
+void PointCloud::publish(point_vec &points, color_vec &colors, bool last)
+// ----------------------------------------------------------------------------
+//   Hand over a batch of points to the main thread, which will draw them
+// ----------------------------------------------------------------------------
+//   Full blocks of data are moved into the batch, the arguments keep the
+//   points of their last partial block until the last batch. Batches thus
+//   end on block boundaries, so that fetchBatches() moves their blocks into
+//   the cloud instead of copying points.
+//   A load in progress can only be appended to, so that the main thread
+//   may upload new points to the GPU without touching the others.
+//   Batches are never modified once published. They are pushed with release
+//   semantics on a lock-free list, so that neither the loader nor the main
+//   thread ever waits for the other.
+//   prepareBatch() lets derived classes do their own share of the work on
+//   the batch here, in the loader thread.
+{
+    text tree;
+    if (treeBuilder)
+    {
+        // Only the last batch is published, to draw the tree
+        treeBuilder->add(points, colors);
+        point_vec().swap(points);
+        color_vec().swap(colors);
+        if (!last || interrupted())
+            return;
+        if (treeBuilder->finish())
+            tree = loadDataParm.tree;
+        else
+            loadError = treeBuilder->error;
+        delete treeBuilder;
+        treeBuilder = NULL;
+        appendOffset = -1;
+        loadExpected = 0;
+    }
+
+    if (points.size() < point_vec::BLOCK && !last)
+        return;
+
+    Batch *batch = new Batch;
+    if (last)
+    {
+        batch->points.swap(points);
+        batch->colors.swap(colors);
+    }
+    else
+    {
+        batch->points.spliceBlocks(points);
+        batch->colors.spliceBlocks(colors);
+    }
+    prepareBatch(batch);
+    batch->error = loadError;
+    batch->reset = loadReset;
+    batch->shadow = loadShadow;
+    batch->last = last;
+    batch->appendable = appendOffset >= 0;
+    batch->expected = loadExpected;
+    batch->tree = tree;
+    loadError.clear();
+    loadReset = false;
+
+    Batch *head;
+    do
+    {
+        head = batches.loadAcquire();
+        batch->next = head;
+    } while (!batches.testAndSetRelease(head, batch));
+}
+
+
+void PointCloud::endLoad()
+// ----------------------------------------------------------------------------
+//   Publish the last points of a load and mark it as complete
+// ----------------------------------------------------------------------------
+//   When a download failed, its error replaces whatever the loader reported
+//   about the partial data it received.
+{
+    if (stream)
+    {
+        QString err = stream->error();
+        if (!err.isEmpty())
+            loadError = +err;
+    }
+    publish(loadPoints, loadColors, true);
+    loaded = 1.0;
+}
+
+
+bool PointCloud::fetchBatches()
+// ----------------------------------------------------------------------------
+//   Append batches published by a loader to the cloud (main thread only)
+// ----------------------------------------------------------------------------
+{
+    if (QThread::currentThread() != qApp->thread())
+        return false;
+
+    // Take all published batches at once, and put them back in order
+    Batch *list = batches.fetchAndStoreAcquire(NULL);
+    if (!list)
+        return false;
+    Batch *ready = NULL;
+    unsigned count = 0;
+    while (list)
+    {
+        Batch *next = list->next;
+        list->next = ready;
+        ready = list;
+        list = next;
+        count++;
+    }
+
+    unsigned first = points.size();
+    while (Batch *batch = ready)
+    {
+        ready = batch->next;
+        if (batch->error != "")
+            error = batch->error;
+        if (batch->last)
+            appendable = batch->appendable;
+        if (batch->last && batch->tree != "" &&
+            openTree(absolutePath(batch->tree)))
+            file = batch->tree;
+        if (batch->reset)
+        {
+            shadowing = batch->shadow;
+            expected = batch->expected;
+            if (shadowing)
+            {
+                backReset();
+            }
+            else
+            {
+                // Drop what an interrupted reload left in back buffers
+                dropIndex();
+                point_vec().swap(backPoints);
+                color_vec().swap(backColors);
+                first = 0;
+            }
+        }
+
+        point_vec &pts = shadowing ? backPoints : points;
+        color_vec &cols = shadowing ? backColors : colors;
+        unsigned at = batch->reset ? 0 : pts.size();
+        if (batch->reset)
+        {
+            point_vec().swap(pts);
+            color_vec().swap(cols);
+        }
+
+        // Batches end on block boundaries: their blocks are moved, not copied
+        pts.splice(batch->points);
+        cols.splice(batch->colors);
+        batchFetched(batch, at, shadowing);
+
+        if (batch->last && shadowing)
+        {
+            // Show the new data, then release the old one
+            IFTRACE(pointcloud)
+                debug() << "Swapping " << backPoints.size()
+                        << " points loaded in back buffers\n";
+            dropIndex();
+            points.swap(backPoints);
+            colors.swap(backColors);
+            dataSwapped();
+            point_vec().swap(backPoints);
+            color_vec().swap(backColors);
+            shadowing = false;
+            first = points.size();
+        }
+        delete batch;
+    }
+
+    IFTRACE(pointcloud)
+        debug() << "Fetched " << count << " batches, "
+                << points.size() << " points\n";
+
+    dataAppended(first);
+    return true;
+}
+
+
+void PointCloud::checkIndex()
+// ----------------------------------------------------------------------------
+//   Pick up a new octree, or index the points loaded or added since the last
+// ----------------------------------------------------------------------------
+{
+    if (indexing)
+    {
+        if (PointCloudOctree *tree = indexer->take())
+        {
+            delete octree;
+            octree = tree;
+            indexing = false;
+            tailScanned = octree->count;
+            tailLo = Point(FLT_MAX, FLT_MAX, FLT_MAX);
+            tailHi = Point(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+            indexChanged();
+        }
+    }
+    if (isOptimized())
+        return;
+
+    // Keep the bounds of the tail up to date as points are added
+    unsigned n = points.size();
+    for (; tailScanned < n; tailScanned++)
+    {
+        const Point &p = points[tailScanned];
+        tailLo.x = qMin(tailLo.x, p.x); tailHi.x = qMax(tailHi.x, p.x);
+        tailLo.y = qMin(tailLo.y, p.y); tailHi.y = qMax(tailHi.y, p.y);
+        tailLo.z = qMin(tailLo.z, p.z); tailHi.z = qMax(tailHi.z, p.z);
+    }
+
+    // Rebuild once the tail is a significant part of the cloud
+    unsigned indexed = octree ? octree->count : 0;
+    if (indexing || loadInProgress() || n < PointCloudIndex::MIN_POINTS ||
+        n - indexed <= indexed / 4)
+        return;
+    IFTRACE(pointcloud)
+        debug() << "Indexing " << n << " points, "
+                << n - indexed << " not indexed\n";
+    if (!indexer)
+        indexer = new PointCloudIndex;
+    indexer->build(points);
+    indexing = true;
+}
+
+
+void PointCloud::dropIndex()
+// ----------------------------------------------------------------------------
+//   Forget the octree and stop any build, before points are freed
+// ----------------------------------------------------------------------------
+{
+    if (indexer)
+        indexer->stop();
+    indexing = false;
+    if (octree)
+    {
+        delete octree;
+        octree = NULL;
+        indexChanged();
+    }
+    tailScanned = 0;
+    tailLo = Point(FLT_MAX, FLT_MAX, FLT_MAX);
+    tailHi = Point(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+}
+
+
+bool PointCloud::openTree(text path)
+// ----------------------------------------------------------------------------
+//   Draw the cloud from a tree file from now on
+// ----------------------------------------------------------------------------
+{
+    PointCloudTree *opened = new PointCloudTree(path);
+    text err;
+    if (!opened->open(err))
+    {
+        error = +QString("%1: %2").arg(+err).arg(+path);
+        delete opened;
+        return false;
+    }
+    dropTree();
+    tree = opened;
+    return true;
+}
+
+
+void PointCloud::dropTree()
+// ----------------------------------------------------------------------------
+//   Stop drawing from a tree file, and release its nodes
+// ----------------------------------------------------------------------------
+{
+    delete tree;
+    tree = NULL;
+}
+
+
+bool PointCloud::buildTree(text target, text file, text sep,
+                           int xi, int yi, int zi, float colorScale,
+                           float ri, float gi, float bi, float ai)
+// ----------------------------------------------------------------------------
+//   Convert a cloud to a tree file in a thread, then draw from the tree
+// ----------------------------------------------------------------------------
+//   The tree is drawn right away if it is more recent than the source.
+{
+    XL_ASSERT(folder != "");
+    QFileInfo out(+absolutePath(target));
+    QFileInfo in(+absolutePath(file));
+    if (out.exists() &&
+        (!in.exists() || out.lastModified() >= in.lastModified()))
+        return loadData(target, "", 0, 0, 0);
+
+    // Do not restart a conversion in progress, or one that failed
+    if (loadDataParm.tree == target && this->file == file)
+        return false;
+
+    buildTarget = target;
+    this->file = ""; // Or loadData() would do nothing
+    return loadData(file, sep, xi, yi, zi, colorScale, ri, gi, bi, ai, true);
+}
+
+
+bool PointCloud::save(text file)
+// ----------------------------------------------------------------------------
+//   Save the cloud in native format
+// ----------------------------------------------------------------------------
+{
+    if (loadInProgress())
+    {
+        error = "Cannot save cloud while it is being loaded";
+        return false;
+    }
+    return saveData(file, points, colors);
+}
+
+
+bool PointCloud::saveData(text file,
+                          const point_vec &points, const color_vec &colors)
+// ----------------------------------------------------------------------------
+//   Write given points and colors to a file in native format
+// ----------------------------------------------------------------------------
+//   The file is written under a temporary name and only replaces an
+//   existing one once complete, so that a failed save keeps the old file.
+{
+    text path = absolutePath(file);
+    QSaveFile f(+path);
+    if (!f.open(QIODevice::WriteOnly))
+    {
+        error = +QString("Cannot write file: %1").arg(+path);
+        return false;
+    }
+
+    IFTRACE(pointcloud)
+        debug() << "Saving " << points.size() << " points to " << path << "\n";
+
+    if (!PointCloudFile::write(&f, points, colors, error))
+    {
+        f.cancelWriting();
+        return false;
+    }
+    if (!f.commit())
+    {
+        error = +QString("Cannot write file: %1").arg(+path);
+        return false;
+    }
+    return true;
+}
+
+
+text PointCloud::absolutePath(text file)
+// ----------------------------------------------------------------------------
+//   Path of a file relative to the folder of the document
+// ----------------------------------------------------------------------------
+{
+    QString qf = QString::fromUtf8(folder.data(), folder.length());
+    QString qn = QString::fromUtf8(file.data(), file.length());
+    QFileInfo inf(QDir(qf), qn);
+    return +QDir::toNativeSeparators(inf.absoluteFilePath());
+}
+
+
+void PointCloud::run()
+// ----------------------------------------------------------------------------
+//   Called in a separate thread to load data asynchronously
+// ----------------------------------------------------------------------------
+{
+    if (stream)
+    {
+        IFTRACE(pointcloud)
+            debug() << "Loading from network\n";
+        appendOffset = -1;
+        return loadFromStream(stream);
+    }
+    if (appending)
+    {
+        appending = false;
+        return loadAppended();
+    }
+    loadLocal();
+}
+
+
+std::ostream & PointCloud::debug()
+// ----------------------------------------------------------------------------
+//   Convenience method to log with a common prefix
+// ----------------------------------------------------------------------------
+{
+    std::cerr << "[PointCloud] \"" << name << "\" " << (void*)this << " ";
+    return std::cerr;
+}
+
+bool PointCloud::loadInProgress()
+// ----------------------------------------------------------------------------
+//   Is a file currently being loaded?
+// ----------------------------------------------------------------------------
+{
+    return (loaded >= 0 && loaded < 1.0);
+}
+
+
+void PointCloud::startLoad()
+// ----------------------------------------------------------------------------
+//   Run the loader in a pool thread
+// ----------------------------------------------------------------------------
+//   Downloads wait for the network most of the time, so they have their own
+//   threads and cannot hold back file loads and index builds.
+{
+    PointCloudFactory * fact = PointCloudFactory::instance();
+    if (stream)
+        fact->downloads.start(this);
+    else
+        fact->pool.start(this);
+}
+
+
+void PointCloud::closeStream()
+// ----------------------------------------------------------------------------
+//   Stop loading from the network and release the reply
+// ----------------------------------------------------------------------------
+{
+    if (!stream)
+        return;
+    interrupt();
+    delete stream;
+    stream = NULL;
+}
+
+
+void PointCloud::reload()
+// ----------------------------------------------------------------------------
+//   Reload data from file
+// ----------------------------------------------------------------------------
+{
+    // A text file that was loaded completely may only have grown
+    if (appendable && !isOptimized() && !loadInProgress())
+    {
+        IFTRACE(pointcloud)
+            debug() << "Checking for lines added\n";
+        interrupt();
+        appending = true;
+        startLoad();
+        return;
+    }
+
+    IFTRACE(pointcloud)
+        debug() << "Reloading\n";
+
+    // Keep showing current points until the new ones are all loaded
+    interrupt();
+    shadowReload = true;
     file = ""; // Or loadData() would do nothing
+    buildTarget = loadDataParm.tree;
     LoadDataParm &p(loadDataParm);
     loadData(p.file, p.sep, p.xi, p.yi, p.zi, p.colorScale,
              p.ri, p.gi, p.bi, p.ai, true);
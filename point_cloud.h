@@ -40,6 +40,7 @@
 // *****************************************************************************
 
 #include "thread_pool.h"
+#include "block_vector.h"
 #include "basics.h"  // From XLR
 #include "tao/tao_gl.h"
 #include "tao/module_api.h"
@@ -47,8 +48,20 @@
 #include <QRunnable>
 #include <QNetworkAccessManager>
 #include <QNetworkReply>
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include <QByteArray>
+#include <cstring>
 #include <vector>
 
+class PointCloudDecoder;
+class PointCloudStream;
+class PointCloudIndex;
+struct PointCloudOctree;
+class PointCloudTree;
+class PointCloudTreeBuilder;
+class QFile;
+
 
 struct PointCloud : Runnable
 // ----------------------------------------------------------------------------
@@ -83,17 +96,85 @@ public:
             : file(file), sep(sep), xi(xi), yi(yi), zi(zi),
               colorScale(colorScale), ri(ri), gi(gi), bi(bi), ai(ai) {}
         text  file, sep;
+        text  tree;     // Tree file the points are converted to, or ""
         int   xi, yi, zi;
         float colorScale, ri, gi, bi, ai;
     };
+    typedef BlockVector<Point>  point_vec;
+    typedef BlockVector<Color>  color_vec;
+    struct Batch
+    {
+        Batch() : next(NULL), reset(false), shadow(false), last(false),
+                  appendable(false), expected(0), format(0) {}
+        Batch *   next;
+        point_vec points;
+        color_vec colors;
+        QByteArray vertices; // Points and colors encoded by prepareBatch()
+        text      error;    // Error detected by the loader
+        bool      reset;    // Replace existing points instead of appending
+        bool      shadow;   // With reset, load into back buffers
+        bool      last;     // Last batch of a load
+        bool      appendable; // With last, lines added later can be loaded
+        unsigned  expected; // With reset, total number of points expected
+        int       format;   // Layout of vertices, see prepareBatch()
+        text      tree;     // With last, tree file to draw from now on
+    };
+    struct Progress
+    {
+        Progress(float value) { *this = value; }
+        Progress &operator =(float value)
+        {
+            int b;
+            memcpy(&b, &value, sizeof(b));
+            bits.storeRelease(b);
+            return *this;
+        }
+        operator float() const
+        {
+            int b = bits.loadAcquire();
+            float value;
+            memcpy(&value, &b, sizeof(value));
+            return value;
+        }
+        QAtomicInt bits;
+    };
+    struct Style
+    {
+        // GL state set up once for all clouds drawn with the same style
+        float pointSize;
+        bool  sprites, programmable, colored, shaders;
+        bool  operator<(const Style &o) const
+        {
+            if (shaders != o.shaders)
+                return shaders < o.shaders;
+            if (pointSize != o.pointSize)
+                return pointSize < o.pointSize;
+            if (sprites != o.sprites)
+                return sprites < o.sprites;
+            if (programmable != o.programmable)
+                return programmable < o.programmable;
+            return colored < o.colored;
+        }
+        bool  operator!=(const Style &o) const
+        {
+            return *this < o || o < *this;
+        }
+    };
 
 public:
     virtual unsigned  size();
     virtual bool      addPoint(const Point &p, Color c = Color());
+    virtual bool      addPoints(point_vec &p, color_vec &c);
     virtual void      removePoints(unsigned n);
     virtual void      draw();
+    virtual bool      prepareDraw();
+    virtual Style     style(bool documentProgram);
+    virtual void      drawStyled(const Style &style);
+    static bool       documentProgram();
+    static void       beginStyle(const Style &style);
+    static void       endStyle(const Style &style);
     virtual bool      optimize() { return false; }
-    virtual bool      isOptimized() { return false; }
+    virtual bool      isOptimized() { return tree != NULL; }
     virtual void      clear();
     virtual bool      randomPoints(unsigned n, bool colored = false);
     virtual bool      loadData(text file, text sep, int xi, int yi, int zi,
@@ -102,26 +183,70 @@ public:
                                float bi = -1.0, float ai = -1.0,
                                bool async = false);
     virtual bool      colored() { return (colors.size() != 0); }
+    virtual bool      save(text file);
+    bool              buildTree(text target, text file, text sep,
+                                int xi, int yi, int zi,
+                                float colorScale = 0.0,
+                                float ri = -1.0, float gi = -1.0,
+                                float bi = -1.0, float ai = -1.0);
     virtual void      run();  // From Runnable
 
 public:
     text       error;
-    float      loaded;  // -1.0 default, [0.0..1.0[ loading, 1.0 loaded
+    Progress   loaded;  // -1.0 default, [0.0..1.0[ loading, 1.0 loaded
     text       folder;  // When cloud is loaded from a file
     float      pointSize;
     bool       pointSprites;
     bool       pointProgrammableSize;
-
-protected:
-    typedef std::vector<Point>  point_vec;
-    typedef std::vector<Color>  color_vec;
+    bool       compactPoints;   // GPU positions as 16-bit integers
+    bool       compactColors;   // GPU colors as 8-bit RGBA
+    bool       interleaved;     // GPU positions and colors in one buffer
+    unsigned   pointBudget;     // Points drawn per frame, 0 for all
+    unsigned   treeMemory;      // MB of nodes of a tree kept in memory
+    unsigned   treeVideoMemory; // MB of nodes of a tree kept in VBOs
+    unsigned   uploadBudget;    // MB uploaded to VBOs per frame, 0 for all
+    bool       shaders;         // Draw VBOs with a VAO and shaders
 
 protected:
     virtual std::ostream &  debug();
     bool                    loadInProgress();
     void                    reload();
+    void                    startLoad();
     void                    loadFromStream(QIODevice *io);
-    void                    replyFinished(QNetworkReply *);
+    void                    loadLocal();
+    void                    loadFile(QFile &f);
+    void                    loadAppended();
+    void                    loadFromMemory(const char *begin, const char *end,
+                                           bool append = false);
+    void                    loadChunks(const char *begin, const char *end);
+    void                    loadNative(const char *begin, const char *end);
+    void                    loadNativeStream(QIODevice *io);
+    void                    truncatedStream();
+    void                    loadRecords(PointCloudDecoder &decoder,
+                                        const char *begin, const char *end);
+    void                    loadRecordsStream(PointCloudDecoder &decoder,
+                                              QIODevice *io);
+    bool                    saveData(text file, const point_vec &points,
+                                     const color_vec &colors);
+    text                    absolutePath(text file);
+    static quint64          checksum(const char *begin, qint64 offset);
+    void                    beginLoad(bool append = false);
+    void                    publish();
+    void                    publish(point_vec &points, color_vec &colors,
+                                    bool last = false);
+    void                    endLoad();
+    bool                    fetchBatches();
+    virtual void            prepareBatch(Batch *) {}
+    virtual void            batchFetched(Batch *, unsigned, bool) {}
+    virtual void            dataAppended(unsigned) {}
+    virtual void            backReset() {}
+    virtual void            dataSwapped() {}
+    void                    closeStream();
+    void                    checkIndex();
+    void                    dropIndex();
+    virtual void            indexChanged() {}
+    bool                    openTree(text path);
+    void                    dropTree();
 
 protected:
     static void             fileChanged(std::string path,
@@ -133,14 +258,50 @@ protected:
     text       name;
     point_vec  points;
     color_vec  colors;
+    unsigned   expected;        // Final size of a load in progress, if known
+
+    // Reloads are built in back buffers, then swapped with points and colors
+    point_vec  backPoints;
+    color_vec  backColors;
+    bool       shadowing;       // Back buffers are being loaded
+    bool       shadowReload;    // Next load goes to back buffers
+
+    // Loader side of progressive loads, published as batches to draw().
+    // Only the loader thread touches these, until they are published.
+    point_vec  loadPoints;
+    color_vec  loadColors;
+    text       loadError;
+    unsigned   loadExpected;
+    bool       loadReset;
+    bool       loadShadow;
+    qint64     appendOffset;    // End of lines loaded, -1 to reload all
+    quint64    appendChecksum;  // Checksum of the bytes before appendOffset
+
+    // Batches published and not yet fetched, most recent first
+    QAtomicPointer<Batch> batches;
+
+    // Spatial index of the first points, built after loads. Points added
+    // later are in the tail, until there are enough of them to rebuild it.
+    PointCloudIndex  *indexer;
+    PointCloudOctree *octree;
+    bool       indexing;        // indexer is building a new octree
+    Point      tailLo, tailHi;  // Bounds of the points not in octree
+    unsigned   tailScanned;     // Points included in tailLo..tailHi
+
+    // Out-of-core cloud drawn instead of points, and conversion to a tree
+    PointCloudTree        *tree;
+    PointCloudTreeBuilder *treeBuilder; // Loader side of a conversion
+    text       buildTarget;     // Tree file the next loadData() builds
 
     // When cloud is loaded from a file
     text       file;
     void     * fileMonitor;
+    bool       appendable;      // Lines added to the file can be loaded
+    bool       appending;       // Next run() loads the lines added
 
     // When cloud is loaded from a URL
     QNetworkAccessManager *network;
-    QNetworkReply         *networkReply;
+    PointCloudStream      *stream;
 
     // When cloud is random
     unsigned   nbRandom;
@@ -40,8 +40,17 @@ MODINSTDIR = point_cloud
 include(../modules.pri)
 
 HEADERS     = point_cloud.h point_cloud_vbo.h point_cloud_factory.h \
-              thread_pool.h
-SOURCES     = point_cloud.cpp point_cloud_vbo.cpp point_cloud_factory.cpp
+              point_cloud_decoder.h point_cloud_file.h point_cloud_las.h \
+              point_cloud_parser.h point_cloud_ply.h point_cloud_stream.h \
+              point_cloud_index.h point_cloud_view.h point_cloud_tree.h \
+              point_cloud_shader.h point_cloud_pack.h \
+              thread_pool.h block_vector.h
+SOURCES     = point_cloud.cpp point_cloud_vbo.cpp point_cloud_factory.cpp \
+              point_cloud_file.cpp point_cloud_las.cpp \
+              point_cloud_parser.cpp point_cloud_ply.cpp \
+              point_cloud_stream.cpp point_cloud_index.cpp \
+              point_cloud_view.cpp point_cloud_tree.cpp \
+              point_cloud_shader.cpp point_cloud_pack.cpp
 TBL_SOURCES = point_cloud.tbl
 OTHER_FILES = point_cloud.xl point_cloud.tbl traces.tbl
 QT         += core opengl network
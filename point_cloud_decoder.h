@@ -0,0 +1,93 @@
+#ifndef POINT_CLOUD_DECODER_H
+#define POINT_CLOUD_DECODER_H
+// *****************************************************************************
+// point_cloud_decoder.h                                           Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Common interface for binary point cloud file formats.
+//
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include "point_cloud.h"
+
+
+class PointCloudDecoder
+// ----------------------------------------------------------------------------
+//    Base class for formats made of a header followed by fixed-size records
+// ----------------------------------------------------------------------------
+//    Decoders only see byte ranges, so that PointCloud can feed them
+//    either from a memory-mapped file or from blocks read from a device.
+{
+public:
+    typedef PointCloud::Point       Point;
+    typedef PointCloud::Color       Color;
+    typedef PointCloud::point_vec   point_vec;
+    typedef PointCloud::color_vec   color_vec;
+
+public:
+    PointCloudDecoder()
+        : count(0), decoded(0), stride(0), skip(0), colored(false) {}
+    virtual ~PointCloudDecoder() {}
+
+public:
+    // Name of the format, for traces
+    virtual const char *  name() = 0;
+
+    // Size of the header if [begin, end) contains all of it, otherwise 0
+    virtual size_t        headerSize(const char *begin, const char *end) = 0;
+
+    // Parse the header, setting count, stride, skip and colored
+    virtual bool          header(const char *begin, const char *end,
+                                 text &error) = 0;
+
+    // Look at the records in [begin, end) before decoding, when all of
+    // them are in memory at once (not when reading from a device)
+    virtual void          sample(const char *begin, const char *end)
+    {
+        Q_UNUSED(begin);
+        Q_UNUSED(end);
+    }
+
+    // Decode all complete records in [begin, end), return where we stopped
+    virtual const char *  decode(const char *begin, const char *end,
+                                 point_vec &points, color_vec &colors) = 0;
+
+    bool                  done() { return decoded >= count; }
+
+public:
+    quint64       count;        // Number of records in the file
+    quint64       decoded;      // Number of records decoded so far
+    size_t        stride;       // Size of a record in bytes
+    quint64       skip;         // Bytes between header and first record
+    bool          colored;
+};
+
+#endif // POINT_CLOUD_DECODER_H
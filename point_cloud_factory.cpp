@@ -39,9 +39,11 @@
 
 #include "point_cloud_factory.h"
 #include "point_cloud.h"
+#include "point_cloud_shader.h"
 #include "point_cloud_vbo.h"
 #include "graphic_state.h"
 #include <QEvent>
+#include <algorithm>
 
 
 PointCloudFactory * PointCloudFactory::factory = NULL;
@@ -51,12 +53,21 @@ PointCloudFactory::PointCloudFactory(const Tao::ModuleApi *tao)
 // ----------------------------------------------------------------------------
 //   Constructor
 // ----------------------------------------------------------------------------
-    : tao(tao)
+    : tao(tao), shader(new PointCloudShader),
+      downloads(DOWNLOADS), indexes(1), workers(QThread::idealThreadCount()),
+      generation(1)
 {
     QString extensions((const char *)glGetString(GL_EXTENSIONS));
     vboSupported = extensions.contains("ARB_vertex_buffer_object");
+    mapRangeSupported = extensions.contains("ARB_map_buffer_range");
+    const GLubyte *glsl = glGetString(GL_SHADING_LANGUAGE_VERSION);
+    shadersSupported = (vboSupported && glsl != NULL &&
+                        extensions.contains("ARB_vertex_array_object"));
     IFTRACE(pointcloud)
-        sdebug() << "VBO supported: " << vboSupported << "\n";
+        sdebug() << "VBO supported: " << vboSupported
+                 << ", map buffer range supported: " << mapRangeSupported
+                 << ", shaders supported: " << shadersSupported
+                 << "\n";
 }
 
 
@@ -104,6 +115,7 @@ PointCloud * PointCloudFactory::cloud(text name, LookupMode mode)
                 delete cloud;
                 cloud = new PointCloudVBO(name);
                 clouds[name] = cloud;
+                generation++;
             }
         }
     }
@@ -111,20 +123,86 @@ PointCloud * PointCloudFactory::cloud(text name, LookupMode mode)
     {
         cloud = new PointCloudVBO(name);
         clouds[name] = cloud;
+        generation++;
     }
     return cloud;
 }
 
 
+typedef std::pair<PointCloud::Style, PointCloud *> StyledCloud;
+
+static bool byStyle(const StyledCloud &a, const StyledCloud &b)
+// ----------------------------------------------------------------------------
+//   Order clouds by the GL state they are drawn with
+// ----------------------------------------------------------------------------
+{
+    return a.first < b.first;
+}
+
+
+void PointCloudFactory::draw(const std::vector<PointCloud *> &shown)
+// ----------------------------------------------------------------------------
+//   Draw clouds, setting up the GL state once for each style
+// ----------------------------------------------------------------------------
+//   Consecutive clouds with the same point size, sprites, colors and
+//   program share one beginStyle() / endStyle() pair. Clouds are only
+//   grouped by style across the list when the result does not depend on
+//   the order they are drawn in, i.e. with depth test and no blending.
+//   Otherwise, they are drawn in order, as each one blends with those
+//   drawn before it. The program of the document and the blending state
+//   are read once for all clouds.
+{
+    if (shown.size() == 1)
+        return shown[0]->draw();
+
+    bool program = PointCloud::documentProgram();
+    std::vector<StyledCloud> batch;
+    batch.reserve(shown.size());
+    for (size_t c = 0; c < shown.size(); c++)
+        if (shown[c]->prepareDraw())
+            batch.push_back(StyledCloud(shown[c]->style(program), shown[c]));
+    bool reorder = !glIsEnabled(GL_BLEND) && glIsEnabled(GL_DEPTH_TEST);
+    if (reorder)
+        std::stable_sort(batch.begin(), batch.end(), byStyle);
+
+    for (size_t c = 0; c < batch.size(); c++)
+    {
+        const PointCloud::Style &style = batch[c].first;
+        if (c == 0 || style != batch[c-1].first)
+        {
+            if (c > 0)
+                PointCloud::endStyle(batch[c-1].first);
+            PointCloud::beginStyle(style);
+        }
+        batch[c].second->drawStyled(style);
+    }
+    if (!batch.empty())
+        PointCloud::endStyle(batch.back().first);
+
+    IFTRACE(pointcloud)
+        sdebug() << "Drew " << batch.size() << " of " << shown.size()
+                 << " clouds\n";
+}
+
+
 void PointCloudFactory::render_callback(void *arg)
 // ----------------------------------------------------------------------------
-//   Find point cloud by name and draw it
+//   Find point clouds by name and draw them
 // ----------------------------------------------------------------------------
+//   Names are only looked up again when clouds were created or deleted.
 {
-    text name = text((const char *)arg);
-    PointCloud * cloud = PointCloudFactory::instance()->cloud(name);
-    if (cloud)
-        cloud->draw();
+    Shown *shown = (Shown *) arg;
+    PointCloudFactory *f = PointCloudFactory::instance();
+    if (shown->generation != f->generation)
+    {
+        shown->clouds.clear();
+        for (size_t n = 0; n < shown->names.size(); n++)
+            if (PointCloud *cloud = f->cloud(shown->names[n]))
+                shown->clouds.push_back(cloud);
+        shown->generation = f->generation;
+    }
+    if (!shown->clouds.empty())
+        f->draw(shown->clouds);
 }
 
 
@@ -139,10 +217,10 @@ void PointCloudFactory::identify_callback(void *arg)
 
 void PointCloudFactory::delete_callback(void *arg)
 // ----------------------------------------------------------------------------
-//   Delete point cloud name
+//   Delete point cloud names
 // ----------------------------------------------------------------------------
 {
-    free(arg);
+    delete (Shown *) arg;
 }
 
 
@@ -157,6 +235,7 @@ XL::Name_p PointCloudFactory::cloud_drop(text name)
     {
         PointCloud *s = (*found).second;
         f->clouds.erase(found);
+        f->generation++;
         delete s;
         return XL::xl_true;
     }
@@ -179,6 +258,7 @@ XL::Name_p PointCloudFactory::cloud_only(text name)
         {
             PointCloud *s = (*v).second;
             f->clouds.erase(v);
+            f->generation++;
             delete s;
             n = f->clouds.begin();
         }
@@ -196,9 +276,67 @@ XL::name_p PointCloudFactory::cloud_show(text name)
 //   Show point cloud
 // ----------------------------------------------------------------------------
 {
+    Shown *shown = new Shown;
+    shown->names.push_back(name);
+    shown->generation = 0;
+    instance()->tao->AddToLayout2(PointCloudFactory::render_callback,
+                                  PointCloudFactory::identify_callback,
+                                  shown,
+                                  PointCloudFactory::delete_callback);
+    return XL::xl_true;
+}
+
+
+static bool names(XL::Tree *t, std::vector<text> &values)
+// ----------------------------------------------------------------------------
+//   Append the texts of a comma-separated list, false if not all texts
+// ----------------------------------------------------------------------------
+{
+    while (t)
+    {
+        if (XL::Infix *infix = t->AsInfix())
+        {
+            if (infix->name != "," || !names(infix->left, values))
+                return false;
+            t = infix->right;
+        }
+        else if (XL::Block *block = t->AsBlock())
+        {
+            t = block->child;
+        }
+        else if (XL::Text *txt = t->AsText())
+        {
+            values.push_back(txt->value);
+            return true;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return false;
+}
+
+
+XL::Name_p PointCloudFactory::clouds_show(XL::Tree_p self, XL::Tree_p list)
+// ----------------------------------------------------------------------------
+//   Show several point clouds, drawn together
+// ----------------------------------------------------------------------------
+//   Unlike a sequence of cloud_show, the GL state is set up once for all
+//   clouds drawn with the same style, see draw().
+{
+    Q_UNUSED(self);
+    Shown *shown = new Shown;
+    if (!names(list, shown->names))
+    {
+        delete shown;
+        XL::Ooops("PointsCloud: Expected a list of cloud names in $1", list);
+        return XL::xl_false;
+    }
+    shown->generation = 0;
     instance()->tao->AddToLayout2(PointCloudFactory::render_callback,
                                   PointCloudFactory::identify_callback,
-                                  strdup(name.c_str()),
+                                  shown,
                                   PointCloudFactory::delete_callback);
     return XL::xl_true;
 }
@@ -266,6 +404,141 @@ XL::Name_p PointCloudFactory::cloud_add(XL::Tree_p self,
 }
 
 
+struct PointSink
+// ----------------------------------------------------------------------------
+//   Group numbers three by three into points
+// ----------------------------------------------------------------------------
+{
+    PointSink(PointCloud::point_vec &points): points(points), count(0) {}
+    void add(float x)
+    {
+        v[count++ % 3] = x;
+        if (count % 3 == 0)
+            points.push_back(PointCloud::Point(v[0], v[1], v[2]));
+    }
+
+    PointCloud::point_vec &points;
+    float                  v[3];
+    size_t                 count;   // Numbers received
+};
+
+
+struct ColorSink
+// ----------------------------------------------------------------------------
+//   Group numbers four by four into colors
+// ----------------------------------------------------------------------------
+{
+    ColorSink(PointCloud::color_vec &colors): colors(colors), count(0) {}
+    void add(float x)
+    {
+        v[count++ % 4] = x;
+        if (count % 4 == 0)
+            colors.push_back(PointCloud::Color(v[0], v[1], v[2], v[3]));
+    }
+
+    PointCloud::color_vec &colors;
+    float                  v[4];
+    size_t                 count;   // Numbers received
+};
+
+
+template <class Sink>
+static bool numbers(XL::Tree *t, Sink &sink, bool negate = false)
+// ----------------------------------------------------------------------------
+//   Add the numbers of a comma-separated list, false if not all numbers
+// ----------------------------------------------------------------------------
+{
+    while (t)
+    {
+        if (XL::Infix *infix = t->AsInfix())
+        {
+            if (infix->name != "," || !numbers(infix->left, sink, negate))
+                return false;
+            t = infix->right;
+        }
+        else if (XL::Block *block = t->AsBlock())
+        {
+            t = block->child;
+        }
+        else if (XL::Integer *i = t->AsInteger())
+        {
+            sink.add(negate ? -i->value : i->value);
+            return true;
+        }
+        else if (XL::Real *r = t->AsReal())
+        {
+            sink.add(negate ? -r->value : r->value);
+            return true;
+        }
+        else if (XL::Prefix *prefix = t->AsPrefix())
+        {
+            // Negative numbers are parsed as -x
+            XL::Name *op = prefix->left->AsName();
+            size_t n = sink.count;
+            return op && op->value == "-" &&
+                numbers(prefix->right, sink, !negate) && sink.count == n + 1;
+        }
+        else
+        {
+            return false;
+        }
+    }
+    return false;
+}
+
+
+XL::Name_p PointCloudFactory::cloud_add_batch(XL::Tree_p self, text name,
+                                              XL::Tree_p xyz, XL::Tree_p rgba)
+// ----------------------------------------------------------------------------
+//   Add all the points of a list of coordinates to a cloud
+// ----------------------------------------------------------------------------
+//   The cloud is looked up once, and the points are appended in one call,
+//   to be uploaded after the points already in the cloud.
+{
+    PointCloud *cloud = instance()->cloud(name, LM_CREATE | LM_CLEAR_OPTIMIZED);
+    if (!cloud)
+    {
+        XL::Ooops("PointsCloud: No cloud named $2 for $1", self).Arg(name);
+        return XL::xl_false;
+    }
+
+    // Numbers are grouped into points and colors as the lists are walked
+    PointCloud::point_vec points;
+    PointCloud::color_vec colors;
+    PointSink xyzs(points);
+    if (!numbers(xyz, xyzs) || xyzs.count % 3)
+    {
+        XL::Ooops("PointsCloud: Expected X, Y, Z coordinates in $1", xyz);
+        return XL::xl_false;
+    }
+    size_t n = points.size();
+    ColorSink rgbas(colors);
+    if (rgba && (!numbers(rgba, rgbas) || rgbas.count != 4 * n))
+    {
+        XL::Ooops("PointsCloud: Expected R, G, B, A for each point in $1",
+                  rgba);
+        return XL::xl_false;
+    }
+
+    // As with cloud_add, colors are ignored if the cloud is not colored
+    bool colored = cloud->size() ? cloud->colored() : rgba != NULL;
+    if (!colored)
+        colors.clear();
+    else if (!rgba)
+        colors.resize(n, PointCloud::Color(1, 1, 1, 1));
+
+    bool changed = cloud->addPoints(points, colors);
+    if (!changed && cloud->error != "")
+    {
+        XL::Ooops("PointsCloud: Error adding to cloud $2 in $1: $3", self)
+            .Arg(name).Arg(cloud->error);
+        cloud->error.clear();
+    }
+
+    return changed ? XL::xl_true : XL::xl_false;
+}
+
+
 XL::Name_p PointCloudFactory::cloud_load_data(XL::Tree_p self,
                                               text name, text file, text fmt,
                                               int xi, int yi, int zi,
@@ -298,6 +571,39 @@ XL::Name_p PointCloudFactory::cloud_load_data(XL::Tree_p self,
 }
 
 
+XL::Name_p PointCloudFactory::cloud_build_tree(XL::Tree_p self,
+                                               text name, text file, text tree,
+                                               text fmt,
+                                               int xi, int yi, int zi,
+                                               float colorScale,
+                                               float ri, float gi, float bi,
+                                               float ai)
+// ----------------------------------------------------------------------------
+//   Convert points from a file to a tree file, then draw them out of core
+// ----------------------------------------------------------------------------
+{
+    PointCloud *cloud = instance()->cloud(name, LM_CREATE);
+    if (!cloud)
+    {
+        XL::Ooops("PointsCloud: No cloud named $2 for $1", self).Arg(name);
+        return XL::xl_false;
+    }
+
+    if (cloud->folder == "")
+        cloud->folder = instance()->tao->currentDocumentFolder();
+    bool changed = cloud->buildTree(tree, file, fmt, xi, yi, zi, colorScale,
+                                    ri, gi, bi, ai);
+    if (!changed && cloud->error != "")
+    {
+        XL::Ooops("PointsCloud: Error converting cloud $2 from $3 in $1: $4",
+                  self).Arg(name).Arg(file).Arg(cloud->error);
+        cloud->error.clear();
+    }
+
+    return changed ? XL::xl_true : XL::xl_false;
+}
+
+
 XL::Real_p PointCloudFactory::cloud_loaded(text name)
 // ----------------------------------------------------------------------------
 //   How much of the file has been loaded by cloud_load_data (0.0 to 1.0)
@@ -314,6 +620,33 @@ XL::Real_p PointCloudFactory::cloud_loaded(text name)
 }
 
 
+XL::Name_p PointCloudFactory::cloud_save(XL::Tree_p self,
+                                         text name, text file)
+// ----------------------------------------------------------------------------
+//   Save points to a file in native binary format
+// ----------------------------------------------------------------------------
+{
+    PointCloud *cloud = instance()->cloud(name);
+    if (!cloud)
+    {
+        XL::Ooops("PointsCloud: No cloud named $2 for $1", self).Arg(name);
+        return XL::xl_false;
+    }
+
+    if (cloud->folder == "")
+        cloud->folder = instance()->tao->currentDocumentFolder();
+    bool ok = cloud->save(file);
+    if (!ok && cloud->error != "")
+    {
+        XL::Ooops("PointsCloud: Error saving cloud $2 to $3 in $1: $4",
+                  self).Arg(name).Arg(file).Arg(cloud->error);
+        cloud->error.clear();
+    }
+
+    return ok ? XL::xl_true : XL::xl_false;
+}
+
+
 XL::Real_p PointCloudFactory::cloud_point_size(text name, float size)
 // ----------------------------------------------------------------------------
 //   Sets the GL point size for the cloud
@@ -353,6 +686,99 @@ XL::Name_p PointCloudFactory::cloud_point_programmable_size(text name, bool on)
 }
 
 
+XL::Name_p PointCloudFactory::cloud_compact_points(text name, bool on)
+// ----------------------------------------------------------------------------
+//   Select 16-bit quantized coordinates for the cloud VBOs
+// ----------------------------------------------------------------------------
+{
+    PointCloud *cloud = instance()->cloud(name);
+    if (!cloud)
+        return XL::xl_false;
+    cloud->compactPoints = on;
+    return XL::xl_true;
+}
+
+
+XL::Name_p PointCloudFactory::cloud_compact_colors(text name, bool on)
+// ----------------------------------------------------------------------------
+//   Select 8-bit RGBA colors for the cloud VBOs
+// ----------------------------------------------------------------------------
+{
+    PointCloud *cloud = instance()->cloud(name);
+    if (!cloud)
+        return XL::xl_false;
+    cloud->compactColors = on;
+    return XL::xl_true;
+}
+
+
+XL::Name_p PointCloudFactory::cloud_interleaved(text name, bool on)
+// ----------------------------------------------------------------------------
+//   Select a single VBO for positions and colors
+// ----------------------------------------------------------------------------
+{
+    PointCloud *cloud = instance()->cloud(name);
+    if (!cloud)
+        return XL::xl_false;
+    cloud->interleaved = on;
+    return XL::xl_true;
+}
+
+
+XL::Name_p PointCloudFactory::cloud_point_budget(text name, int budget)
+// ----------------------------------------------------------------------------
+//   Limit the number of points drawn per frame, 0 to draw all points
+// ----------------------------------------------------------------------------
+{
+    PointCloud *cloud = instance()->cloud(name);
+    if (!cloud)
+        return XL::xl_false;
+    cloud->pointBudget = budget > 0 ? budget : 0;
+    return XL::xl_true;
+}
+
+
+XL::Name_p PointCloudFactory::cloud_tree_memory(text name,
+                                                int memory, int video)
+// ----------------------------------------------------------------------------
+//   Set the megabytes of main and video memory used by nodes of a tree
+// ----------------------------------------------------------------------------
+{
+    PointCloud *cloud = instance()->cloud(name);
+    if (!cloud)
+        return XL::xl_false;
+    cloud->treeMemory = memory > 0 ? memory : 0;
+    cloud->treeVideoMemory = video > 0 ? video : 0;
+    return XL::xl_true;
+}
+
+
+XL::Name_p PointCloudFactory::cloud_upload_budget(text name, int megabytes)
+// ----------------------------------------------------------------------------
+//   Limit the megabytes sent to VBOs per frame, 0 to send all points at once
+// ----------------------------------------------------------------------------
+{
+    PointCloud *cloud = instance()->cloud(name);
+    if (!cloud)
+        return XL::xl_false;
+    cloud->uploadBudget = megabytes > 0 ? megabytes : 0;
+    return XL::xl_true;
+}
+
+
+XL::Name_p PointCloudFactory::cloud_shaders(text name, bool on)
+// ----------------------------------------------------------------------------
+//   Draw VBOs with a vertex array object and shaders instead of client arrays
+// ----------------------------------------------------------------------------
+{
+    PointCloud *cloud = instance()->cloud(name);
+    if (!cloud)
+        return XL::xl_false;
+    cloud->shaders = on;
+    return XL::xl_true;
+}
+
+
 std::ostream & PointCloudFactory::sdebug()
 // ----------------------------------------------------------------------------
 //   Convenience method to log with a common prefix
@@ -383,7 +809,11 @@ int module_exit()
 //   Uninitialize the Tao module
 // ----------------------------------------------------------------------------
 {
-    PointCloudFactory::instance()->pool.stopAll();
+    // Deleting clouds interrupts their loads, which may wait for the network
     PointCloudFactory::cloud_only("");
+    PointCloudFactory::instance()->downloads.stopAll();
+    PointCloudFactory::instance()->pool.stopAll();
+    PointCloudFactory::instance()->indexes.stopAll();
+    PointCloudFactory::instance()->workers.stopAll();
     return 0;
 }
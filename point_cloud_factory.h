@@ -44,8 +44,10 @@
 #include "tao/module_api.h"
 #include <QFlags>
 #include <map>
+#include <vector>
 
 struct PointCloud;
+class PointCloudShader;
 
 class PointCloudFactory
 // ----------------------------------------------------------------------------
@@ -53,6 +55,9 @@ class PointCloudFactory
 // ----------------------------------------------------------------------------
 {
 public:
+    // Clouds downloaded at the same time, each one blocks a thread
+    enum { DOWNLOADS = 8 };
+
     enum LookupModeFlag {
         LM_DEFAULT = 0x0,
         LM_CREATE = 0x1,          // Create if not exists
@@ -65,6 +70,7 @@ public:
     virtual ~PointCloudFactory() {}
 
     PointCloud *  cloud(text name, LookupMode mode = LM_DEFAULT);
+    void          draw(const std::vector<PointCloud *> &shown);
 
 public:
     static PointCloudFactory * instance(const Tao::ModuleApi *tao = 0);
@@ -78,6 +84,7 @@ public:
     static XL::Name_p    cloud_drop(text name);
     static XL::Name_p    cloud_only(text name);
     static XL::Name_p    cloud_show(text name);
+    static XL::Name_p    clouds_show(XL::Tree_p self, XL::Tree_p names);
     static XL::Name_p    cloud_optimize(text name);
     static XL::Name_p    cloud_random(text name, XL::Integer_p points,
                                       bool colored = false);
@@ -87,30 +94,61 @@ public:
                                    XL::Real_p z,
                                    float r = -1.0, float g = -1.0,
                                    float b = -1.0, float a = -1.0);
+    static XL::Name_p    cloud_add_batch(XL::Tree_p self, text name,
+                                         XL::Tree_p xyz,
+                                         XL::Tree_p rgba = NULL);
     static XL::Name_p    cloud_load_data(XL::Tree_p self,
                                          text name, text file, text fmt,
                                          int xi, int yi, int zi,
                                          float colorScale = 0.0,
                                          float ri = -1.0, float gi = -1.0,
                                          float bi = -1.0, float ai = -1.0);
+    static XL::Name_p    cloud_build_tree(XL::Tree_p self,
+                                          text name, text file, text tree,
+                                          text fmt, int xi, int yi, int zi,
+                                          float colorScale = 0.0,
+                                          float ri = -1.0, float gi = -1.0,
+                                          float bi = -1.0, float ai = -1.0);
     static XL::Real_p    cloud_loaded(text name);
+    static XL::Name_p    cloud_save(XL::Tree_p self, text name, text file);
     static XL::Real_p    cloud_point_size(text name, float sz);
     static XL::Name_p    cloud_point_sprites(text name, bool enabled);
     static XL::Name_p    cloud_point_programmable_size(text name, bool enabled);
+    static XL::Name_p    cloud_compact_points(text name, bool on);
+    static XL::Name_p    cloud_compact_colors(text name, bool on);
+    static XL::Name_p    cloud_interleaved(text name, bool on);
+    static XL::Name_p    cloud_point_budget(text name, int budget);
+    static XL::Name_p    cloud_tree_memory(text name, int memory, int video);
+    static XL::Name_p    cloud_upload_budget(text name, int megabytes);
+    static XL::Name_p    cloud_shaders(text name, bool on);
 
 public:
     const Tao::ModuleApi *  tao;
     bool                    vboSupported;
-    ThreadPool              pool;
+    bool                    mapRangeSupported;
+    bool                    shadersSupported;
+    PointCloudShader *      shader;     // Shared by clouds drawn with VAOs
+    ThreadPool              pool;       // Loading whole clouds
+    ThreadPool              downloads;  // Loading clouds from URLs
+    ThreadPool              indexes;    // Building octrees
+    ThreadPool              workers;    // Parallel parts of a load
 
 protected:
     static std::ostream &  sdebug();
 
 protected:
     typedef std::map<text, PointCloud *>  cloud_map;
+    struct Shown
+    {
+        // Clouds drawn by one render callback, looked up again on change
+        std::vector<text>          names;
+        std::vector<PointCloud *>  clouds;
+        unsigned                   generation;
+    };
 
 protected:
     cloud_map    clouds;
+    unsigned     generation;    // Changes when clouds are created or deleted
 
 protected:
     static PointCloudFactory * factory;
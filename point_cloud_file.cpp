@@ -0,0 +1,188 @@
+// *****************************************************************************
+// point_cloud_file.cpp                                            Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Native binary file format for point clouds.
+//
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include "point_cloud_file.h"
+#include "point_cloud_tree.h"
+#include <string.h>
+#include <float.h>
+
+static const char nativeMagic[8] = { 'T','A','O','C','L','O','U','D' };
+
+// The on-disk layout must not depend on the compiler
+typedef char header_size_check[sizeof(PointCloudFile::Header) == 128 ? 1 : -1];
+
+
+PointCloudFile::Format PointCloudFile::format(QIODevice *io)
+// ----------------------------------------------------------------------------
+//   Identify the format of the data without consuming it
+// ----------------------------------------------------------------------------
+{
+    char magic[8];
+    qint64 n = io->peek(magic, sizeof(magic));
+    if (n == sizeof(magic) && memcmp(magic, nativeMagic, sizeof(magic)) == 0)
+        return NATIVE;
+    if (n == sizeof(magic) &&
+        memcmp(magic, PointCloudTreeFile::magic, sizeof(magic)) == 0)
+        return TREE;
+    if (n >= 4 && memcmp(magic, "ply", 3) == 0 &&
+        (magic[3] == '\n' || magic[3] == '\r'))
+        return PLY;
+    if (n >= 4 && memcmp(magic, "LASF", 4) == 0)
+        return LAS;
+    return TEXT;
+}
+
+
+bool PointCloudFile::check(const Header &h, qint64 size, text &error)
+// ----------------------------------------------------------------------------
+//   Check that a native header is valid and consistent with the file size
+// ----------------------------------------------------------------------------
+{
+    if (size < qint64(sizeof(Header)) ||
+        memcmp(h.magic, nativeMagic, sizeof(nativeMagic)) != 0)
+    {
+        error = "Invalid point cloud file header";
+        return false;
+    }
+    if (h.byteOrder != BYTE_ORDER_MARK)
+    {
+        error = "Point cloud file was written with a different byte order";
+        return false;
+    }
+    if (h.version > VERSION || h.headerSize < sizeof(Header))
+    {
+        error = "Unsupported point cloud file version";
+        return false;
+    }
+    if (h.pointFormat != POINT_FLOAT3 || h.pointStride != sizeof(Point) ||
+        (h.colorFormat != COLOR_NONE &&
+         (h.colorFormat != COLOR_FLOAT4 || h.colorStride != sizeof(Color))))
+    {
+        error = "Unsupported point cloud data format";
+        return false;
+    }
+
+    // Counts and offsets come from the file, compare them without overflow
+    quint64 fsize = quint64(size);
+    if (h.count > fsize / h.pointStride ||
+        (h.colorFormat && h.count > fsize / h.colorStride))
+    {
+        error = "Point cloud file is truncated";
+        return false;
+    }
+    quint64 psize = h.count * h.pointStride;
+    quint64 csize = h.colorFormat ? h.count * h.colorStride : 0;
+    if (h.pointOffset > fsize || psize > fsize - h.pointOffset ||
+        h.colorOffset > fsize || csize > fsize - h.colorOffset)
+    {
+        error = "Point cloud file is truncated";
+        return false;
+    }
+
+    // Mapped arrays are accessed in place, they must be aligned for floats
+    if (h.pointOffset % sizeof(float) || h.colorOffset % sizeof(float))
+    {
+        error = "Invalid point cloud data offset";
+        return false;
+    }
+    return true;
+}
+
+
+bool PointCloudFile::write(QIODevice *io,
+                           const point_vec &points, const color_vec &colors,
+                           text &error)
+// ----------------------------------------------------------------------------
+//   Write points and colors in native format
+// ----------------------------------------------------------------------------
+{
+    Header h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, nativeMagic, sizeof(h.magic));
+    h.byteOrder = BYTE_ORDER_MARK;
+    h.version = VERSION;
+    h.headerSize = sizeof(Header);
+    h.count = points.size();
+    h.pointFormat = POINT_FLOAT3;
+    h.pointStride = sizeof(Point);
+    h.pointOffset = sizeof(Header);
+    if (colors.size())
+    {
+        XL_ASSERT(colors.size() == points.size());
+        h.colorFormat = COLOR_FLOAT4;
+        h.colorStride = sizeof(Color);
+        h.colorOffset = h.pointOffset + h.count * h.pointStride;
+    }
+
+    for (int i = 0; i < 3; i++)
+    {
+        h.min[i] = FLT_MAX;
+        h.max[i] = -FLT_MAX;
+    }
+    for (size_t p = 0; p < points.size(); p++)
+    {
+        const float *v = &points[p].x;
+        for (int i = 0; i < 3; i++)
+        {
+            h.min[i] = qMin(h.min[i], v[i]);
+            h.max[i] = qMax(h.max[i], v[i]);
+        }
+    }
+
+    // Arrays are written block by block, as they are stored
+    bool ok = io->write((const char *) &h, sizeof(h)) == sizeof(h);
+    size_t n = 0;
+    for (size_t i = 0; ok && i < points.size(); i += n)
+    {
+        n = points.size() - i;
+        const Point *p = points.span(i, n);
+        qint64 size = n * sizeof(Point);
+        ok = io->write((const char *) p, size) == size;
+    }
+    for (size_t i = 0; ok && i < colors.size(); i += n)
+    {
+        n = colors.size() - i;
+        const Color *c = colors.span(i, n);
+        qint64 size = n * sizeof(Color);
+        ok = io->write((const char *) c, size) == size;
+    }
+    if (!ok)
+    {
+        error = "Error writing point cloud file";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,104 @@
+#ifndef POINT_CLOUD_FILE_H
+#define POINT_CLOUD_FILE_H
+// *****************************************************************************
+// point_cloud_file.h                                              Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Native binary file format for point clouds.
+//
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include "point_cloud.h"
+#include <QIODevice>
+
+
+struct PointCloudFile
+// ----------------------------------------------------------------------------
+//    Detect file formats, read and write the native binary format
+// ----------------------------------------------------------------------------
+//    A native file is a Header followed by contiguous arrays of points and
+//    colors, stored exactly as in memory so that it can be memory-mapped.
+{
+    enum Format
+    {
+        TEXT,                   // Delimited text, parsed by PointCloudParser
+        NATIVE,                 // Native binary format, see Header
+        PLY,                    // Stanford PLY, see PointCloudPly
+        LAS,                    // ASPRS LAS, see PointCloudLas
+        TREE                    // Out-of-core tree, see PointCloudTreeFile
+    };
+
+    enum PointFormat
+    {
+        POINT_FLOAT3    = 1     // x, y, z as 32-bit floats
+    };
+
+    enum ColorFormat
+    {
+        COLOR_NONE      = 0,    // Cloud is not colored
+        COLOR_FLOAT4    = 1     // r, g, b, a as 32-bit floats
+    };
+
+    enum { VERSION = 1, BYTE_ORDER_MARK = 0x01020304 };
+
+    struct Header
+    {
+        char     magic[8];      // "TAOCLOUD"
+        quint32  byteOrder;     // BYTE_ORDER_MARK in the writer's order
+        quint32  version;       // VERSION
+        quint32  headerSize;    // sizeof(Header)
+        quint32  flags;         // Reserved, 0
+        quint64  count;         // Number of points
+        quint32  pointFormat;   // PointFormat
+        quint32  pointStride;   // Bytes per point
+        quint32  colorFormat;   // ColorFormat
+        quint32  colorStride;   // Bytes per color, 0 if not colored
+        quint64  pointOffset;   // Offset of points from start of file
+        quint64  colorOffset;   // Offset of colors from start of file
+        float    min[3];        // Bounding box
+        float    max[3];
+        quint32  reserved[10];
+    };
+
+    typedef PointCloud::Point       Point;
+    typedef PointCloud::Color       Color;
+    typedef PointCloud::point_vec   point_vec;
+    typedef PointCloud::color_vec   color_vec;
+
+public:
+    static Format       format(QIODevice *io);
+    static bool         check(const Header &header, qint64 size, text &error);
+    static bool         write(QIODevice *io,
+                              const point_vec &points, const color_vec &colors,
+                              text &error);
+};
+
+#endif // POINT_CLOUD_FILE_H
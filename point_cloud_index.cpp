@@ -0,0 +1,476 @@
+// *****************************************************************************
+// point_cloud_index.cpp                                           Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Spatial index of a point cloud: a linear octree of Morton-sorted points
+//
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+#include "point_cloud_index.h"
+#include "point_cloud_factory.h"
+#include <QElapsedTimer>
+#include <algorithm>
+#include <float.h>
+
+
+static inline quint32 spread(quint32 v)
+// ----------------------------------------------------------------------------
+//   Insert two zero bits between each of the 10 low bits of v
+// ----------------------------------------------------------------------------
+{
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000FF;
+    v = (v | (v <<  8)) & 0x0300F00F;
+    v = (v | (v <<  4)) & 0x030C30C3;
+    v = (v | (v <<  2)) & 0x09249249;
+    return v;
+}
+
+
+static inline quint32 cell(float v, float lo, float scale)
+// ----------------------------------------------------------------------------
+//   Grid cell of a coordinate along one axis
+// ----------------------------------------------------------------------------
+{
+    float c = (v - lo) * scale;
+    if (c <= 0)
+        return 0;
+    if (c >= 1023)
+        return 1023;
+    return quint32(c);
+}
+
+
+PointCloudIndex::PointCloudIndex()
+// ----------------------------------------------------------------------------
+//   Create an idle index
+// ----------------------------------------------------------------------------
+    : Runnable(), count(0), built(0), generation(0), tree(NULL), tasks(0),
+      lo(0, 0, 0), scale(0, 0, 0), result(NULL)
+{}
+
+
+PointCloudIndex::~PointCloudIndex()
+// ----------------------------------------------------------------------------
+//   Stop any build in progress and drop a result not taken
+// ----------------------------------------------------------------------------
+{
+    stop();
+}
+
+
+void PointCloudIndex::build(const point_vec &points)
+// ----------------------------------------------------------------------------
+//   Start indexing the points currently in the cloud (main thread)
+// ----------------------------------------------------------------------------
+{
+    stop();
+    input(points);
+    PointCloudFactory::instance()->indexes.start(this);
+}
+
+
+void PointCloudIndex::stop()
+// ----------------------------------------------------------------------------
+//   Stop or unqueue the build in progress and drop its result (main thread)
+// ----------------------------------------------------------------------------
+//   Builds of a previous generation never publish their octree, in case
+//   one completes while its points are being freed. Bumping the generation
+//   first makes the steps in progress return early, so that interrupt()
+//   only waits for CHECK_POINTS items per task.
+{
+    generation.fetchAndAddOrdered(1);
+    interrupt();
+    delete take();
+}
+
+
+PointCloudOctree *PointCloudIndex::buildNow(const point_vec &points)
+// ----------------------------------------------------------------------------
+//   Index points in the calling thread, with the help of the worker threads
+// ----------------------------------------------------------------------------
+{
+    stop();
+    input(points);
+    run();
+    return take();
+}
+
+
+void PointCloudIndex::input(const point_vec &points)
+// ----------------------------------------------------------------------------
+//   Record where the points to index are stored
+// ----------------------------------------------------------------------------
+{
+    blocks.clear();
+    for (size_t b = 0; b < points.blockCount(); b++)
+        blocks.push_back(points.block(b));
+    count = points.size();
+    built = generation.loadAcquire();
+}
+
+
+PointCloudOctree *PointCloudIndex::take()
+// ----------------------------------------------------------------------------
+//   Return the octree built last, if any, and forget it (main thread)
+// ----------------------------------------------------------------------------
+{
+    return result.fetchAndStoreAcquire(NULL);
+}
+
+
+void PointCloudIndex::run()
+// ----------------------------------------------------------------------------
+//   Build the octree
+// ----------------------------------------------------------------------------
+//   Points are sorted by Morton code with their index packed in the low
+//   32 bits of each key. Keys are first distributed in buckets by their
+//   top bits, then buckets are sorted independently, so that all steps
+//   run in parallel. Nodes are then split from the sorted keys.
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    size_t n = count;
+    PointCloudFactory *fact = PointCloudFactory::instance();
+    tasks = TASKS * qMax(fact->workers.maxThreadCount(), 1);
+    tree = new PointCloudOctree;
+    tree->count = n;
+
+    // Bounds of the cloud, to map points to a 1024^3 grid
+    taskLo.assign(tasks, Point(FLT_MAX, FLT_MAX, FLT_MAX));
+    taskHi.assign(tasks, Point(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+    parallel(BOUNDS, n);
+    Point hi(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    lo = Point(FLT_MAX, FLT_MAX, FLT_MAX);
+    for (unsigned t = 0; t < tasks; t++)
+    {
+        lo = Point(qMin(lo.x, taskLo[t].x), qMin(lo.y, taskLo[t].y),
+                   qMin(lo.z, taskLo[t].z));
+        hi = Point(qMax(hi.x, taskHi[t].x), qMax(hi.y, taskHi[t].y),
+                   qMax(hi.z, taskHi[t].z));
+    }
+    scale = Point(hi.x > lo.x ? 1024 / (hi.x - lo.x) : 0,
+                  hi.y > lo.y ? 1024 / (hi.y - lo.y) : 0,
+                  hi.z > lo.z ? 1024 / (hi.z - lo.z) : 0);
+
+    // Sort keys by buckets
+    const size_t nbuckets = 1 << BUCKET_BITS;
+    if (!stale())
+    {
+        keys.resize(n);
+        parallel(KEYS, n);
+    }
+    if (!stale())
+    {
+        offsets.assign(tasks * nbuckets, 0);
+        parallel(HISTOGRAM, n);
+        buckets.assign(nbuckets + 1, 0);
+        unsigned total = 0;
+        for (size_t b = 0; b < nbuckets; b++)
+        {
+            buckets[b] = total;
+            for (unsigned t = 0; t < tasks; t++)
+            {
+                unsigned c = offsets[t * nbuckets + b];
+                offsets[t * nbuckets + b] = total;
+                total += c;
+            }
+        }
+        buckets[nbuckets] = total;
+        sorted.resize(n);
+        parallel(SCATTER, n);
+        std::vector<quint64>().swap(keys);
+    }
+    if (!stale())
+        parallel(SORT, nbuckets);
+    if (!stale())
+    {
+        tree->order.resize(n);
+        parallel(ORDER, n);
+    }
+
+    // Split nodes, then compute their bounds from the leaves up
+    if (!stale() && n)
+    {
+        tree->nodes.push_back(Node(0, n));
+        split(0, 0);
+        parallel(LEAVES, leaves.size());
+        tree->samples.resize(inner.size() * SAMPLE_POINTS);
+        parallel(SAMPLES, inner.size());
+        for (size_t i = tree->nodes.size(); i-- > 0; )
+        {
+            Node &node = tree->nodes[i];
+            for (unsigned c = 0; c < node.children; c++)
+            {
+                const Node &child = tree->nodes[node.firstChild + c];
+                if (c == 0)
+                {
+                    node.lo = child.lo;
+                    node.hi = child.hi;
+                    continue;
+                }
+                node.lo = Point(qMin(node.lo.x, child.lo.x),
+                                qMin(node.lo.y, child.lo.y),
+                                qMin(node.lo.z, child.lo.z));
+                node.hi = Point(qMax(node.hi.x, child.hi.x),
+                                qMax(node.hi.y, child.hi.y),
+                                qMax(node.hi.z, child.hi.z));
+            }
+        }
+    }
+
+    std::vector<quint64>().swap(keys);
+    std::vector<quint64>().swap(sorted);
+    std::vector<unsigned>().swap(offsets);
+    std::vector<unsigned>().swap(leaves);
+    std::vector<unsigned>().swap(inner);
+    if (stale())
+    {
+        IFTRACE(pointcloud)
+            debug() << "Indexing interrupted\n";
+        delete tree;
+        tree = NULL;
+        return;
+    }
+
+    IFTRACE(pointcloud)
+        debug() << "Indexed " << n << " points in "
+                << tree->nodes.size() << " nodes with " << tasks
+                << " tasks, " << timer.elapsed() << " ms\n";
+    delete result.fetchAndStoreRelease(tree);
+    tree = NULL;
+}
+
+
+void PointCloudIndex::step(Step step, unsigned task, size_t first, size_t last)
+// ----------------------------------------------------------------------------
+//   Run one slice of a step of the build (worker threads)
+// ----------------------------------------------------------------------------
+{
+    const size_t nbuckets = 1 << BUCKET_BITS;
+    const unsigned bucketShift = 32 + 3 * LEVELS - BUCKET_BITS;
+
+    switch (step)
+    {
+    case BOUNDS:
+    {
+        Point l = taskLo[task], h = taskHi[task];
+        for (size_t i = first; i < last; i++)
+        {
+            const Point &p = point(i);
+            l.x = qMin(l.x, p.x); h.x = qMax(h.x, p.x);
+            l.y = qMin(l.y, p.y); h.y = qMax(h.y, p.y);
+            l.z = qMin(l.z, p.z); h.z = qMax(h.z, p.z);
+        }
+        taskLo[task] = l;
+        taskHi[task] = h;
+        break;
+    }
+    case KEYS:
+        for (size_t i = first; i < last; i++)
+        {
+            const Point &p = point(i);
+            quint32 code = (spread(cell(p.x, lo.x, scale.x)) << 2) |
+                           (spread(cell(p.y, lo.y, scale.y)) << 1) |
+                            spread(cell(p.z, lo.z, scale.z));
+            keys[i] = (quint64(code) << 32) | i;
+        }
+        break;
+    case HISTOGRAM:
+    {
+        unsigned *counts = &offsets[task * nbuckets];
+        for (size_t i = first; i < last; i++)
+            counts[keys[i] >> bucketShift]++;
+        break;
+    }
+    case SCATTER:
+    {
+        unsigned *next = &offsets[task * nbuckets];
+        for (size_t i = first; i < last; i++)
+            sorted[next[keys[i] >> bucketShift]++] = keys[i];
+        break;
+    }
+    case SORT:
+        for (size_t b = first; b < last; b++)
+            std::sort(sorted.begin() + buckets[b],
+                      sorted.begin() + buckets[b + 1]);
+        break;
+    case ORDER:
+        for (size_t i = first; i < last; i++)
+            tree->order[i] = quint32(sorted[i]);
+        break;
+    case LEAVES:
+    {
+        std::vector<unsigned> copy;
+        for (size_t l = first; l < last; l++)
+        {
+            Node &node = tree->nodes[leaves[l]];
+            unsigned *order = &tree->order[node.first];
+            Point lo = point(order[0]), hi = lo;
+            for (unsigned i = 1; i < node.count; i++)
+            {
+                const Point &p = point(order[i]);
+                lo.x = qMin(lo.x, p.x); hi.x = qMax(hi.x, p.x);
+                lo.y = qMin(lo.y, p.y); hi.y = qMax(hi.y, p.y);
+                lo.z = qMin(lo.z, p.z); hi.z = qMax(hi.z, p.z);
+            }
+            node.lo = lo;
+            node.hi = hi;
+
+            // Shuffle entries so that the leaf can be drawn partially
+            unsigned step = spacing(node.count);
+            copy.assign(order, order + node.count);
+            for (unsigned i = 0, j = 0; i < node.count; i++)
+            {
+                order[i] = copy[j];
+                j = (j + step) % node.count;
+            }
+        }
+        break;
+    }
+    case SAMPLES:
+        for (size_t n = first; n < last; n++)
+        {
+            Node &node = tree->nodes[inner[n]];
+            const unsigned *order = &tree->order[node.first];
+            unsigned *sample = &tree->samples[n * SAMPLE_POINTS];
+            unsigned step = spacing(node.count);
+            for (unsigned i = 0, j = 0; i < SAMPLE_POINTS; i++)
+            {
+                sample[i] = order[j];
+                j = (j + step) % node.count;
+            }
+            node.sample = n * SAMPLE_POINTS;
+            node.samples = SAMPLE_POINTS;
+        }
+        break;
+    }
+}
+
+
+void PointCloudIndex::parallel(Step step, size_t count)
+// ----------------------------------------------------------------------------
+//   Split a step in slices run by the worker threads, and wait for them
+// ----------------------------------------------------------------------------
+//   Slices only depend on the count, so that successive steps over the
+//   same items give the same items to each task.
+{
+    ThreadPool &workers = PointCloudFactory::instance()->workers;
+    size_t slice = (count + tasks - 1) / tasks;
+    QSemaphore done;
+    std::vector<PointCloudIndexTask *> running;
+    for (unsigned t = 0; t < tasks && t * slice < count; t++)
+    {
+        size_t first = t * slice;
+        size_t last = qMin(count, first + slice);
+        running.push_back(new PointCloudIndexTask(this, step, t,
+                                                  first, last, done));
+        workers.start(running.back());
+    }
+    done.acquire(running.size());
+    for (size_t t = 0; t < running.size(); t++)
+        delete running[t];
+}
+
+
+void PointCloudIndex::split(unsigned node, unsigned level)
+// ----------------------------------------------------------------------------
+//   Create the children of a node from the sorted keys
+// ----------------------------------------------------------------------------
+{
+    unsigned first = tree->nodes[node].first;
+    unsigned last = first + tree->nodes[node].count;
+    if (last - first <= LEAF_POINTS || level == LEVELS)
+    {
+        leaves.push_back(node);
+        return;
+    }
+
+    // Children are the runs of keys sharing the next 3 bits of their code
+    unsigned shift = 3 * (LEVELS - 1 - level);
+    quint64 base = quint64(quint32(sorted[first] >> 32) >> (shift + 3))
+        << (shift + 3);
+    unsigned firstChild = tree->nodes.size();
+    unsigned children = 0;
+    std::vector<quint64>::iterator begin = sorted.begin();
+    unsigned start = first;
+    for (quint64 digit = 1; digit <= 8 && start < last; digit++)
+    {
+        quint64 limit = (base + (digit << shift)) << 32;
+        unsigned end = std::lower_bound(begin + start, begin + last, limit)
+            - begin;
+        if (end > start)
+        {
+            tree->nodes.push_back(Node(start, end - start));
+            children++;
+        }
+        start = end;
+    }
+    tree->nodes[node].firstChild = firstChild;
+    tree->nodes[node].children = children;
+    inner.push_back(node);
+
+    for (unsigned c = 0; c < children; c++)
+        split(firstChild + c, level + 1);
+}
+
+
+unsigned PointCloudIndex::spacing(unsigned count)
+// ----------------------------------------------------------------------------
+//   Step close to count / golden ratio, and prime with count
+// ----------------------------------------------------------------------------
+//   Visiting entries with this step modulo count reaches all of them, and
+//   any number of consecutive visits is spread evenly over the range.
+{
+    unsigned step = qMax(unsigned(count * 0.6180339887), 1u);
+    for (;; step++)
+    {
+        unsigned a = count, b = step;
+        while (b)
+        {
+            unsigned r = a % b;
+            a = b;
+            b = r;
+        }
+        if (a == 1)
+            return step;
+    }
+}
+
+
+std::ostream & PointCloudIndex::debug()
+// ----------------------------------------------------------------------------
+//   Convenience method to log with a common prefix
+// ----------------------------------------------------------------------------
+{
+    std::cerr << "[PointCloudIndex] " << (void*)this << " ";
+    return std::cerr;
+}
@@ -0,0 +1,196 @@
+#ifndef POINT_CLOUD_INDEX_H
+#define POINT_CLOUD_INDEX_H
+// *****************************************************************************
+// point_cloud_index.h                                             Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Spatial index of a point cloud: a linear octree of Morton-sorted points
+//
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+#include "point_cloud.h"
+#include "thread_pool.h"
+#include <QAtomicPointer>
+#include <QSemaphore>
+#include <vector>
+
+
+struct PointCloudOctree
+// ----------------------------------------------------------------------------
+//    Octree over the first 'count' points of a cloud
+// ----------------------------------------------------------------------------
+//    Points are not moved: 'order' lists their indices sorted by Morton
+//    code, and each node covers a contiguous range of 'order'. The children
+//    of a node are consecutive in 'nodes', after their parent.
+//    The entries of a leaf are shuffled so that any prefix of the leaf is
+//    spread over it. Inner nodes have a subsample in 'samples', with the
+//    same property, used to draw them at a lower level of detail.
+{
+    typedef PointCloud::Point   Point;
+
+    struct Node
+    {
+        Node(unsigned first, unsigned count)
+            : lo(0, 0, 0), hi(0, 0, 0), first(first), count(count),
+              firstChild(0), children(0), sample(0), samples(0) {}
+        Point    lo, hi;        // Bounds of the points in the node
+        unsigned first;         // First entry of the node in order
+        unsigned count;         // Number of points in the node
+        unsigned firstChild;    // Index of the first child in nodes
+        unsigned children;      // Number of children, 0 for a leaf
+        unsigned sample;        // First entry of the subsample in samples
+        unsigned samples;       // Points in the subsample, 0 for a leaf
+    };
+
+    PointCloudOctree() : count(0) {}
+
+    std::vector<Node>     nodes;    // nodes[0] is the root, if any
+    std::vector<unsigned> order;    // Point indices in Morton order
+    std::vector<unsigned> samples;  // Subsamples of the inner nodes
+    unsigned              count;    // Number of points indexed
+};
+
+
+class PointCloudIndex : public Runnable
+// ----------------------------------------------------------------------------
+//    Build the octree of a cloud in the background
+// ----------------------------------------------------------------------------
+//    The index runs on its own pool, so that it does not delay loads, and
+//    splits each step across the worker threads. It reads the storage
+//    blocks of the points directly: appending points to the cloud does not
+//    move them, but anything that frees points must stop() the build first.
+//    Steps check stale() every CHECK_POINTS items, so that stop() does not
+//    wait for a whole step.
+{
+public:
+    typedef PointCloud::Point       Point;
+    typedef PointCloud::point_vec   point_vec;
+    typedef PointCloudOctree::Node  Node;
+
+    enum
+    {
+        MIN_POINTS    = 1 << 16, // Smaller clouds are not worth indexing
+        LEAF_POINTS   = 4096,    // Nodes with more points are split
+        SAMPLE_POINTS = 1024,    // Subsample of each inner node
+        LEVELS        = 10,      // Morton code bits per axis
+        BUCKET_BITS   = 12,      // Top code bits used to distribute the sort
+        TASKS         = 4,       // Tasks per worker thread
+        CHECK_POINTS  = 4096     // Items between checks for a stop()
+    };
+
+public:
+    PointCloudIndex();
+    ~PointCloudIndex();
+
+public:
+    void                build(const point_vec &points);
+    PointCloudOctree *  buildNow(const point_vec &points);
+    PointCloudOctree *  take();
+    void                stop();
+    virtual void        run();  // From Runnable
+
+public:
+    enum Step
+    {
+        BOUNDS, KEYS, HISTOGRAM, SCATTER, SORT, ORDER, LEAVES, SAMPLES
+    };
+    void                step(Step step, unsigned task,
+                             size_t first, size_t last);
+    bool                stale()
+    {
+        // Set for good once the build is stopped, see stop()
+        return interrupted() || generation.loadAcquire() != built;
+    }
+
+protected:
+    void                input(const point_vec &points);
+    void                parallel(Step step, size_t count);
+    void                split(unsigned node, unsigned level);
+    static unsigned     spacing(unsigned count);
+    std::ostream &      debug();
+    const Point &       point(size_t i)
+    {
+        return blocks[i >> point_vec::BLOCK_SHIFT]
+                     [i & (point_vec::BLOCK - 1)];
+    }
+
+protected:
+    // Input, set by build() before the index is started
+    std::vector<const Point *>      blocks;
+    unsigned                        count;
+    int                             built;      // Generation of the input
+    QAtomicInt                      generation; // Changed by stop()
+
+    // Work data, only used while running
+    PointCloudOctree *              tree;
+    unsigned                        tasks;
+    Point                           lo, scale;
+    std::vector<Point>              taskLo, taskHi;
+    std::vector<quint64>            keys, sorted;
+    std::vector<unsigned>           buckets;    // First key of each bucket
+    std::vector<unsigned>           offsets;    // Per task and bucket
+    std::vector<unsigned>           leaves;
+    std::vector<unsigned>           inner;      // Nodes with children
+
+    // Output, handed over to the main thread
+    QAtomicPointer<PointCloudOctree> result;
+};
+
+
+struct PointCloudIndexTask : Runnable
+// ----------------------------------------------------------------------------
+//    One slice of a step of the index build, run by a worker thread
+// ----------------------------------------------------------------------------
+{
+    PointCloudIndexTask(PointCloudIndex *index, PointCloudIndex::Step step,
+                        unsigned task, size_t first, size_t last,
+                        QSemaphore &done)
+        : index(index), stepId(step), task(task),
+          first(first), last(last), done(done) {}
+    virtual void run()
+    {
+        // Steps over buckets or nodes check after each, others less often
+        bool nodes = (stepId == PointCloudIndex::SORT ||
+                      stepId == PointCloudIndex::LEAVES ||
+                      stepId == PointCloudIndex::SAMPLES);
+        size_t slice = nodes ? 1 : size_t(PointCloudIndex::CHECK_POINTS);
+        for (size_t f = first; f < last && !index->stale(); f += slice)
+            index->step(stepId, task, f, qMin(last, f + slice));
+        done.release();
+    }
+
+    PointCloudIndex *       index;
+    PointCloudIndex::Step   stepId;
+    unsigned                task;
+    size_t                  first, last;
+    QSemaphore &            done;
+};
+
+#endif // POINT_CLOUD_INDEX_H
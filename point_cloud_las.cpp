@@ -0,0 +1,276 @@
+// *****************************************************************************
+// point_cloud_las.cpp                                             Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Reading point clouds from LAS files.
+//
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include "point_cloud_las.h"
+#include <QtEndian>
+#include <string.h>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+// Offsets of fields in the LAS public header block
+enum
+{
+    LAS_VERSION_MINOR           = 25,
+    LAS_HEADER_SIZE             = 94,
+    LAS_POINT_DATA_OFFSET       = 96,
+    LAS_POINT_FORMAT            = 104,
+    LAS_POINT_LENGTH            = 105,
+    LAS_LEGACY_POINT_COUNT      = 107,
+    LAS_SCALE                   = 131,
+    LAS_OFFSET                  = 155,
+    LAS_POINT_COUNT             = 247,      // LAS 1.4 and later
+    LAS_MIN_HEADER_SIZE         = 227,      // LAS 1.2
+    LAS_MIN_HEADER_SIZE_14      = 375       // LAS 1.4
+};
+
+
+template <typename T>
+static inline T le(const char *p)
+// ----------------------------------------------------------------------------
+//   Load a little-endian value (all LAS values are little-endian)
+// ----------------------------------------------------------------------------
+{
+    return qFromLittleEndian<T>((const uchar *) p);
+}
+
+
+static inline double leDouble(const char *p)
+// ----------------------------------------------------------------------------
+//   Load a little-endian double
+// ----------------------------------------------------------------------------
+{
+    quint64 bits = le<quint64>(p);
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+
+PointCloudLas::PointCloudLas()
+// ----------------------------------------------------------------------------
+//   Constructor
+// ----------------------------------------------------------------------------
+    : format(0), rgbOffset(0), colorScale(1.0f / 65535)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        scale[i] = 1.0;
+        offset[i] = 0.0;
+    }
+}
+
+
+size_t PointCloudLas::headerSize(const char *begin, const char *end)
+// ----------------------------------------------------------------------------
+//   The header, including variable length records, ends at the point data
+// ----------------------------------------------------------------------------
+{
+    if (end - begin < LAS_MIN_HEADER_SIZE)
+        return 0;
+    size_t size = le<quint32>(begin + LAS_POINT_DATA_OFFSET);
+    if (size < LAS_MIN_HEADER_SIZE)
+        size = LAS_MIN_HEADER_SIZE;
+    return size_t(end - begin) >= size ? size : 0;
+}
+
+
+bool PointCloudLas::header(const char *begin, const char *end, text &error)
+// ----------------------------------------------------------------------------
+//   Parse the public header block
+// ----------------------------------------------------------------------------
+{
+    if (end - begin < LAS_MIN_HEADER_SIZE || memcmp(begin, "LASF", 4) != 0)
+    {
+        error = "Invalid LAS file header";
+        return false;
+    }
+
+    int minor = quint8(begin[LAS_VERSION_MINOR]);
+    int hsize = le<quint16>(begin + LAS_HEADER_SIZE);
+    quint8 fmt = begin[LAS_POINT_FORMAT];
+    if (fmt & 0xC0)
+    {
+        error = "Compressed LAS (LAZ) files are not supported";
+        return false;
+    }
+
+    format = fmt;
+    switch(format)
+    {
+    case 0: case 1: case 6:     rgbOffset = 0;  break;
+    case 2:                     rgbOffset = 20; break;
+    case 3:                     rgbOffset = 28; break;
+    case 7: case 8:             rgbOffset = 30; break;
+    default:
+        error = "Unsupported LAS point data format";
+        return false;
+    }
+
+    static const size_t minLength[] = { 20, 28, 26, 34, 0, 0, 30, 36, 38 };
+    stride = le<quint16>(begin + LAS_POINT_LENGTH);
+    if (stride < minLength[format])
+    {
+        error = "Invalid LAS point data record length";
+        return false;
+    }
+
+    count = le<quint32>(begin + LAS_LEGACY_POINT_COUNT);
+    if (minor >= 4 && hsize >= LAS_MIN_HEADER_SIZE_14 &&
+        end - begin >= LAS_MIN_HEADER_SIZE_14)
+        count = le<quint64>(begin + LAS_POINT_COUNT);
+
+    for (int i = 0; i < 3; i++)
+    {
+        scale[i] = leDouble(begin + LAS_SCALE + 8 * i);
+        offset[i] = leDouble(begin + LAS_OFFSET + 8 * i);
+    }
+
+    skip = 0;
+    colored = rgbOffset != 0;
+    return true;
+}
+
+
+void PointCloudLas::sample(const char *begin, const char *end)
+// ----------------------------------------------------------------------------
+//   Detect 8-bit colors from records spread across the whole file
+// ----------------------------------------------------------------------------
+//   Colors are 16-bit values, but many files store 8-bit values in them.
+//   The 8-bit scale is used only if no sampled color reaches 256, so that
+//   a dark start does not make the rest of a 16-bit file overflow.
+{
+    quint64 n = (end - begin) / stride;
+    if (n > count)
+        n = count;
+    if (!colored || !n)
+        return;
+
+    quint64 samples = qMin(n, quint64(SAMPLES));
+    quint16 maxc = 0;
+    for (quint64 s = 0; s < samples && maxc < 256; s++)
+    {
+        const char *p = begin + s * n / samples * stride + rgbOffset;
+        for (int c = 0; c < 3; c++)
+            maxc = qMax(maxc, le<quint16>(p + 2 * c));
+    }
+    colorScale = maxc < 256 ? 1.0f / 255 : 1.0f / 65535;
+}
+
+
+const char *PointCloudLas::decode(const char *begin, const char *end,
+                                  point_vec &points, color_vec &colors)
+// ----------------------------------------------------------------------------
+//   Decode complete records in batches
+// ----------------------------------------------------------------------------
+{
+    quint64 n = (end - begin) / stride;
+    if (n > count - decoded)
+        n = count - decoded;
+
+    qint32 raw[3][BATCH];
+    float xyz[3][BATCH];
+    const char *p = begin;
+    while (n)
+    {
+        size_t batch = n < quint64(BATCH) ? size_t(n) : size_t(BATCH);
+        const char *record = p;
+        for (size_t i = 0; i < batch; i++, record += stride)
+            for (int c = 0; c < 3; c++)
+                raw[c][i] = le<qint32>(record + 4 * c);
+        for (int c = 0; c < 3; c++)
+            transform(raw[c], xyz[c], batch, scale[c], offset[c]);
+
+        for (size_t i = 0; i < batch; i++)
+            points.push_back(Point(xyz[0][i], xyz[1][i], xyz[2][i]));
+        if (colored)
+        {
+            record = p + rgbOffset;
+            for (size_t i = 0; i < batch; i++, record += stride)
+                colors.push_back(Color(le<quint16>(record) * colorScale,
+                                       le<quint16>(record + 2) * colorScale,
+                                       le<quint16>(record + 4) * colorScale,
+                                       1.0f));
+        }
+
+        p += batch * stride;
+        decoded += batch;
+        n -= batch;
+    }
+    return p;
+}
+
+
+void PointCloudLas::transform(const qint32 *in, float *out, size_t n,
+                              double scale, double offset)
+// ----------------------------------------------------------------------------
+//   Compute out[i] = in[i] * scale + offset, in double precision
+// ----------------------------------------------------------------------------
+{
+    size_t i = 0;
+
+#if defined(__AVX__)
+    __m256d s4 = _mm256_set1_pd(scale);
+    __m256d o4 = _mm256_set1_pd(offset);
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *) (in + i));
+        __m256d d = _mm256_add_pd(_mm256_mul_pd(_mm256_cvtepi32_pd(v), s4),
+                                  o4);
+        _mm_storeu_ps(out + i, _mm256_cvtpd_ps(d));
+    }
+#elif defined(__SSE2__)
+    __m128d s2 = _mm_set1_pd(scale);
+    __m128d o2 = _mm_set1_pd(offset);
+    for (; i + 4 <= n; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *) (in + i));
+        __m128d lo = _mm_cvtepi32_pd(v);
+        __m128d hi = _mm_cvtepi32_pd(_mm_shuffle_epi32(v, 0xEE));
+        lo = _mm_add_pd(_mm_mul_pd(lo, s2), o2);
+        hi = _mm_add_pd(_mm_mul_pd(hi, s2), o2);
+        _mm_storeu_ps(out + i, _mm_movelh_ps(_mm_cvtpd_ps(lo),
+                                             _mm_cvtpd_ps(hi)));
+    }
+#endif
+
+    for (; i < n; i++)
+        out[i] = float(in[i] * scale + offset);
+}
@@ -0,0 +1,74 @@
+#ifndef POINT_CLOUD_LAS_H
+#define POINT_CLOUD_LAS_H
+// *****************************************************************************
+// point_cloud_las.h                                               Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Reading point clouds from LAS files.
+//
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include "point_cloud_decoder.h"
+
+
+class PointCloudLas : public PointCloudDecoder
+// ----------------------------------------------------------------------------
+//    Decode point data records of uncompressed LAS 1.2 to 1.4 files
+// ----------------------------------------------------------------------------
+//    Point data formats 0 to 3 and 6 to 8 are supported. Integer coordinates
+//    are scaled and offset in batches, using SIMD instructions if available.
+{
+public:
+    PointCloudLas();
+
+public:
+    virtual const char *  name() { return "LAS"; }
+    virtual size_t        headerSize(const char *begin, const char *end);
+    virtual bool          header(const char *begin, const char *end,
+                                 text &error);
+    virtual void          sample(const char *begin, const char *end);
+    virtual const char *  decode(const char *begin, const char *end,
+                                 point_vec &points, color_vec &colors);
+
+protected:
+    enum { BATCH = 1024, SAMPLES = 4096 };
+    static void   transform(const qint32 *in, float *out, size_t n,
+                            double scale, double offset);
+
+protected:
+    int           format;       // Point data record format
+    size_t        rgbOffset;    // Offset of RGB in record, 0 if none
+    float         colorScale;   // 16-bit or 8-bit color values, see sample()
+    double        scale[3];
+    double        offset[3];
+};
+
+#endif // POINT_CLOUD_LAS_H
@@ -0,0 +1,266 @@
+// *****************************************************************************
+// point_cloud_pack.cpp                                            Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Losslessly compressed copy of the points of an optimized cloud.
+//
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include "point_cloud_pack.h"
+#include "point_cloud_factory.h"
+#include <string.h>
+
+
+void PointCloudPack::start(point_vec &pts, color_vec &cols)
+// ----------------------------------------------------------------------------
+//   Pack points and colors in the background, leaving the vectors empty
+// ----------------------------------------------------------------------------
+//   The vectors are taken over and packed by the worker threads, so that
+//   the caller does not wait. They are freed by packing() or wait().
+{
+    clear();
+    count = pts.size();
+    colored = cols.size() == pts.size() && count != 0;
+    pointBlocks.resize(pts.blockCount());
+    if (colored)
+        colorBlocks.resize(cols.blockCount());
+
+    // Workers only read the vectors while packing
+    sourcePoints.swap(pts);
+    sourceColors.swap(cols);
+    point_vec().swap(pts);
+    color_vec().swap(cols);
+    points = &sourcePoints;
+    colors = &sourceColors;
+    parallel(true);
+}
+
+
+bool PointCloudPack::packing()
+// ----------------------------------------------------------------------------
+//   Check if blocks are still being packed, free the source once they are not
+// ----------------------------------------------------------------------------
+{
+    if (running.empty())
+        return false;
+    if (done.available() < int(running.size()))
+        return true;
+    wait();
+    return false;
+}
+
+
+void PointCloudPack::wait()
+// ----------------------------------------------------------------------------
+//   Wait for the blocks being packed or unpacked, then release the tasks
+// ----------------------------------------------------------------------------
+{
+    if (running.empty())
+        return;
+    done.acquire(running.size());
+    for (size_t t = 0; t < running.size(); t++)
+        delete running[t];
+    running.clear();
+
+    points = NULL;
+    colors = NULL;
+    point_vec().swap(sourcePoints);
+    color_vec().swap(sourceColors);
+}
+
+
+bool PointCloudPack::unpack(point_vec &pts, color_vec &cols)
+// ----------------------------------------------------------------------------
+//   Restore the points and colors exactly as packed, false on error
+// ----------------------------------------------------------------------------
+{
+    wait();
+    pts.clear();
+    cols.clear();
+    pts.resize(count, Point(0, 0, 0));
+    if (colored)
+        cols.resize(count);
+
+    points = &pts;
+    colors = &cols;
+    parallel(false);
+    wait();
+
+    if (failed.loadAcquire())
+    {
+        pts.clear();
+        cols.clear();
+        return false;
+    }
+    return true;
+}
+
+
+void PointCloudPack::clear()
+// ----------------------------------------------------------------------------
+//   Release the packed data, stopping the blocks being packed
+// ----------------------------------------------------------------------------
+{
+    // Tasks not started are unqueued, the others stop after their block
+    for (size_t t = 0; t < running.size(); t++)
+        running[t]->interrupt();
+    done.tryAcquire(done.available());
+    for (size_t t = 0; t < running.size(); t++)
+        delete running[t];
+    running.clear();
+    points = NULL;
+    colors = NULL;
+    point_vec().swap(sourcePoints);
+    color_vec().swap(sourceColors);
+
+    count = 0;
+    colored = false;
+    std::vector<QByteArray>().swap(pointBlocks);
+    std::vector<QByteArray>().swap(colorBlocks);
+}
+
+
+size_t PointCloudPack::bytes()
+// ----------------------------------------------------------------------------
+//   Size of the packed data
+// ----------------------------------------------------------------------------
+{
+    wait();
+    size_t total = 0;
+    for (size_t b = 0; b < pointBlocks.size(); b++)
+        total += pointBlocks[b].size();
+    for (size_t b = 0; b < colorBlocks.size(); b++)
+        total += colorBlocks[b].size();
+    return total;
+}
+
+
+void PointCloudPack::parallel(bool packing)
+// ----------------------------------------------------------------------------
+//   Split the blocks among the worker threads, see wait() for the end
+// ----------------------------------------------------------------------------
+{
+    failed.storeRelease(0);
+    size_t blocks = pointBlocks.size();
+    if (!blocks)
+        return;
+
+    ThreadPool &workers = PointCloudFactory::instance()->workers;
+    size_t tasks = qMin(blocks, size_t(4 * qMax(workers.maxThreadCount(), 1)));
+    size_t slice = (blocks + tasks - 1) / tasks;
+    for (size_t first = 0; first < blocks; first += slice)
+    {
+        size_t last = qMin(blocks, first + slice);
+        running.push_back(new PointCloudPackTask(this, packing,
+                                                 first, last, done));
+        workers.start(running.back());
+    }
+}
+
+
+void PointCloudPack::run(bool packing, size_t b)
+// ----------------------------------------------------------------------------
+//   Pack or unpack block b in a worker thread
+// ----------------------------------------------------------------------------
+{
+    size_t index = b * point_vec::BLOCK;
+    size_t n = count - index;
+    float *p = (float *) points->span(index, n);
+    if (packing)
+        pointBlocks[b] = encode(p, 3 * n, 3);
+    else if (!decode(pointBlocks[b], p, 3 * n, 3))
+        failed.storeRelease(1);
+
+    if (colored)
+    {
+        float *c = (float *) colors->span(index, n);
+        if (packing)
+            colorBlocks[b] = encode(c, 4 * n, 4);
+        else if (!decode(colorBlocks[b], c, 4 * n, 4))
+            failed.storeRelease(1);
+    }
+}
+
+
+QByteArray PointCloudPack::encode(const float *values, size_t n, size_t stride)
+// ----------------------------------------------------------------------------
+//   Compress n floats, each one predicted by the one stride floats before
+// ----------------------------------------------------------------------------
+//   The bits of each value are XOR-ed with those of the same component of
+//   the previous point. Nearby points share sign, exponent and high mantissa
+//   bits, which become zeros. The bytes of the differences are then grouped
+//   by significance, so that zlib sees long runs of similar bytes.
+{
+    QByteArray planes(int(4 * n), 0);
+    uchar *out = (uchar *) planes.data();
+    for (size_t i = 0; i < n; i++)
+    {
+        quint32 bits, previous = 0;
+        memcpy(&bits, &values[i], sizeof(bits));
+        if (i >= stride)
+            memcpy(&previous, &values[i - stride], sizeof(previous));
+        bits ^= previous;
+        out[i]         = bits >> 24;
+        out[n + i]     = bits >> 16;
+        out[2 * n + i] = bits >> 8;
+        out[3 * n + i] = bits;
+    }
+
+    // Fastest level, so that the points are freed early after optimize()
+    return qCompress(planes, 1);
+}
+
+
+bool PointCloudPack::decode(const QByteArray &data, float *values,
+                            size_t n, size_t stride)
+// ----------------------------------------------------------------------------
+//   Restore n floats compressed by encode(), false if data is corrupt
+// ----------------------------------------------------------------------------
+{
+    QByteArray planes = qUncompress(data);
+    if (size_t(planes.size()) != 4 * n)
+        return false;
+
+    const uchar *in = (const uchar *) planes.constData();
+    for (size_t i = 0; i < n; i++)
+    {
+        quint32 bits = (quint32(in[i]) << 24 |
+                        quint32(in[n + i]) << 16 |
+                        quint32(in[2 * n + i]) << 8 |
+                        quint32(in[3 * n + i]));
+        quint32 previous = 0;
+        if (i >= stride)
+            memcpy(&previous, &values[i - stride], sizeof(previous));
+        bits ^= previous;
+        memcpy(&values[i], &bits, sizeof(bits));
+    }
+    return true;
+}
@@ -0,0 +1,127 @@
+#ifndef POINT_CLOUD_PACK_H
+#define POINT_CLOUD_PACK_H
+// *****************************************************************************
+// point_cloud_pack.h                                              Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Losslessly compressed copy of the points of an optimized cloud.
+//
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include "point_cloud.h"
+#include "thread_pool.h"
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QSemaphore>
+#include <vector>
+
+struct PointCloudPackTask;
+
+
+class PointCloudPack
+// ----------------------------------------------------------------------------
+//    Losslessly compressed copy of the points and colors of a cloud
+// ----------------------------------------------------------------------------
+//    Optimized clouds keep it instead of their points, to restore their
+//    VBOs when the GL context changes. Each block of the point and color
+//    vectors is packed separately, so that blocks are packed and unpacked
+//    in parallel by the worker threads. Packing runs in the background:
+//    start() takes the vectors over and returns at once, and they are
+//    freed once all blocks are packed. Reading the packed data waits for
+//    the blocks still being packed.
+{
+public:
+    typedef PointCloud::Point           Point;
+    typedef PointCloud::Color           Color;
+    typedef PointCloud::point_vec       point_vec;
+    typedef PointCloud::color_vec       color_vec;
+
+public:
+    PointCloudPack() : count(0), colored(false), points(NULL), colors(NULL) {}
+    ~PointCloudPack() { clear(); }
+
+public:
+    void          start(point_vec &points, color_vec &colors);
+    bool          packing();
+    void          wait();
+    bool          unpack(point_vec &points, color_vec &colors);
+    void          clear();
+    unsigned      size() { return count; }
+    size_t        bytes();
+    void          run(bool packing, size_t block);
+
+public:
+    static QByteArray encode(const float *values, size_t n, size_t stride);
+    static bool   decode(const QByteArray &data, float *values,
+                         size_t n, size_t stride);
+
+protected:
+    void          parallel(bool packing);
+
+protected:
+    unsigned                count;      // Points packed
+    bool                    colored;
+    std::vector<QByteArray> pointBlocks, colorBlocks;
+
+    // Vectors read or written by the worker threads, see parallel()
+    point_vec *             points;
+    color_vec *             colors;
+    point_vec               sourcePoints; // Taken over by start()
+    color_vec               sourceColors;
+    std::vector<PointCloudPackTask *> running;
+    QSemaphore              done;       // Released by each task
+    QAtomicInt              failed;
+};
+
+
+struct PointCloudPackTask : Runnable
+// ----------------------------------------------------------------------------
+//    Pack or unpack a range of blocks in a worker thread
+// ----------------------------------------------------------------------------
+{
+    PointCloudPackTask(PointCloudPack *pack, bool packing,
+                       size_t first, size_t last, QSemaphore &done)
+        : pack(pack), packing(packing),
+          first(first), last(last), done(done) {}
+    virtual void run()
+    {
+        for (size_t b = first; b < last && !interrupted(); b++)
+            pack->run(packing, b);
+        done.release();
+    }
+
+    PointCloudPack *    pack;
+    bool                packing;
+    size_t              first, last;
+    QSemaphore &        done;
+};
+
+#endif // POINT_CLOUD_PACK_H
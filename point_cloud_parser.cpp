@@ -0,0 +1,481 @@
+// *****************************************************************************
+// point_cloud_parser.cpp                                          Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Parsing delimited text point data directly from raw bytes.
+//
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+#include "point_cloud_parser.h"
+#include <QString>
+#include <QtGlobal>
+#include <algorithm>
+#include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+PointCloudParser::PointCloudParser(const LoadDataParm &parm)
+// ----------------------------------------------------------------------------
+//   Constructor
+// ----------------------------------------------------------------------------
+    : count(0), sep(parm.sep),
+      xi(parm.xi), yi(parm.yi), zi(parm.zi),
+      colorScale(parm.colorScale),
+      ri(parm.ri), gi(parm.gi), bi(parm.bi), ai(parm.ai)
+{
+    // Same rule as QString::split(): lines with less fields are skipped
+    int maxp = qMax(qMax(xi, yi), zi);
+    float maxc = qMax(qMax(ri, gi), qMax(bi, ai));
+    maxIndex = qMax(maxp, (int) maxc);
+    fields.resize(2 * maxIndex);
+}
+
+
+const char *PointCloudParser::parse(const char *begin, const char *end,
+                                    point_vec &points, color_vec &colors)
+// ----------------------------------------------------------------------------
+//   Parse all lines in [begin, end), including a last unterminated one
+// ----------------------------------------------------------------------------
+{
+    const char *line = begin;
+    while (line < end)
+    {
+        const char *eol = (const char *) memchr(line, '\n', end - line);
+        const char *next = eol ? eol + 1 : end;
+        if (!eol)
+            eol = end;
+        if (eol > line && eol[-1] == '\r')
+            eol--;
+
+        float x, y, z;
+        if (split(line, eol) &&
+            field(xi, x) && field(yi, y) && field(zi, z))
+        {
+            if (colorScale)
+            {
+                float r = -ri, g = -gi, b = -bi, a = -ai;
+                if ((ri <= 0 || colorField(ri, r)) &&
+                    (gi <= 0 || colorField(gi, g)) &&
+                    (bi <= 0 || colorField(bi, b)) &&
+                    (ai <= 0 || colorField(ai, a)))
+                {
+                    if (ri > 0) r *= colorScale;
+                    if (gi > 0) g *= colorScale;
+                    if (bi > 0) b *= colorScale;
+                    if (ai > 0) a *= colorScale;
+                    colors.push_back(Color(r, g, b, a));
+                    points.push_back(Point(x, y, z));
+                    count++;
+                }
+            }
+            else
+            {
+                points.push_back(Point(x, y, z));
+                count++;
+            }
+        }
+        line = next;
+    }
+    return line;
+}
+
+
+const char *PointCloudParser::lastLine(const char *begin, const char *end)
+// ----------------------------------------------------------------------------
+//   Return the start of the last (incomplete) line in [begin, end)
+// ----------------------------------------------------------------------------
+{
+    const char *p = end;
+    while (p > begin && p[-1] != '\n')
+        p--;
+    return p;
+}
+
+
+const char *PointCloudParser::nextLine(const char *pos, const char *end)
+// ----------------------------------------------------------------------------
+//   Return the start of the first line beginning after pos
+// ----------------------------------------------------------------------------
+{
+    if (pos >= end)
+        return end;
+    const char *eol = (const char *) memchr(pos, '\n', end - pos);
+    return eol ? eol + 1 : end;
+}
+
+
+const char *PointCloudParser::slice(const char *pos, const char *end,
+                                    size_t size)
+// ----------------------------------------------------------------------------
+//   End of a slice of about size bytes starting at pos, on a line boundary
+// ----------------------------------------------------------------------------
+{
+    if (size_t(end - pos) <= size)
+        return end;
+    return nextLine(pos + size, end);
+}
+
+
+size_t PointCloudParser::estimateLines(const char *begin, const char *end,
+                                       double size)
+// ----------------------------------------------------------------------------
+//   Estimate the number of lines in size bytes from samples in [begin, end)
+// ----------------------------------------------------------------------------
+//   Complete lines are counted in a few windows spread over the range, and
+//   their average length is extrapolated. Small ranges are counted entirely.
+{
+    int samples = 16;
+    size_t window = 64 << 10;
+    size_t len = end - begin;
+    if (len <= samples * window)
+    {
+        samples = 1;
+        window = len;
+    }
+
+    size_t lines = 0, bytes = 0;
+    for (int i = 0; i < samples; i++)
+    {
+        const char *start = begin + len / samples * i;
+        if (i > 0)
+            start = nextLine(start, end);
+        const char *stop = lastLine(start, qMin(start + window, end));
+        for (const char *p = start; p < stop; lines++)
+            p = nextLine(p, stop);
+        bytes += stop - start;
+    }
+    if (!lines)
+        return 0;
+    return size_t(size * lines / bytes);
+}
+
+
+bool PointCloudParser::split(const char *line, const char *eol)
+// ----------------------------------------------------------------------------
+//   Record the boundaries of the first maxIndex fields of the line
+// ----------------------------------------------------------------------------
+{
+    const char **f = &fields[0];
+    size_t seplen = sep.length();
+    const char *p = line;
+    if (seplen == 1)
+    {
+        char c = sep[0];
+        for (int i = 0; i < maxIndex; i++)
+        {
+            const char *e = (const char *) memchr(p, c, eol - p);
+            *f++ = p;
+            *f++ = e ? e : eol;
+            if (!e)
+                return i + 1 >= maxIndex;
+            p = e + 1;
+        }
+        return true;
+    }
+
+    for (int i = 0; i < maxIndex; i++)
+    {
+        const char *e = seplen ? std::search(p, eol, sep.begin(), sep.end())
+                               : eol;
+        *f++ = p;
+        *f++ = e;
+        if (e == eol)
+            return i + 1 >= maxIndex;
+        p = e + seplen;
+    }
+    return true;
+}
+
+
+bool PointCloudParser::field(int index, float &value)
+// ----------------------------------------------------------------------------
+//   Convert field at given (1-based) index
+// ----------------------------------------------------------------------------
+{
+    const char **f = &fields[2 * (index - 1)];
+    return parseFloat(f[0], f[1], value);
+}
+
+
+bool PointCloudParser::colorField(int index, float &value)
+// ----------------------------------------------------------------------------
+//   Convert color field, with a fast path for 8-bit integer values
+// ----------------------------------------------------------------------------
+{
+    const char **f = &fields[2 * (index - 1)];
+    const char *p = f[0];
+    const char *e = f[1];
+    size_t len = e - p;
+    if (len - 1 < 3)
+    {
+        // 1 to 3 digits, converted without branches. Missing leading
+        // digits re-read a digit that is then masked out.
+        int two = len >= 2;
+        int three = len >= 3;
+        unsigned d2 = unsigned(e[-1] - '0');
+        unsigned d1 = unsigned(e[-1 - two] - '0');
+        unsigned d0 = unsigned(e[-1 - two - three] - '0');
+        if ((d0 < 10) & (d1 < 10) & (d2 < 10))
+        {
+            value = float(d2 + (d1 * 10 & -two) + (d0 * 100 & -three));
+            return true;
+        }
+    }
+    return parseFloat(p, e, value);
+}
+
+
+static inline bool isBlank(char c)
+// ----------------------------------------------------------------------------
+//   Whitespace ignored around numbers, as with QString::toFloat()
+// ----------------------------------------------------------------------------
+{
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+
+static inline unsigned firstSet(unsigned mask)
+// ----------------------------------------------------------------------------
+//   Index of the lowest bit set in a non-zero mask
+// ----------------------------------------------------------------------------
+{
+#ifdef __GNUC__
+    return __builtin_ctz(mask);
+#else
+    unsigned n = 0;
+    while (!(mask & 1))
+    {
+        mask >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+
+static inline size_t digitRun(const char *p, const char *end)
+// ----------------------------------------------------------------------------
+//   Number of consecutive ASCII digits starting at p
+// ----------------------------------------------------------------------------
+//   The vector loops only read whole registers inside [p, end): reading
+//   past the number into the following fields is harmless.
+{
+    const char *start = p;
+
+#if defined(__AVX2__)
+    const __m256i zero32 = _mm256_set1_epi8('0');
+    const __m256i nine32 = _mm256_set1_epi8(9);
+    while (end - p >= 32)
+    {
+        __m256i c = _mm256_loadu_si256((const __m256i *) p);
+        __m256i d = _mm256_sub_epi8(c, zero32);
+        __m256i digit = _mm256_cmpeq_epi8(_mm256_min_epu8(d, nine32), d);
+        unsigned other = ~unsigned(_mm256_movemask_epi8(digit));
+        if (other)
+            return p - start + firstSet(other);
+        p += 32;
+    }
+#endif // __AVX2__
+
+#if defined(__SSE2__)
+    const __m128i zero16 = _mm_set1_epi8('0');
+    const __m128i nine16 = _mm_set1_epi8(9);
+    while (end - p >= 16)
+    {
+        __m128i c = _mm_loadu_si128((const __m128i *) p);
+        __m128i d = _mm_sub_epi8(c, zero16);
+        __m128i digit = _mm_cmpeq_epi8(_mm_min_epu8(d, nine16), d);
+        unsigned other = ~unsigned(_mm_movemask_epi8(digit)) & 0xFFFF;
+        if (other)
+            return p - start + firstSet(other);
+        p += 16;
+    }
+#endif // __SSE2__
+
+    while (p < end && unsigned(*p - '0') < 10)
+        p++;
+    return p - start;
+}
+
+
+static inline quint64 convertDigits(const char *p, size_t n, quint64 value)
+// ----------------------------------------------------------------------------
+//   Append n ASCII digits to value, eight at a time when possible
+// ----------------------------------------------------------------------------
+{
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    // SWAR conversion: pairs, then quads, then the 8 digits in one word
+    for (; n >= 8; n -= 8, p += 8)
+    {
+        quint64 v;
+        memcpy(&v, p, 8);
+        v -= Q_UINT64_C(0x3030303030303030);
+        v = v * 10 + (v >> 8);
+        v = (((v & Q_UINT64_C(0x000000FF000000FF)) *
+              Q_UINT64_C(0x000F424000000064)) +
+             (((v >> 16) & Q_UINT64_C(0x000000FF000000FF)) *
+              Q_UINT64_C(0x0000271000000001))) >> 32;
+        value = value * 100000000 + quint32(v);
+    }
+#endif // Q_LITTLE_ENDIAN
+    while (n--)
+        value = value * 10 + unsigned(*p++ - '0');
+    return value;
+}
+
+
+static bool parseFloatSlow(const char *begin, const char *end, float &value)
+// ----------------------------------------------------------------------------
+//   Reference conversion, for anything the fast path can't convert exactly
+// ----------------------------------------------------------------------------
+{
+    bool ok = false;
+    value = QString::fromLatin1(begin, end - begin).toFloat(&ok);
+    return ok;
+}
+
+
+bool PointCloudParser::parseFloat(const char *begin, const char *end,
+                                  float &value)
+// ----------------------------------------------------------------------------
+//   Locale-independent conversion of [-]ddd.ddd[e[+-]dd] without allocation
+// ----------------------------------------------------------------------------
+//   The decimal mantissa is accumulated as an integer. When it fits in
+//   53 bits and the power of ten is exact in a double, a single multiply
+//   or divide is correctly rounded, so the result is bit-identical to
+//   QString::toFloat(). Other inputs go through the slow path.
+{
+    static const double pow10[] =
+    {
+        1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10,
+        1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21,
+        1e22
+    };
+
+    const char *p = begin;
+    while (p < end && isBlank(*p))
+        p++;
+    while (end > p && isBlank(end[-1]))
+        end--;
+    if (p == end)
+        return false;
+
+    bool negative = false;
+    if (*p == '-' || *p == '+')
+        negative = *p++ == '-';
+
+    // Integer and fraction digits, scanned and converted in bulk
+    const char *ip = p;
+    size_t ilen = digitRun(p, end);
+    p += ilen;
+    const char *fp = p;
+    size_t flen = 0;
+    if (p < end && *p == '.')
+    {
+        fp = ++p;
+        flen = digitRun(p, end);
+        p += flen;
+    }
+    if (ilen + flen == 0 || ilen + flen > 19)
+        return parseFloatSlow(begin, end, value);
+    quint64 mantissa = convertDigits(ip, ilen, 0);
+    mantissa = convertDigits(fp, flen, mantissa);
+    int exponent = -int(flen);
+
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        bool eneg = false;
+        if (++p < end && (*p == '-' || *p == '+'))
+            eneg = *p++ == '-';
+        if (p == end)
+            return parseFloatSlow(begin, end, value);
+        int e = 0;
+        for (; p < end && unsigned(*p - '0') < 10; p++)
+            if (e < 10000)
+                e = e * 10 + unsigned(*p - '0');
+        exponent += eneg ? -e : e;
+    }
+    if (p != end)
+        return parseFloatSlow(begin, end, value);
+
+    if (mantissa == 0)
+    {
+        value = negative ? -0.0f : 0.0f;
+        return true;
+    }
+    if (mantissa > (Q_UINT64_C(1) << 53) || exponent < -22 || exponent > 22)
+        return parseFloatSlow(begin, end, value);
+
+    double d = double(mantissa);
+    d = exponent < 0 ? d / pow10[-exponent] : d * pow10[exponent];
+    value = float(negative ? -d : d);
+    return true;
+}
+
+
+
+// ============================================================================
+//
+//    Parallel parsing of large files
+//
+// ============================================================================
+
+PointCloudChunk::PointCloudChunk(const LoadDataParm &parm,
+                                 const char *begin, const char *end,
+                                 QSemaphore &done, QAtomicInt &cancel)
+// ----------------------------------------------------------------------------
+//   Constructor
+// ----------------------------------------------------------------------------
+    : parser(parm), begin(begin), end(end), parsed(0), finished(0),
+      done(done), cancel(cancel)
+{}
+
+
+void PointCloudChunk::run()
+// ----------------------------------------------------------------------------
+//   Parse the chunk in slices, checking for cancellation between slices
+// ----------------------------------------------------------------------------
+{
+    const size_t sliceSize = 1 << 20;
+    const char *pos = begin;
+    while (pos < end && !cancel.loadAcquire() && !interrupted())
+    {
+        const char *stop = PointCloudParser::slice(pos, end, sliceSize);
+        pos = parser.parse(pos, stop, points, colors);
+        parsed.storeRelease(pos - begin);
+    }
+    finished.storeRelease(1);
+    done.release();
+}
@@ -0,0 +1,125 @@
+#ifndef POINT_CLOUD_PARSER_H
+#define POINT_CLOUD_PARSER_H
+// *****************************************************************************
+// point_cloud_parser.h                                            Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Parsing delimited text point data directly from raw bytes.
+//
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+#include "point_cloud.h"
+#include "thread_pool.h"
+#include <QAtomicInt>
+#include <QSemaphore>
+#include <vector>
+
+
+class PointCloudParser
+// ----------------------------------------------------------------------------
+//    Tokenize lines of text in place and convert them to points and colors
+// ----------------------------------------------------------------------------
+//    The parser works on byte ranges (memory-mapped file or I/O buffer)
+//    and does not allocate anything per line. It honors the column indices,
+//    separator and color scaling of PointCloud::LoadDataParm, and yields
+//    the same points as splitting each line and calling QString::toFloat.
+{
+public:
+    typedef PointCloud::Point           Point;
+    typedef PointCloud::Color           Color;
+    typedef PointCloud::point_vec       point_vec;
+    typedef PointCloud::color_vec       color_vec;
+    typedef PointCloud::LoadDataParm    LoadDataParm;
+
+public:
+    PointCloudParser(const LoadDataParm &parm);
+
+public:
+    const char *  parse(const char *begin, const char *end,
+                        point_vec &points, color_vec &colors);
+    bool          colored() { return colorScale != 0.0; }
+
+public:
+    static bool   parseFloat(const char *begin, const char *end, float &value);
+    static const char *lastLine(const char *begin, const char *end);
+    static const char *nextLine(const char *pos, const char *end);
+    static const char *slice(const char *pos, const char *end, size_t size);
+    static size_t estimateLines(const char *begin, const char *end,
+                                double size);
+
+public:
+    unsigned      count;        // Number of points parsed so far
+
+protected:
+    bool          split(const char *line, const char *eol);
+    bool          field(int index, float &value);
+    bool          colorField(int index, float &value);
+
+protected:
+    std::string   sep;
+    int           xi, yi, zi;
+    float         colorScale, ri, gi, bi, ai;
+    int           maxIndex;
+
+    // Boundaries of the fields of the current line, reused for every line
+    std::vector<const char *> fields;
+};
+
+
+struct PointCloudChunk : Runnable
+// ----------------------------------------------------------------------------
+//    Parse a range of complete lines of a file in a worker thread
+// ----------------------------------------------------------------------------
+{
+    typedef PointCloudParser::point_vec       point_vec;
+    typedef PointCloudParser::color_vec       color_vec;
+    typedef PointCloudParser::LoadDataParm    LoadDataParm;
+
+public:
+    PointCloudChunk(const LoadDataParm &parm,
+                    const char *begin, const char *end,
+                    QSemaphore &done, QAtomicInt &cancel);
+    virtual void run();  // From Runnable
+
+public:
+    PointCloudParser    parser;
+    const char *        begin;
+    const char *        end;
+    QAtomicInt          parsed; // Bytes parsed so far
+    QAtomicInt          finished; // Set when points and colors are final
+    point_vec           points;
+    color_vec           colors;
+
+protected:
+    QSemaphore &        done;   // Released once when the chunk is done
+    QAtomicInt &        cancel; // Set by the loader to stop all chunks
+};
+
+#endif // POINT_CLOUD_PARSER_H
@@ -0,0 +1,297 @@
+// *****************************************************************************
+// point_cloud_ply.cpp                                             Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Reading point clouds from binary PLY files.
+//
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include "point_cloud_ply.h"
+#include <QtEndian>
+#include <sstream>
+#include <string.h>
+
+
+PointCloudPly::PointCloudPly()
+// ----------------------------------------------------------------------------
+//   Constructor
+// ----------------------------------------------------------------------------
+    : bigEndian(false)
+{}
+
+
+size_t PointCloudPly::headerSize(const char *begin, const char *end)
+// ----------------------------------------------------------------------------
+//   Size of the header including "end_header", 0 if not complete yet
+// ----------------------------------------------------------------------------
+{
+    static const char marker[] = "end_header";
+    const size_t len = sizeof(marker) - 1;
+    for (const char *p = begin; p + len < end; p++)
+    {
+        p = (const char *) memchr(p, 'e', end - len - p);
+        if (!p)
+            break;
+        if ((p == begin || p[-1] == '\n') && memcmp(p, marker, len) == 0)
+        {
+            const char *eol = (const char *) memchr(p, '\n', end - p);
+            return eol ? eol + 1 - begin : 0;
+        }
+    }
+    return 0;
+}
+
+
+bool PointCloudPly::header(const char *begin, const char *end, text &error)
+// ----------------------------------------------------------------------------
+//   Parse the header, locating the vertex properties we know about
+// ----------------------------------------------------------------------------
+{
+    std::istringstream in(std::string(begin, end - begin));
+    std::string line, word;
+    bool inVertex = false, seenVertex = false, ascii = false;
+    quint64 elementCount = 0;
+    size_t elementSize = 0;
+    bool elementFixed = true;
+
+    std::getline(in, line);
+    if (line.compare(0, 3, "ply") != 0)
+    {
+        error = "Not a PLY file";
+        return false;
+    }
+
+    while (std::getline(in, line))
+    {
+        std::istringstream words(line);
+        words >> word;
+        if (word == "format")
+        {
+            words >> word;
+            ascii = word == "ascii";
+            bigEndian = word == "binary_big_endian";
+        }
+        else if (word == "element" || word == "end_header")
+        {
+            // Account for the size of elements stored before vertices
+            if (!seenVertex && !inVertex && elementCount)
+            {
+                if (!elementFixed)
+                {
+                    error = "Unsupported PLY file: variable-size elements "
+                            "before vertices";
+                    return false;
+                }
+                skip += elementCount * elementSize;
+            }
+            if (inVertex)
+                seenVertex = true;
+            if (word == "end_header")
+                break;
+
+            std::string name;
+            words >> name >> elementCount;
+            inVertex = !seenVertex && name == "vertex";
+            if (inVertex)
+                count = elementCount;
+            elementSize = 0;
+            elementFixed = true;
+        }
+        else if (word == "property")
+        {
+            std::string ptype, name;
+            words >> ptype;
+            if (ptype == "list")
+            {
+                elementFixed = false;
+                if (inVertex)
+                {
+                    error = "Unsupported PLY file: list in vertex element";
+                    return false;
+                }
+                continue;
+            }
+            words >> name;
+            Type t = type(ptype);
+            if (t == NONE)
+            {
+                error = "Unsupported PLY property type: " + ptype;
+                return false;
+            }
+            if (inVertex)
+            {
+                Property *prop = NULL;
+                if (name == "x")                                prop = &x;
+                else if (name == "y")                           prop = &y;
+                else if (name == "z")                           prop = &z;
+                else if (name == "red" || name == "r")          prop = &r;
+                else if (name == "green" || name == "g")        prop = &g;
+                else if (name == "blue" || name == "b")         prop = &b;
+                else if (name == "alpha" || name == "a")        prop = &a;
+                if (prop)
+                {
+                    prop->type = t;
+                    prop->offset = elementSize;
+                    if (prop != &x && prop != &y && prop != &z)
+                    {
+                        if (t == UINT8)
+                            prop->scale = 1.0f / 255;
+                        else if (t == UINT16)
+                            prop->scale = 1.0f / 65535;
+                    }
+                }
+            }
+            elementSize += typeSize(t);
+            if (inVertex)
+                stride = elementSize;
+        }
+    }
+
+    if (ascii)
+    {
+        error = "Unsupported PLY file: only binary PLY files can be loaded";
+        return false;
+    }
+    if (!seenVertex || x.type == NONE || y.type == NONE || z.type == NONE)
+    {
+        error = "PLY file has no vertex coordinates";
+        return false;
+    }
+    colored = r.type != NONE && g.type != NONE && b.type != NONE;
+    return true;
+}
+
+
+const char *PointCloudPly::decode(const char *begin, const char *end,
+                                  point_vec &points, color_vec &colors)
+// ----------------------------------------------------------------------------
+//   Decode all complete vertices in [begin, end), return where we stopped
+// ----------------------------------------------------------------------------
+{
+    quint64 n = (end - begin) / stride;
+    if (n > count - decoded)
+        n = count - decoded;
+
+    const char *p = begin;
+    for (quint64 i = 0; i < n; i++, p += stride)
+    {
+        points.push_back(Point(value(p, x), value(p, y), value(p, z)));
+        if (colored)
+            colors.push_back(Color(value(p, r), value(p, g), value(p, b),
+                                   a.type != NONE ? value(p, a) : 1.0f));
+    }
+    decoded += n;
+    return p;
+}
+
+
+PointCloudPly::Type PointCloudPly::type(const std::string &name)
+// ----------------------------------------------------------------------------
+//   Convert a PLY type name, accepting both naming conventions
+// ----------------------------------------------------------------------------
+{
+    if (name == "char"   || name == "int8")     return INT8;
+    if (name == "uchar"  || name == "uint8")    return UINT8;
+    if (name == "short"  || name == "int16")    return INT16;
+    if (name == "ushort" || name == "uint16")   return UINT16;
+    if (name == "int"    || name == "int32")    return INT32;
+    if (name == "uint"   || name == "uint32")   return UINT32;
+    if (name == "float"  || name == "float32")  return FLOAT32;
+    if (name == "double" || name == "float64")  return FLOAT64;
+    return NONE;
+}
+
+
+size_t PointCloudPly::typeSize(Type type)
+// ----------------------------------------------------------------------------
+//   Size in bytes of a value of the given type
+// ----------------------------------------------------------------------------
+{
+    switch(type)
+    {
+    case INT8:
+    case UINT8:         return 1;
+    case INT16:
+    case UINT16:        return 2;
+    case INT32:
+    case UINT32:
+    case FLOAT32:       return 4;
+    case FLOAT64:       return 8;
+    default:            return 0;
+    }
+}
+
+
+template <typename T>
+static inline T load(const char *p, bool bigEndian)
+// ----------------------------------------------------------------------------
+//   Load a value stored with the given byte order
+// ----------------------------------------------------------------------------
+{
+    const uchar *u = (const uchar *) p;
+    return bigEndian ? qFromBigEndian<T>(u) : qFromLittleEndian<T>(u);
+}
+
+
+float PointCloudPly::value(const char *vertex, const Property &prop)
+// ----------------------------------------------------------------------------
+//   Read a property of a vertex as a float
+// ----------------------------------------------------------------------------
+{
+    const char *p = vertex + prop.offset;
+    float f = 0.0f;
+    switch(prop.type)
+    {
+    case INT8:      f = *((const qint8 *) p);                   break;
+    case UINT8:     f = *((const quint8 *) p);                  break;
+    case INT16:     f = load<qint16>(p, bigEndian);             break;
+    case UINT16:    f = load<quint16>(p, bigEndian);            break;
+    case INT32:     f = load<qint32>(p, bigEndian);             break;
+    case UINT32:    f = load<quint32>(p, bigEndian);            break;
+    case FLOAT32:
+    {
+        quint32 bits = load<quint32>(p, bigEndian);
+        memcpy(&f, &bits, sizeof(f));
+        break;
+    }
+    case FLOAT64:
+    {
+        quint64 bits = load<quint64>(p, bigEndian);
+        double d;
+        memcpy(&d, &bits, sizeof(d));
+        f = d;
+        break;
+    }
+    default:
+        break;
+    }
+    return f * prop.scale;
+}
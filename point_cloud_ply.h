@@ -0,0 +1,83 @@
+#ifndef POINT_CLOUD_PLY_H
+#define POINT_CLOUD_PLY_H
+// *****************************************************************************
+// point_cloud_ply.h                                               Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Reading point clouds from binary PLY files.
+//
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include "point_cloud_decoder.h"
+
+
+class PointCloudPly : public PointCloudDecoder
+// ----------------------------------------------------------------------------
+//    Decode the vertices of binary PLY files (little or big endian)
+// ----------------------------------------------------------------------------
+//    Elements stored before the vertices are skipped (see 'skip'), those
+//    stored after them are ignored.
+{
+public:
+    PointCloudPly();
+
+public:
+    virtual const char *  name() { return "PLY"; }
+    virtual size_t        headerSize(const char *begin, const char *end);
+    virtual bool          header(const char *begin, const char *end,
+                                 text &error);
+    virtual const char *  decode(const char *begin, const char *end,
+                                 point_vec &points, color_vec &colors);
+
+protected:
+    enum Type
+    {
+        NONE, INT8, UINT8, INT16, UINT16, INT32, UINT32, FLOAT32, FLOAT64
+    };
+    struct Property
+    {
+        Property(): type(NONE), offset(0), scale(1.0f) {}
+        Type    type;
+        size_t  offset;
+        float   scale;          // Normalizes integer color components
+    };
+
+protected:
+    static Type   type(const std::string &name);
+    static size_t typeSize(Type type);
+    float         value(const char *vertex, const Property &property);
+
+protected:
+    bool          bigEndian;
+    Property      x, y, z, r, g, b, a;
+};
+
+#endif // POINT_CLOUD_PLY_H
@@ -0,0 +1,224 @@
+// *****************************************************************************
+// point_cloud_shader.cpp                                          Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Program drawing the VBOs of point clouds with vertex attributes
+//
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include "point_cloud_shader.h"
+#include "tao/tao_gl.h"
+#include <vector>
+
+
+static const char *vertexSource =
+    "#version 120\n"
+    "attribute vec3 position;\n"
+    "attribute vec4 color;\n"
+    "uniform mat4 matrix;\n"
+    "uniform vec3 origin;\n"
+    "uniform vec3 step;\n"
+    "uniform float pointSize;\n"
+    "varying vec4 pointColor;\n"
+    "void main()\n"
+    "{\n"
+    "    gl_Position = matrix * vec4(origin + position * step, 1.0);\n"
+    "    gl_PointSize = pointSize;\n"
+    "    pointColor = color;\n"
+    "}\n";
+
+static const char *fragmentSource =
+    "#version 120\n"
+    "uniform bool sprites;\n"
+    "uniform sampler2D sprite;\n"
+    "varying vec4 pointColor;\n"
+    "void main()\n"
+    "{\n"
+    "    gl_FragColor = pointColor;\n"
+    "    if (sprites)\n"
+    "        gl_FragColor *= texture2D(sprite, gl_PointCoord);\n"
+    "}\n";
+
+
+PointCloudShader::PointCloudShader()
+// ----------------------------------------------------------------------------
+//   Constructor, the program is built on first use
+// ----------------------------------------------------------------------------
+    : context(NULL), program(0), failed(false), previous(0),
+      matrix(-1), origin(-1), step(-1), pointSize(-1), sprites(-1), sprite(-1)
+{}
+
+
+bool PointCloudShader::ready()
+// ----------------------------------------------------------------------------
+//   Build the program for the current context if needed, false if it fails
+// ----------------------------------------------------------------------------
+{
+    if (QGLContext::currentContext() != context)
+    {
+        // The program of the previous context is gone with it
+        context = QGLContext::currentContext();
+        program = 0;
+        failed = false;
+    }
+    if (!program && !failed)
+        failed = !compile();
+    return program != 0;
+}
+
+
+void PointCloudShader::bind()
+// ----------------------------------------------------------------------------
+//   Use the program until unbind(), for one or more clouds
+// ----------------------------------------------------------------------------
+{
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previous);
+    glUseProgram(program);
+}
+
+
+void PointCloudShader::uniforms(const GLfloat m[16],
+                                const Point &o, const Point &s,
+                                GLfloat size, bool sprt)
+// ----------------------------------------------------------------------------
+//   Set the uniforms to draw a cloud, while the program is bound
+// ----------------------------------------------------------------------------
+//   Positions drawn are origin + position * step, transformed by matrix.
+{
+    glUniformMatrix4fv(matrix, 1, GL_FALSE, m);
+    glUniform3f(origin, o.x, o.y, o.z);
+    glUniform3f(step, s.x, s.y, s.z);
+    glUniform1f(pointSize, size);
+    glUniform1i(sprites, sprt);
+}
+
+
+void PointCloudShader::unbind()
+// ----------------------------------------------------------------------------
+//   Restore the program in use before bind()
+// ----------------------------------------------------------------------------
+{
+    glUseProgram(previous);
+}
+
+
+bool PointCloudShader::compile()
+// ----------------------------------------------------------------------------
+//   Compile and link the shaders, and find their uniforms
+// ----------------------------------------------------------------------------
+{
+    GLuint vs = compileShader(GL_VERTEX_SHADER, vertexSource);
+    GLuint fs = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
+    if (!vs || !fs)
+    {
+        glDeleteShader(vs);
+        glDeleteShader(fs);
+        return false;
+    }
+
+    GLuint prg = glCreateProgram();
+    glAttachShader(prg, vs);
+    glAttachShader(prg, fs);
+    glBindAttribLocation(prg, POSITION, "position");
+    glBindAttribLocation(prg, COLOR, "color");
+    glLinkProgram(prg);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+
+    GLint status = 0;
+    glGetProgramiv(prg, GL_LINK_STATUS, &status);
+    if (!status)
+    {
+        GLint length = 0;
+        glGetProgramiv(prg, GL_INFO_LOG_LENGTH, &length);
+        std::vector<char> log(length + 1);
+        glGetProgramInfoLog(prg, length, NULL, &log[0]);
+        IFTRACE(pointcloud)
+            debug() << "Cannot link program: " << &log[0] << "\n";
+        glDeleteProgram(prg);
+        return false;
+    }
+
+    program = prg;
+    matrix = glGetUniformLocation(program, "matrix");
+    origin = glGetUniformLocation(program, "origin");
+    step = glGetUniformLocation(program, "step");
+    pointSize = glGetUniformLocation(program, "pointSize");
+    sprites = glGetUniformLocation(program, "sprites");
+    sprite = glGetUniformLocation(program, "sprite");
+
+    // Sprites use the texture set on the first unit, as without shaders
+    GLint current = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &current);
+    glUseProgram(program);
+    glUniform1i(sprite, 0);
+    glUseProgram(current);
+
+    IFTRACE(pointcloud)
+        debug() << "Built program #" << program << "\n";
+    return true;
+}
+
+
+GLuint PointCloudShader::compileShader(GLenum type, const char *source)
+// ----------------------------------------------------------------------------
+//   Compile a shader, 0 if it fails
+// ----------------------------------------------------------------------------
+{
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, NULL);
+    glCompileShader(shader);
+
+    GLint status = 0;
+    glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (!status)
+    {
+        GLint length = 0;
+        glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &length);
+        std::vector<char> log(length + 1);
+        glGetShaderInfoLog(shader, length, NULL, &log[0]);
+        IFTRACE(pointcloud)
+            debug() << "Cannot compile shader: " << &log[0] << "\n";
+        glDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+
+std::ostream & PointCloudShader::debug()
+// ----------------------------------------------------------------------------
+//   Convenience method to log with a common prefix
+// ----------------------------------------------------------------------------
+{
+    std::cerr << "[PointCloudShader] ";
+    return std::cerr;
+}
@@ -0,0 +1,82 @@
+#ifndef POINT_CLOUD_SHADER_H
+#define POINT_CLOUD_SHADER_H
+// *****************************************************************************
+// point_cloud_shader.h                                            Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Program drawing the VBOs of point clouds with vertex attributes
+//
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+
+#include "point_cloud.h"
+#include <QGLContext>
+
+
+class PointCloudShader
+// ----------------------------------------------------------------------------
+//    Vertex and fragment shaders shared by all clouds drawn with a VAO
+// ----------------------------------------------------------------------------
+//    Quantized positions are decoded, point size and sprites are applied
+//    by the shaders, from uniforms, instead of fixed-function state. The
+//    shaders only use GLSL 1.20, so that they also run on software
+//    renderers such as Mesa llvmpipe.
+{
+public:
+    typedef PointCloud::Point   Point;
+
+    enum { POSITION, COLOR };   // Attribute locations
+
+public:
+    PointCloudShader();
+
+public:
+    bool        ready();
+    void        bind();
+    void        uniforms(const GLfloat matrix[16],
+                         const Point &origin, const Point &step,
+                         GLfloat pointSize, bool sprites);
+    void        unbind();
+
+protected:
+    bool        compile();
+    GLuint      compileShader(GLenum type, const char *source);
+    std::ostream & debug();
+
+protected:
+    const QGLContext *  context;    // Context the program was built for
+    GLuint      program;
+    bool        failed;             // Do not try again in this context
+    GLint       previous;           // Program in use before bind()
+    GLint       matrix, origin, step, pointSize, sprites, sprite;
+};
+
+#endif // POINT_CLOUD_SHADER_H
@@ -0,0 +1,172 @@
+// *****************************************************************************
+// point_cloud_stream.cpp                                          Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Feeding a network reply to a loader thread while it downloads.
+//
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include "point_cloud_stream.h"
+#include "base.h"
+#include <iostream>
+
+
+PointCloudStream::PointCloudStream(QNetworkReply *reply, Runnable *loader)
+// ----------------------------------------------------------------------------
+//   Constructor, receive data from the reply as soon as it arrives
+// ----------------------------------------------------------------------------
+    : QIODevice(), reply(reply), loader(loader),
+      offset(0), buffered(0), total(-1), consumed(0), complete(false)
+{
+    open(QIODevice::ReadOnly);
+    connect(reply, SIGNAL(readyRead()), this, SLOT(received()));
+    connect(reply, SIGNAL(finished()), this, SLOT(finished()));
+}
+
+
+PointCloudStream::~PointCloudStream()
+// ----------------------------------------------------------------------------
+//   Destructor, abort the download if it is still running
+// ----------------------------------------------------------------------------
+//   The loader must no longer be reading, see PointCloud::closeStream()
+{
+    if (reply)
+    {
+        reply->disconnect(this);
+        reply->abort();
+        reply->deleteLater();
+    }
+}
+
+
+qint64 PointCloudStream::bytesAvailable() const
+// ----------------------------------------------------------------------------
+//   Bytes that remain to be read, including those not yet downloaded
+// ----------------------------------------------------------------------------
+{
+    QMutexLocker locker(&mutex);
+    qint64 remaining = buffered;
+    if (total >= 0 && !complete)
+        remaining = qMax(remaining, total - consumed);
+    return remaining + QIODevice::bytesAvailable();
+}
+
+
+QString PointCloudStream::error() const
+// ----------------------------------------------------------------------------
+//   Error reported by the network reply, empty if none so far
+// ----------------------------------------------------------------------------
+{
+    QMutexLocker locker(&mutex);
+    return failure;
+}
+
+
+qint64 PointCloudStream::readData(char *data, qint64 maxSize)
+// ----------------------------------------------------------------------------
+//   Wait for data in the loader thread, -1 at end of stream or on error
+// ----------------------------------------------------------------------------
+{
+    QMutexLocker locker(&mutex);
+    while (!buffered && !complete)
+    {
+        if (loader->interrupted())
+            return -1;
+        ready.wait(&mutex, 50);
+    }
+    if (!buffered || !failure.isEmpty())
+        return -1;
+
+    qint64 n = 0;
+    while (n < maxSize && !blocks.isEmpty())
+    {
+        const QByteArray &block = blocks.first();
+        qint64 copy = qMin(maxSize - n, qint64(block.size() - offset));
+        memcpy(data + n, block.constData() + offset, copy);
+        n += copy;
+        offset += copy;
+        if (offset == block.size())
+        {
+            blocks.removeFirst();
+            offset = 0;
+        }
+    }
+    buffered -= n;
+    consumed += n;
+    return n;
+}
+
+
+void PointCloudStream::received()
+// ----------------------------------------------------------------------------
+//   Data arrived from the network (main thread)
+// ----------------------------------------------------------------------------
+{
+    QByteArray data = reply->readAll();
+    QMutexLocker locker(&mutex);
+    if (total < 0)
+    {
+        QVariant length = reply->header(QNetworkRequest::ContentLengthHeader);
+        if (length.isValid())
+            total = length.toLongLong();
+    }
+    if (data.isEmpty())
+        return;
+    blocks.append(data);
+    buffered += data.size();
+    ready.wakeAll();
+}
+
+
+void PointCloudStream::finished()
+// ----------------------------------------------------------------------------
+//   The reply completed, successfully or not (main thread)
+// ----------------------------------------------------------------------------
+{
+    received();
+
+    QString err;
+    if (reply->error() != QNetworkReply::NoError)
+    {
+        err = reply->errorString();
+        IFTRACE(pointcloud)
+            std::cerr << "[PointCloudStream] " << (void *) this << " "
+                      << err.toUtf8().constData() << "\n";
+    }
+
+    reply->deleteLater();
+    reply = NULL;
+
+    QMutexLocker locker(&mutex);
+    failure = err;
+    complete = true;
+    ready.wakeAll();
+}
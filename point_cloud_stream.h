@@ -0,0 +1,92 @@
+#ifndef POINT_CLOUD_STREAM_H
+#define POINT_CLOUD_STREAM_H
+// *****************************************************************************
+// point_cloud_stream.h                                            Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Feeding a network reply to a loader thread while it downloads.
+//
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include "thread_pool.h"
+#include <QByteArray>
+#include <QIODevice>
+#include <QList>
+#include <QMutex>
+#include <QNetworkReply>
+#include <QWaitCondition>
+
+
+class PointCloudStream : public QIODevice
+// ----------------------------------------------------------------------------
+//    A read-only device receiving the body of a network reply
+// ----------------------------------------------------------------------------
+//    Data is received in the main thread as the reply signals it, and read
+//    by a loader running in a pool thread. Reads block until data arrives,
+//    the reply completes, or the loader is interrupted. bytesAvailable()
+//    includes what is still to be downloaded when the size is known, which
+//    is what the loaders expect from a file. Once the reply fails, reads
+//    return -1 and error() tells why.
+{
+    Q_OBJECT
+
+public:
+    PointCloudStream(QNetworkReply *reply, Runnable *loader);
+    virtual ~PointCloudStream();
+
+public:
+    virtual bool        isSequential() const { return true; }
+    virtual qint64      bytesAvailable() const;
+    QString             error() const;
+
+protected:
+    virtual qint64      readData(char *data, qint64 maxSize);
+    virtual qint64      writeData(const char *, qint64) { return -1; }
+
+protected slots:
+    void                received();
+    void                finished();
+
+protected:
+    QNetworkReply *     reply;
+    Runnable *          loader;
+    mutable QMutex      mutex;
+    QWaitCondition      ready;
+    QList<QByteArray>   blocks;         // Received, not yet read
+    int                 offset;         // Bytes already read in first block
+    qint64              buffered;       // Bytes in blocks, minus offset
+    qint64              total;          // Size of the body, -1 if unknown
+    qint64              consumed;       // Bytes read by the loader
+    bool                complete;       // No more data will be received
+    QString             failure;        // Error of the reply, if any
+};
+
+#endif // POINT_CLOUD_STREAM_H
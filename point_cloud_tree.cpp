@@ -0,0 +1,993 @@
+// *****************************************************************************
+// point_cloud_tree.cpp                                            Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Out-of-core point clouds: a hierarchy of nodes stored in a file,
+//
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include "point_cloud_tree.h"
+#include "point_cloud_factory.h"
+#include "point_cloud_index.h"
+#include "tao/graphic_state.h"
+#include <QElapsedTimer>
+#include <QTemporaryFile>
+#include <algorithm>
+#include <float.h>
+#include <string.h>
+
+const char PointCloudTreeFile::magic[8] = { 'T','A','O','C','T','R','E','E' };
+
+// The on-disk layout must not depend on the compiler
+typedef char tree_header_size_check
+    [sizeof(PointCloudTreeFile::Header) == 128 ? 1 : -1];
+typedef char tree_node_size_check
+    [sizeof(PointCloudTreeFile::Node) == 48 ? 1 : -1];
+
+
+
+// ============================================================================
+//
+//    Tree file
+//
+// ============================================================================
+
+bool PointCloudTreeFile::check(const Header &h, qint64 size, text &error)
+// ----------------------------------------------------------------------------
+//   Check that a tree header is valid and consistent with the file size
+// ----------------------------------------------------------------------------
+{
+    if (size < qint64(sizeof(Header)) ||
+        memcmp(h.magic, magic, sizeof(magic)) != 0)
+    {
+        error = "Invalid point cloud tree header";
+        return false;
+    }
+    if (h.byteOrder != BYTE_ORDER_MARK)
+    {
+        error = "Point cloud tree was written with a different byte order";
+        return false;
+    }
+    if (h.version > VERSION || h.headerSize < sizeof(Header) ||
+        h.nodeSize != sizeof(Node))
+    {
+        error = "Unsupported point cloud tree version";
+        return false;
+    }
+    quint64 fsize = quint64(size);
+    quint64 tableSize = quint64(h.nodeCount) * h.nodeSize;
+    if (h.nodeOffset > fsize || tableSize > fsize - h.nodeOffset)
+    {
+        error = "Point cloud tree is truncated";
+        return false;
+    }
+    return true;
+}
+
+
+
+// ============================================================================
+//
+//    Conversion of a cloud to a tree file
+//
+// ============================================================================
+
+PointCloudTreeBuilder::PointCloudTreeBuilder(text path, Runnable *owner)
+// ----------------------------------------------------------------------------
+//   Prepare to receive points
+// ----------------------------------------------------------------------------
+    : path(path), owner(owner), spill(new QTemporaryFile), out(NULL),
+      count(0), colored(false),
+      lo(FLT_MAX, FLT_MAX, FLT_MAX), hi(-FLT_MAX, -FLT_MAX, -FLT_MAX),
+      random(0x9E3779B97F4A7C15ULL)
+{
+    if (!spill->open())
+        error = "Cannot create a temporary file to convert the cloud";
+}
+
+
+PointCloudTreeBuilder::~PointCloudTreeBuilder()
+// ----------------------------------------------------------------------------
+//   Remove temporary files, and the output unless it was completed
+// ----------------------------------------------------------------------------
+{
+    delete spill;
+    delete out;
+}
+
+
+bool PointCloudTreeBuilder::add(const point_vec &points,
+                                const color_vec &colors)
+// ----------------------------------------------------------------------------
+//   Append points and their colors, if any, to the temporary file
+// ----------------------------------------------------------------------------
+{
+    if (error != "")
+        return false;
+    if (points.empty())
+        return true;
+    if (count == 0)
+        colored = !colors.empty();
+    if (colored && colors.size() != points.size())
+        return failed("Cannot convert a cloud with some points not colored");
+
+    size_t rec = recordSize();
+    std::vector<char> buffer(SLICE * rec);
+    for (size_t done = 0; done < points.size(); done += SLICE)
+    {
+        size_t n = qMin(size_t(SLICE), points.size() - done);
+        char *r = &buffer[0];
+        for (size_t i = done; i < done + n; i++, r += rec)
+        {
+            const Point &p = points[i];
+            lo.x = qMin(lo.x, p.x); hi.x = qMax(hi.x, p.x);
+            lo.y = qMin(lo.y, p.y); hi.y = qMax(hi.y, p.y);
+            lo.z = qMin(lo.z, p.z); hi.z = qMax(hi.z, p.z);
+            memcpy(r, &p, sizeof(Point));
+            if (colored)
+                memcpy(r + sizeof(Point), &colors[i], sizeof(Color));
+        }
+        qint64 size = n * rec;
+        if (spill->write(&buffer[0], size) != size)
+            return failed("Error writing temporary file to convert the cloud");
+    }
+    count += points.size();
+    return true;
+}
+
+
+bool PointCloudTreeBuilder::finish()
+// ----------------------------------------------------------------------------
+//   Write the tree file from the points added
+// ----------------------------------------------------------------------------
+{
+    if (error != "")
+        return false;
+
+    QElapsedTimer timer;
+    timer.start();
+    IFTRACE(pointcloud)
+        debug() << "Converting " << count << " points\n";
+
+    QSaveFile *file = new QSaveFile(+path);
+    out = file;
+    if (!file->open(QIODevice::WriteOnly))
+        return failed("Cannot write point cloud tree file");
+
+    PointCloudTreeFile::Header h;
+    memset(&h, 0, sizeof(h));
+    if (file->write((const char *) &h, sizeof(h)) != sizeof(h))
+        return failed("Error writing point cloud tree file");
+
+    Node root;
+    memset(&root, 0, sizeof(root));
+    memcpy(root.lo, &lo, sizeof(root.lo));
+    memcpy(root.hi, &hi, sizeof(root.hi));
+    nodes.assign(1, root);
+    if (count && !split(*spill, count, lo, hi, 0, 0))
+        return false;
+
+    // Node table at the end, then the header that points to it
+    memcpy(h.magic, PointCloudTreeFile::magic, sizeof(h.magic));
+    h.byteOrder = PointCloudTreeFile::BYTE_ORDER_MARK;
+    h.version = PointCloudTreeFile::VERSION;
+    h.headerSize = sizeof(h);
+    h.count = count;
+    h.nodeCount = nodes.size();
+    h.nodeSize = sizeof(Node);
+    h.nodeOffset = file->pos();
+    h.colored = colored;
+    memcpy(h.min, &lo, sizeof(h.min));
+    memcpy(h.max, &hi, sizeof(h.max));
+    qint64 size = nodes.size() * sizeof(Node);
+    if (file->write((const char *) &nodes[0], size) != size ||
+        !file->seek(0) ||
+        file->write((const char *) &h, sizeof(h)) != sizeof(h) ||
+        !file->commit())
+        return failed("Error writing point cloud tree file");
+
+    IFTRACE(pointcloud)
+        debug() << "Converted " << count << " points to "
+                << nodes.size() << " nodes in " << timer.elapsed() << " ms\n";
+    return true;
+}
+
+
+bool PointCloudTreeBuilder::split(QFile &in, quint64 count, Point lo, Point hi,
+                                  unsigned node, unsigned level)
+// ----------------------------------------------------------------------------
+//   Distribute the points of a node in the files of its octants
+// ----------------------------------------------------------------------------
+//   lo..hi is the box of the node, split at its center. The node itself
+//   gets a random subsample of its points.
+{
+    if (count <= MEMORY_POINTS)
+        return index(in, 0, count, node);
+    if (level >= SPLIT_LEVELS)
+        return chunk(in, count, node);
+
+    Point mid((lo.x + hi.x) / 2, (lo.y + hi.y) / 2, (lo.z + hi.z) / 2);
+    size_t rec = recordSize();
+    QTemporaryFile parts[8];
+    quint64 counts[8] = { 0 };
+    Point plo[8] = { lo, lo, lo, lo, lo, lo, lo, lo };
+    Point phi[8] = { hi, hi, hi, hi, hi, hi, hi, hi };
+    for (int o = 0; o < 8; o++)
+    {
+        if (!parts[o].open())
+            return failed("Cannot create a temporary file to convert the cloud");
+        plo[o] = Point(FLT_MAX, FLT_MAX, FLT_MAX);
+        phi[o] = Point(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    }
+
+    std::vector<char> buffer(SLICE * rec), octants[8];
+    std::vector<char> sample(SAMPLE_POINTS * rec);
+    if (!in.seek(0))
+        return failed("Error reading temporary file to convert the cloud");
+    for (quint64 done = 0; done < count; done += SLICE)
+    {
+        if (owner->interrupted())
+            return failed("Conversion interrupted");
+        size_t n = qMin(quint64(SLICE), count - done);
+        qint64 size = n * rec;
+        if (in.read(&buffer[0], size) != size)
+            return failed("Error reading temporary file to convert the cloud");
+
+        for (size_t i = 0; i < n; i++)
+        {
+            const char *r = &buffer[i * rec];
+            Point p(0, 0, 0);
+            memcpy(&p, r, sizeof(p));
+            int o = (p.x >= mid.x) << 2 | (p.y >= mid.y) << 1 | (p.z >= mid.z);
+            octants[o].insert(octants[o].end(), r, r + rec);
+            counts[o]++;
+            Point &l = plo[o], &h = phi[o];
+            l.x = qMin(l.x, p.x); h.x = qMax(h.x, p.x);
+            l.y = qMin(l.y, p.y); h.y = qMax(h.y, p.y);
+            l.z = qMin(l.z, p.z); h.z = qMax(h.z, p.z);
+
+            // Reservoir sampling, each point has the same chance to be kept
+            quint64 seen = done + i;
+            if (seen < SAMPLE_POINTS)
+            {
+                memcpy(&sample[seen * rec], r, rec);
+                continue;
+            }
+            random ^= random << 13;
+            random ^= random >> 7;
+            random ^= random << 17;
+            quint64 kept = random % (seen + 1);
+            if (kept < SAMPLE_POINTS)
+                memcpy(&sample[kept * rec], r, rec);
+        }
+        for (int o = 0; o < 8; o++)
+        {
+            qint64 size = octants[o].size();
+            if (size && parts[o].write(&octants[o][0], size) != size)
+                return failed("Error writing temporary file to convert the cloud");
+            octants[o].clear();
+        }
+    }
+
+    // The subsample of the node
+    size_t n = qMin(quint64(SAMPLE_POINTS), count);
+    std::vector<Point> points;
+    std::vector<Color> colors;
+    for (size_t i = 0; i < n; i++)
+    {
+        const char *r = &sample[i * rec];
+        Point p(0, 0, 0);
+        memcpy(&p, r, sizeof(p));
+        points.push_back(p);
+        if (colored)
+        {
+            Color c;
+            memcpy(&c, r + sizeof(Point), sizeof(c));
+            colors.push_back(c);
+        }
+    }
+    if (!writeNode(node, points, colors))
+        return false;
+
+    // Children are consecutive, then each of them is split in turn
+    unsigned childAt[8], children = 0, firstChild = nodes.size();
+    for (int o = 0; o < 8; o++)
+    {
+        if (!counts[o])
+            continue;
+        Node child;
+        memset(&child, 0, sizeof(child));
+        memcpy(child.lo, &plo[o], sizeof(child.lo));
+        memcpy(child.hi, &phi[o], sizeof(child.hi));
+        childAt[o] = nodes.size();
+        nodes.push_back(child);
+        children++;
+    }
+    nodes[node].firstChild = firstChild;
+    nodes[node].children = children;
+
+    for (int o = 0; o < 8; o++)
+    {
+        if (!counts[o])
+            continue;
+        Point clo((o & 4) ? mid.x : lo.x, (o & 2) ? mid.y : lo.y,
+                  (o & 1) ? mid.z : lo.z);
+        Point chi((o & 4) ? hi.x : mid.x, (o & 2) ? hi.y : mid.y,
+                  (o & 1) ? hi.z : mid.z);
+        if (!split(parts[o], counts[o], clo, chi, childAt[o], level + 1))
+            return false;
+        parts[o].resize(0);
+    }
+    return true;
+}
+
+
+bool PointCloudTreeBuilder::chunk(QFile &in, quint64 count, unsigned node)
+// ----------------------------------------------------------------------------
+//   Cut the points of a node that cannot be split further into children
+// ----------------------------------------------------------------------------
+//   Each child indexes a run of at most MEMORY_POINTS consecutive points,
+//   so that memory use stays bounded however dense the points are. The
+//   node gets a subsample taken at regular intervals in the file.
+{
+    size_t rec = recordSize();
+    size_t n = SAMPLE_POINTS;
+    std::vector<Point> points;
+    std::vector<Color> colors;
+    std::vector<char> record(rec);
+    for (size_t i = 0; i < n; i++)
+    {
+        if (!in.seek(i * count / n * rec) ||
+            in.read(&record[0], rec) != qint64(rec))
+            return failed("Error reading temporary file to convert the cloud");
+        Point p(0, 0, 0);
+        memcpy(&p, &record[0], sizeof(p));
+        points.push_back(p);
+        if (colored)
+        {
+            Color c;
+            memcpy(&c, &record[sizeof(Point)], sizeof(c));
+            colors.push_back(c);
+        }
+    }
+    if (!writeNode(node, points, colors))
+        return false;
+
+    // Children are consecutive, their bounds are set when indexed
+    unsigned children = (count + MEMORY_POINTS - 1) / MEMORY_POINTS;
+    unsigned firstChild = nodes.size();
+    Node child;
+    memset(&child, 0, sizeof(child));
+    nodes.resize(firstChild + children, child);
+    nodes[node].firstChild = firstChild;
+    nodes[node].children = children;
+
+    IFTRACE(pointcloud)
+        debug() << "Cutting " << count << " points of node " << node
+                << " in " << children << " parts\n";
+
+    for (unsigned c = 0; c < children; c++)
+    {
+        if (owner->interrupted())
+            return failed("Conversion interrupted");
+        quint64 first = quint64(c) * MEMORY_POINTS;
+        quint64 part = qMin(quint64(MEMORY_POINTS), count - first);
+        if (!index(in, first, part, firstChild + c))
+            return false;
+    }
+    return true;
+}
+
+
+bool PointCloudTreeBuilder::index(QFile &in, quint64 first, quint64 count,
+                                  unsigned node)
+// ----------------------------------------------------------------------------
+//   Load points of a node in memory, and write the subtree indexing them
+// ----------------------------------------------------------------------------
+//   The count points are read from record first on, count is at most
+//   MEMORY_POINTS.
+{
+    XL_ASSERT(count <= MEMORY_POINTS);
+    size_t rec = recordSize();
+    point_vec points;
+    color_vec colors;
+    points.reserve(count);
+    if (colored)
+        colors.reserve(count);
+    std::vector<char> buffer(SLICE * rec);
+    if (!in.seek(first * rec))
+        return failed("Error reading temporary file to convert the cloud");
+    for (quint64 done = 0; done < count; done += SLICE)
+    {
+        size_t n = qMin(quint64(SLICE), count - done);
+        qint64 size = n * rec;
+        if (in.read(&buffer[0], size) != size)
+            return failed("Error reading temporary file to convert the cloud");
+        for (size_t i = 0; i < n; i++)
+        {
+            const char *r = &buffer[i * rec];
+            Point p(0, 0, 0);
+            memcpy(&p, r, sizeof(p));
+            points.push_back(p);
+            if (colored)
+            {
+                Color c;
+                memcpy(&c, r + sizeof(Point), sizeof(c));
+                colors.push_back(c);
+            }
+        }
+    }
+
+    PointCloudIndex indexer;
+    PointCloudOctree *octree = indexer.buildNow(points);
+    if (!octree)
+        return failed("Conversion interrupted");
+
+    // The root of the octree is the node, other nodes are appended
+    unsigned base = nodes.size() - 1;
+    if (octree->nodes.size() > 1)
+        nodes.resize(base + octree->nodes.size());
+    std::vector<Point> pts;
+    std::vector<Color> cols;
+    bool ok = true;
+    for (size_t i = 0; ok && i < octree->nodes.size(); i++)
+    {
+        const PointCloudOctree::Node &src = octree->nodes[i];
+        unsigned slot = i ? base + i : node;
+        Node &dst = nodes[slot];
+        memcpy(dst.lo, &src.lo, sizeof(dst.lo));
+        memcpy(dst.hi, &src.hi, sizeof(dst.hi));
+        dst.firstChild = src.children ? base + src.firstChild : 0;
+        dst.children = src.children;
+
+        // Leaves keep their points, inner nodes their subsample
+        const unsigned *entries = src.children
+            ? &octree->samples[src.sample] : &octree->order[src.first];
+        unsigned n = src.children ? src.samples : src.count;
+        pts.clear();
+        cols.clear();
+        for (unsigned e = 0; e < n; e++)
+        {
+            pts.push_back(points[entries[e]]);
+            if (colored)
+                cols.push_back(colors[entries[e]]);
+        }
+        ok = writeNode(slot, pts, cols);
+    }
+    delete octree;
+    return ok;
+}
+
+
+bool PointCloudTreeBuilder::writeNode(unsigned node,
+                                      const std::vector<Point> &points,
+                                      const std::vector<Color> &colors)
+// ----------------------------------------------------------------------------
+//   Write the points of a node, then their colors
+// ----------------------------------------------------------------------------
+{
+    nodes[node].offset = out->pos();
+    nodes[node].count = points.size();
+    if (points.empty())
+        return true;
+    qint64 size = points.size() * sizeof(Point);
+    if (out->write((const char *) &points[0], size) != size)
+        return failed("Error writing point cloud tree file");
+    size = colors.size() * sizeof(Color);
+    if (size && out->write((const char *) &colors[0], size) != size)
+        return failed("Error writing point cloud tree file");
+    return true;
+}
+
+
+bool PointCloudTreeBuilder::failed(text message)
+// ----------------------------------------------------------------------------
+//   Record the first error of the conversion
+// ----------------------------------------------------------------------------
+{
+    if (error == "")
+        error = message;
+    IFTRACE(pointcloud)
+        debug() << message << "\n";
+    return false;
+}
+
+
+std::ostream & PointCloudTreeBuilder::debug()
+// ----------------------------------------------------------------------------
+//   Convenience method to log with a common prefix
+// ----------------------------------------------------------------------------
+{
+    std::cerr << "[PointCloudTreeBuilder] \"" << path << "\" ";
+    return std::cerr;
+}
+
+
+
+// ============================================================================
+//
+//    Drawing a tree file
+//
+// ============================================================================
+
+PointCloudTree::Node::Node(const PointCloudTreeFile::Node &n)
+// ----------------------------------------------------------------------------
+//   A node not in memory yet
+// ----------------------------------------------------------------------------
+    : lo(n.lo[0], n.lo[1], n.lo[2]), hi(n.hi[0], n.hi[1], n.hi[2]),
+      offset(n.offset), count(n.count),
+      firstChild(n.firstChild), children(n.children),
+      used(0), fetch(NULL), points(NULL), colors(NULL), vbo(0)
+{
+    for (int c = 0; c < CACHES; c++)
+        prev[c] = next[c] = NONE;
+}
+
+
+PointCloudTree::PointCloudTree(text path)
+// ----------------------------------------------------------------------------
+//   Create a tree for a file, open() reads the node table
+// ----------------------------------------------------------------------------
+    : path(path), frame(0), context(QGLContext::currentContext()),
+      missing(0), done(NULL)
+{
+    memset(&header, 0, sizeof(header));
+    budget[CPU] = size_t(1024) << 20;
+    budget[GPU] = size_t(512) << 20;
+}
+
+
+PointCloudTree::~PointCloudTree()
+// ----------------------------------------------------------------------------
+//   Stop fetches and release the memory of all nodes
+// ----------------------------------------------------------------------------
+{
+    // Unqueue fetches that did not start, wait for those running
+    for (int f = 0; f < fetching.size(); f++)
+        fetching[f]->interrupt();
+    qDeleteAll(fetching);
+    fetching.clear();
+    done.storeRelease(NULL);
+
+    // Buffers of another context are gone with it
+    bool current = QGLContext::currentContext() == context;
+    for (size_t n = 0; n < nodes.size(); n++)
+    {
+        delete nodes[n].points;
+        delete nodes[n].colors;
+        if (nodes[n].vbo && current)
+            GL.DeleteBuffers(1, &nodes[n].vbo);
+    }
+}
+
+
+bool PointCloudTree::open(text &error)
+// ----------------------------------------------------------------------------
+//   Read the header and the node table
+// ----------------------------------------------------------------------------
+{
+    QFile f(+path);
+    if (!f.open(QIODevice::ReadOnly))
+    {
+        error = "Cannot open point cloud tree file";
+        return false;
+    }
+    if (f.read((char *) &header, sizeof(header)) != sizeof(header))
+        memset(&header, 0, sizeof(header));
+    if (!PointCloudTreeFile::check(header, f.size(), error))
+        return false;
+
+    std::vector<PointCloudTreeFile::Node> table(header.nodeCount);
+    qint64 size = table.size() * sizeof(PointCloudTreeFile::Node);
+    if (!f.seek(header.nodeOffset) ||
+        f.read((char *) &table[0], size) != size)
+    {
+        error = "Error reading point cloud tree file";
+        return false;
+    }
+
+    quint64 fsize = f.size();
+    size_t stride = sizeof(Point) + (header.colored ? sizeof(Color) : 0);
+    nodes.reserve(table.size());
+    for (size_t n = 0; n < table.size(); n++)
+    {
+        const PointCloudTreeFile::Node &t = table[n];
+        if (t.offset > fsize || quint64(t.count) * stride > fsize - t.offset ||
+            (t.children && (t.firstChild <= n ||
+                            t.firstChild >= table.size() ||
+                            t.children > table.size() - t.firstChild)))
+        {
+            error = "Point cloud tree file is corrupted";
+            nodes.clear();
+            return false;
+        }
+        nodes.push_back(Node(t));
+    }
+
+    IFTRACE(pointcloud)
+        debug() << "Opened tree of " << header.count << " points in "
+                << nodes.size() << " nodes\n";
+    return true;
+}
+
+
+void PointCloudTree::draw(PointCloudView &view, unsigned limit, bool useVbo)
+// ----------------------------------------------------------------------------
+//   Draw the nodes in view, at most limit points if not 0
+// ----------------------------------------------------------------------------
+//   Nodes are refined by decreasing screen-space error, as long as their
+//   visible children are in memory and fit in the point budget. Missing
+//   children are fetched, most wanted first, and drawn in later frames.
+{
+    if (QGLContext::currentContext() != context)
+    {
+        // Buffers of the previous context are gone with it
+        for (size_t n = 0; n < nodes.size(); n++)
+            nodes[n].vbo = 0;
+        caches[GPU] = Cache();
+        context = QGLContext::currentContext();
+    }
+
+    collect();
+    frame++;
+    drawn.clear();
+    queue.clear();
+    wanted.clear();
+    missing = 0;
+
+    unsigned mask = PointCloudView::ALL_PLANES;
+    if (!nodes.empty() && view.clip(mask, nodes[0].lo, nodes[0].hi))
+    {
+        if (!ready(nodes[0], useVbo))
+            wanted.push_back(Refinement(FLT_MAX, 0, mask));
+        else
+            queue.push_back(Refinement(FLT_MAX, 0, mask));
+    }
+
+    quint64 used = nodes.empty() ? 0 : nodes[0].count;
+    quint64 budget = limit ? limit : ~quint64(0);
+    while (!queue.empty())
+    {
+        std::pop_heap(queue.begin(), queue.end());
+        Refinement top = queue.back();
+        queue.pop_back();
+        Node &node = nodes[top.node];
+        node.used = frame;
+
+        // Visible children replace the node if all of them are available
+        unsigned masks[8], cost = 0, absent = 0;
+        bool refine = node.children && top.error >= view.spacing;
+        for (unsigned c = 0; refine && c < node.children; c++)
+        {
+            unsigned id = node.firstChild + c;
+            Node &child = nodes[id];
+            masks[c] = top.mask;
+            if (!view.clip(masks[c], child.lo, child.hi))
+            {
+                masks[c] = NONE;
+                continue;
+            }
+            cost += child.count;
+            if (!ready(child, useVbo))
+            {
+                wanted.push_back(Refinement(top.error, id, masks[c]));
+                absent++;
+            }
+        }
+        if (!refine || absent || used - node.count + cost > budget)
+        {
+            drawn.push_back(top.node);
+            missing += absent;
+            continue;
+        }
+
+        used = used - node.count + cost;
+        for (unsigned c = 0; c < node.children; c++)
+        {
+            if (masks[c] == NONE)
+                continue;
+            unsigned id = node.firstChild + c;
+            const Node &child = nodes[id];
+            GLfloat error = view.error(child.lo, child.hi, child.count);
+            queue.push_back(Refinement(error, id, masks[c]));
+            std::push_heap(queue.begin(), queue.end());
+        }
+    }
+
+    // Vertex and color arrays are enabled by the cloud, see beginStyle()
+    for (size_t d = 0; d < drawn.size(); d++)
+        drawNode(drawn[d], useVbo);
+    if (useVbo && !drawn.empty())
+        GL.BindBuffer(GL_ARRAY_BUFFER, 0);
+
+    evict(CPU);
+    evict(GPU);
+    startFetches();
+}
+
+
+float PointCloudTree::progress()
+// ----------------------------------------------------------------------------
+//   Part of the nodes wanted in the last frame that were in memory
+// ----------------------------------------------------------------------------
+{
+    if (wanted.empty())
+        return 1.0;
+    float ratio = float(drawn.size()) / (drawn.size() + wanted.size());
+    return qMin(ratio, 0.99f);
+}
+
+
+void PointCloudTree::fetched(PointCloudTreeFetch *fetch)
+// ----------------------------------------------------------------------------
+//   Hand over a fetch to the main thread (worker threads)
+// ----------------------------------------------------------------------------
+{
+    PointCloudTreeFetch *head;
+    do
+    {
+        head = done.loadAcquire();
+        fetch->next = head;
+    } while (!done.testAndSetRelease(head, fetch));
+}
+
+
+void PointCloudTree::collect()
+// ----------------------------------------------------------------------------
+//   Put the nodes fetched since the last frame in the CPU cache
+// ----------------------------------------------------------------------------
+{
+    PointCloudTreeFetch *list = done.fetchAndStoreAcquire(NULL);
+    while (PointCloudTreeFetch *fetch = list)
+    {
+        list = fetch->next;
+        fetch->interrupt();         // Wait until run() has returned
+        fetching.removeOne(fetch);
+
+        Node &node = nodes[fetch->node];
+        node.fetch = NULL;
+        if (fetch->ok)
+        {
+            node.points = new std::vector<Point>;
+            node.points->swap(fetch->points);
+            if (colored())
+            {
+                node.colors = new std::vector<Color>;
+                node.colors->swap(fetch->colors);
+            }
+            caches[CPU].bytes += nodeBytes(node);
+            use(fetch->node, CPU);
+        }
+        else
+        {
+            // Do not try again, draw the parent instead
+            IFTRACE(pointcloud)
+                debug() << "Error reading node " << fetch->node << "\n";
+            node.count = 0;
+            node.children = 0;
+        }
+        delete fetch;
+    }
+}
+
+
+bool PointCloudTree::ready(Node &node, bool useVbo)
+// ----------------------------------------------------------------------------
+//   Check if a node can be drawn now
+// ----------------------------------------------------------------------------
+{
+    return node.points || (useVbo && node.vbo) || !node.count;
+}
+
+
+void PointCloudTree::use(unsigned id, unsigned cache)
+// ----------------------------------------------------------------------------
+//   Make a node the most recently used in a cache
+// ----------------------------------------------------------------------------
+{
+    Cache &c = caches[cache];
+    if (c.first == id)
+        return;
+    unlink(id, cache);
+    Node &node = nodes[id];
+    node.next[cache] = c.first;
+    node.prev[cache] = NONE;
+    if (c.first != NONE)
+        nodes[c.first].prev[cache] = id;
+    c.first = id;
+    if (c.last == NONE)
+        c.last = id;
+}
+
+
+void PointCloudTree::unlink(unsigned id, unsigned cache)
+// ----------------------------------------------------------------------------
+//   Remove a node from the list of a cache, if it is in it
+// ----------------------------------------------------------------------------
+{
+    Cache &c = caches[cache];
+    Node &node = nodes[id];
+    unsigned prev = node.prev[cache], next = node.next[cache];
+    if (prev == NONE && c.first != id)
+        return;
+    if (prev != NONE)
+        nodes[prev].next[cache] = next;
+    else
+        c.first = next;
+    if (next != NONE)
+        nodes[next].prev[cache] = prev;
+    else
+        c.last = prev;
+    node.prev[cache] = node.next[cache] = NONE;
+}
+
+
+void PointCloudTree::evict(unsigned cache)
+// ----------------------------------------------------------------------------
+//   Release least recently used nodes until the cache fits its budget
+// ----------------------------------------------------------------------------
+//   Nodes drawn in this frame are kept even if the budget is exceeded.
+{
+    Cache &c = caches[cache];
+    while (c.bytes > budget[cache] && c.last != NONE &&
+           nodes[c.last].used != frame)
+    {
+        unsigned id = c.last;
+        Node &node = nodes[id];
+        unlink(id, cache);
+        c.bytes -= nodeBytes(node);
+        if (cache == CPU)
+        {
+            delete node.points;
+            delete node.colors;
+            node.points = NULL;
+            node.colors = NULL;
+        }
+        else
+        {
+            GL.DeleteBuffers(1, &node.vbo);
+            node.vbo = 0;
+        }
+    }
+}
+
+
+void PointCloudTree::drawNode(unsigned id, bool useVbo)
+// ----------------------------------------------------------------------------
+//   Draw the points of a node, uploading them first if needed
+// ----------------------------------------------------------------------------
+{
+    Node &node = nodes[id];
+    if (!node.count)
+        return;
+    bool hasColors = colored();
+    size_t psize = node.count * sizeof(Point);
+    if (node.points)
+        use(id, CPU);
+    if (useVbo)
+    {
+        if (!node.vbo)
+        {
+            GL.GenBuffers(1, &node.vbo);
+            GL.BindBuffer(GL_ARRAY_BUFFER, node.vbo);
+            GL.BufferData(GL_ARRAY_BUFFER, nodeBytes(node), NULL,
+                          GL_STATIC_DRAW);
+            GL.BufferSubData(GL_ARRAY_BUFFER, 0, psize, &(*node.points)[0]);
+            if (hasColors)
+                GL.BufferSubData(GL_ARRAY_BUFFER, psize,
+                                 node.count * sizeof(Color),
+                                 &(*node.colors)[0]);
+            caches[GPU].bytes += nodeBytes(node);
+        }
+        use(id, GPU);
+        GL.BindBuffer(GL_ARRAY_BUFFER, node.vbo);
+        GL.VertexPointer(3, GL_FLOAT, 0, 0);
+        if (hasColors)
+            GL.ColorPointer(4, GL_FLOAT, 0, (const void *) psize);
+    }
+    else
+    {
+        GL.VertexPointer(3, GL_FLOAT, 0, &(*node.points)[0]);
+        if (hasColors)
+            GL.ColorPointer(4, GL_FLOAT, 0, &(*node.colors)[0]);
+    }
+    GL.DrawArrays(GL_POINTS, 0, node.count);
+}
+
+
+void PointCloudTree::startFetches()
+// ----------------------------------------------------------------------------
+//   Fetch the nodes with the largest error first, while memory allows it
+// ----------------------------------------------------------------------------
+{
+    if (wanted.empty() || caches[CPU].bytes > budget[CPU])
+        return;
+
+    PointCloudFactory *fact = PointCloudFactory::instance();
+    int limit = FETCHES * qMax(fact->workers.maxThreadCount(), 1);
+    std::sort(wanted.begin(), wanted.end());
+    for (size_t w = wanted.size(); w-- > 0 && fetching.size() < limit; )
+    {
+        Node &node = nodes[wanted[w].node];
+        if (node.fetch)
+            continue;
+        node.fetch = new PointCloudTreeFetch(this, path, wanted[w].node,
+                                             node.offset, node.count,
+                                             colored());
+        fetching.append(node.fetch);
+        fact->workers.start(node.fetch);
+    }
+}
+
+
+size_t PointCloudTree::nodeBytes(const Node &node)
+// ----------------------------------------------------------------------------
+//   Memory used by the points and colors of a node
+// ----------------------------------------------------------------------------
+{
+    return node.count * (sizeof(Point) + (colored() ? sizeof(Color) : 0));
+}
+
+
+std::ostream & PointCloudTree::debug()
+// ----------------------------------------------------------------------------
+//   Convenience method to log with a common prefix
+// ----------------------------------------------------------------------------
+{
+    std::cerr << "[PointCloudTree] \"" << path << "\" ";
+    return std::cerr;
+}
+
+
+
+// ============================================================================
+//
+//    Reading nodes
+//
+// ============================================================================
+
+void PointCloudTreeFetch::run()
+// ----------------------------------------------------------------------------
+//   Read the points and colors of the node
+// ----------------------------------------------------------------------------
+{
+    QFile f(+path);
+    if (f.open(QIODevice::ReadOnly) && f.seek(offset))
+    {
+        qint64 psize = count * sizeof(Point);
+        qint64 csize = colored ? count * sizeof(Color) : 0;
+        points.resize(count, Point(0, 0, 0));
+        colors.resize(colored ? count : 0);
+        ok = (f.read((char *) &points[0], psize) == psize &&
+              (!csize || f.read((char *) &colors[0], csize) == csize));
+    }
+    tree->fetched(this);
+}
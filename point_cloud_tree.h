@@ -0,0 +1,275 @@
+#ifndef POINT_CLOUD_TREE_H
+#define POINT_CLOUD_TREE_H
+// *****************************************************************************
+// point_cloud_tree.h                                              Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Out-of-core point clouds: a hierarchy of nodes stored in a file,
+//
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include "point_cloud.h"
+#include "point_cloud_view.h"
+#include "thread_pool.h"
+#include <QAtomicPointer>
+#include <QFile>
+#include <QGLContext>
+#include <QList>
+#include <QSaveFile>
+#include <vector>
+
+struct PointCloudTreeFetch;
+class QTemporaryFile;
+
+
+struct PointCloudTreeFile
+// ----------------------------------------------------------------------------
+//    Layout of the file of an out-of-core cloud
+// ----------------------------------------------------------------------------
+//    A tree file is a Header, the points of all nodes, then the table of
+//    nodes. The children of a node are consecutive in the table, after
+//    their parent. Leaves hold all their points, and inner nodes a
+//    subsample of the points below them, so that any node can be drawn
+//    in place of its children at a lower level of detail. The points of
+//    a node are followed by their colors when the cloud is colored.
+{
+    enum { VERSION = 1, BYTE_ORDER_MARK = 0x01020304 };
+
+    struct Header
+    {
+        char     magic[8];      // "TAOCTREE"
+        quint32  byteOrder;     // BYTE_ORDER_MARK in the writer's order
+        quint32  version;       // VERSION
+        quint32  headerSize;    // sizeof(Header)
+        quint32  flags;         // Reserved, 0
+        quint64  count;         // Number of points in the source cloud
+        quint32  nodeCount;     // Number of entries in the node table
+        quint32  nodeSize;      // sizeof(Node)
+        quint64  nodeOffset;    // Offset of the node table
+        quint32  colored;       // Nodes have one Color per point
+        float    min[3];        // Bounding box
+        float    max[3];
+        quint32  reserved[13];
+    };
+
+    struct Node
+    {
+        float    lo[3], hi[3];  // Bounds of the points below the node
+        quint64  offset;        // Offset of the points of the node
+        quint32  count;         // Number of points stored for the node
+        quint32  firstChild;    // Index of the first child in the table
+        quint32  children;      // Number of children, 0 for a leaf
+        quint32  reserved;
+    };
+
+    static const char magic[8];
+    static bool check(const Header &header, qint64 size, text &error);
+};
+
+
+class PointCloudTreeBuilder
+// ----------------------------------------------------------------------------
+//    Convert points that may not fit in memory into a tree file
+// ----------------------------------------------------------------------------
+//    Points given to add() are spilled to a temporary file. finish() then
+//    splits them in octants, on disk, until each part fits in memory, and
+//    indexes each part with PointCloudIndex to write its subtree. Parts
+//    still too large at SPLIT_LEVELS, such as very dense clusters, are cut
+//    in file order into children of at most MEMORY_POINTS each.
+{
+public:
+    typedef PointCloud::Point       Point;
+    typedef PointCloud::Color       Color;
+    typedef PointCloud::point_vec   point_vec;
+    typedef PointCloud::color_vec   color_vec;
+    typedef PointCloudTreeFile::Node Node;
+
+    enum
+    {
+        MEMORY_POINTS   = 1 << 22,  // Parts indexed in memory
+        SPLIT_LEVELS    = 8,        // Deepest split on disk
+        SAMPLE_POINTS   = 1024,     // Subsample of nodes split on disk
+        SLICE           = 1 << 16   // Points read at once
+    };
+
+public:
+    PointCloudTreeBuilder(text path, Runnable *owner);
+    ~PointCloudTreeBuilder();
+
+public:
+    bool        add(const point_vec &points, const color_vec &colors);
+    bool        finish();
+
+public:
+    text        error;
+
+protected:
+    size_t      recordSize()
+    {
+        return sizeof(Point) + (colored ? sizeof(Color) : 0);
+    }
+    bool        split(QFile &in, quint64 count, Point lo, Point hi,
+                      unsigned node, unsigned level);
+    bool        chunk(QFile &in, quint64 count, unsigned node);
+    bool        index(QFile &in, quint64 first, quint64 count, unsigned node);
+    bool        writeNode(unsigned node, const std::vector<Point> &points,
+                          const std::vector<Color> &colors);
+    bool        failed(text message);
+    std::ostream & debug();
+
+protected:
+    text                path;
+    Runnable *          owner;      // Load to check for interruptions
+    QTemporaryFile *    spill;      // Points and colors given to add()
+    QSaveFile *         out;
+    quint64             count;
+    bool                colored;
+    Point               lo, hi;
+    quint64             random;     // State of the subsample generator
+    std::vector<Node>   nodes;
+};
+
+
+class PointCloudTree
+// ----------------------------------------------------------------------------
+//    Draw a tree file, keeping only the nodes in view in memory
+// ----------------------------------------------------------------------------
+//    Nodes are read by the worker threads, most wanted first, into a
+//    cache of CPU buffers, then uploaded to VBOs when drawn. Both are
+//    least-recently-used lists, trimmed to their memory budget after each
+//    frame. Until the children of a node are loaded, the node is drawn.
+{
+public:
+    typedef PointCloud::Point       Point;
+    typedef PointCloud::Color       Color;
+    typedef PointCloudView::Refinement Refinement;
+
+    enum { CPU, GPU, CACHES };      // LRU lists of nodes in memory
+    enum { NONE = ~0U };            // No node
+    enum { FETCHES = 2 };           // Fetches in progress per worker thread
+
+public:
+    PointCloudTree(text path);
+    ~PointCloudTree();
+
+public:
+    bool        open(text &error);
+    void        draw(PointCloudView &view, unsigned budget, bool useVbo);
+    bool        colored() { return header.colored; }
+    quint64     size() { return header.count; }
+    float       progress();
+    void        fetched(PointCloudTreeFetch *fetch);
+
+public:
+    size_t      budget[CACHES];     // Bytes of CPU and GPU memory to use
+
+protected:
+    struct Node
+    {
+        Node(const PointCloudTreeFile::Node &n);
+        Point       lo, hi;
+        quint64     offset;
+        unsigned    count, firstChild, children;
+        unsigned    used;           // Last frame the node was in view
+        PointCloudTreeFetch *fetch; // Fetch in progress
+        std::vector<Point> *points; // Points in memory, or NULL
+        std::vector<Color> *colors;
+        GLuint      vbo;            // Points and colors in video memory
+        unsigned    prev[CACHES], next[CACHES];
+    };
+
+    struct Cache
+    {
+        Cache() : first(NONE), last(NONE), bytes(0) {}
+        unsigned    first, last;    // Most and least recently used
+        size_t      bytes;
+    };
+
+protected:
+    void        collect();
+    bool        ready(Node &node, bool useVbo);
+    void        use(unsigned node, unsigned cache);
+    void        unlink(unsigned node, unsigned cache);
+    void        evict(unsigned cache);
+    void        drawNode(unsigned node, bool useVbo);
+    void        startFetches();
+    size_t      nodeBytes(const Node &node);
+    std::ostream & debug();
+
+protected:
+    text                        path;
+    PointCloudTreeFile::Header  header;
+    std::vector<Node>           nodes;
+    Cache                       caches[CACHES];
+    unsigned                    frame;
+    const QGLContext *          context;
+
+    // Nodes to draw and to fetch in the current frame
+    std::vector<unsigned>       drawn;
+    std::vector<Refinement>     queue;
+    std::vector<Refinement>     wanted;
+    unsigned                    missing;
+
+    // Fetches in progress, and fetches done but not collected yet
+    QList<PointCloudTreeFetch *>        fetching;
+    QAtomicPointer<PointCloudTreeFetch> done;
+};
+
+
+struct PointCloudTreeFetch : Runnable
+// ----------------------------------------------------------------------------
+//    Read the points of a node in a worker thread
+// ----------------------------------------------------------------------------
+{
+    typedef PointCloud::Point       Point;
+    typedef PointCloud::Color       Color;
+
+public:
+    PointCloudTreeFetch(PointCloudTree *tree, text path, unsigned node,
+                        quint64 offset, unsigned count, bool colored)
+        : tree(tree), path(path), node(node), offset(offset), count(count),
+          colored(colored), ok(false), next(NULL) {}
+    virtual void run();  // From Runnable
+
+public:
+    PointCloudTree *    tree;
+    text                path;
+    unsigned            node;
+    quint64             offset;
+    unsigned            count;
+    bool                colored;
+    bool                ok;
+    std::vector<Point>  points;
+    std::vector<Color>  colors;
+    PointCloudTreeFetch *next;  // In the list of fetches done
+};
+
+#endif // POINT_CLOUD_TREE_H
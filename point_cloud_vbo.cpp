@@ -39,19 +39,23 @@
 
 #include "point_cloud_vbo.h"
 #include "point_cloud_factory.h"
+#include "point_cloud_shader.h"
 #include "tao/graphic_state.h"
 #include <QCoreApplication>
 #include <QThread>
+#include <algorithm>
 
 PointCloudVBO::PointCloudVBO(text name)
 // ----------------------------------------------------------------------------
 //   Initialize object
 // ----------------------------------------------------------------------------
-    : PointCloud(name), vbo(0), colorVbo(0),
-      dirty(false), optimized(false), noOptimize(false),
-      nbPoints(0), context(QGLContext::currentContext())
+    : PointCloud(name), dirty(false), optimized(false), noOptimize(false),
+      reoptimize(false),
+      nbPoints(0), context(QGLContext::currentContext()),
+      ibo(0), iboCount(0), tailVisible(true), culled(false),
+      vao(0), vaoVbo(0), vaoColorVbo(0), vaoLayout(-1)
 {
-    genPointBuffer();
+    genPointBuffer(front);
 }
 
 
@@ -87,8 +91,25 @@ bool PointCloudVBO::addPoint(const Point &p, Color c)
         return false;
     }
 
+    // Uploaded after the points already in the VBOs, like a load
     PointCloud::addPoint(p, c);
-    dirty = true;
+    noOptimize = true;
+    return true;
+}
+
+
+bool PointCloudVBO::addPoints(point_vec &p, color_vec &c)
+// ----------------------------------------------------------------------------
+//   Add many points to the cloud, they are uploaded after the others
+// ----------------------------------------------------------------------------
+{
+    if (optimized)
+    {
+        error = "Cannot add points to optimized cloud";
+        return false;
+    }
+
+    PointCloud::addPoints(p, c);
     noOptimize = true;
     return true;
 }
@@ -101,78 +122,108 @@ void PointCloudVBO::removePoints(unsigned n)
 {
     XL_ASSERT(!optimized);
 
+    // Points left in the VBOs are not drawn, and are overwritten if needed
     PointCloud::removePoints(n);
-    if (useVbo())
-        updateVbo();
+    if (front.uploaded > points.size())
+        front.uploaded = points.size();
+    front.prepared.clear();
     noOptimize = true;
 }
 
 
-void PointCloudVBO::draw()
+bool PointCloudVBO::prepareDraw()
 // ----------------------------------------------------------------------------
-//   Draw cloud
+//   Bring VBOs up to date and find visible nodes before drawing
 // ----------------------------------------------------------------------------
 {
-    if (!useVbo())
-        return PointCloud::draw();
-
-    PointCloudFactory * fact = PointCloudFactory::instance();
+    if (tree || !useVbo())
+        return PointCloud::prepareDraw();
 
     checkGLContext();
 
+    // Optimized clouds only have to pick up a reload in progress
+    bool synced = false;
+    if (!optimized || shadowing || batches.loadAcquire())
+        synced = syncVbo();
+    if (reoptimize && synced && optimize())
+        reoptimize = false;
+    if (optimized)
+        packed.packing();       // Frees the points once they are packed
     if (size() == 0)
-        return;
+        return false;
+    checkIndex();
 
-    if (dirty)
-        updateVbo();
+    // Find visible octree nodes before the quantization transform
+    culled = octree && uploadIndex() && cull();
+    return true;
+}
 
-    if (colored())
-    {
-        GL.EnableClientState(GL_COLOR_ARRAY);
-        GL.BindBuffer(GL_ARRAY_BUFFER, colorVbo);
-        GL.ColorPointer(4, GL_FLOAT, sizeof(Color), 0);
-    }
-    else
+
+PointCloud::Style PointCloudVBO::style(bool documentProgram)
+// ----------------------------------------------------------------------------
+//   GL state the cloud is drawn with, through shaders if possible
+// ----------------------------------------------------------------------------
+{
+    Style s = PointCloud::style(documentProgram);
+    if (!tree && useVbo())
+        s.shaders = useShaders(documentProgram);
+    return s;
+}
+
+
+void PointCloudVBO::drawStyled(const Style &s)
+// ----------------------------------------------------------------------------
+//   Draw the VBOs, with the state of beginStyle() already set
+// ----------------------------------------------------------------------------
+{
+    if (tree || !useVbo())
+        return PointCloud::drawStyled(s);
+    if (s.shaders)
+        return drawShaders();
+
+    size_t stride = front.stride();
+    if (s.colored)
     {
-        // Activate current document color
-        fact->tao->SetFillColor();
+        GLenum type = front.byteColors ? GL_UNSIGNED_BYTE : GL_FLOAT;
+        if (front.interleaved)
+        {
+            // Colors follow each position in the point VBO
+            GL.BindBuffer(GL_ARRAY_BUFFER, front.vbo);
+            GL.ColorPointer(4, type, stride, (const void *) front.pointSize());
+        }
+        else
+        {
+            GL.BindBuffer(GL_ARRAY_BUFFER, front.colorVbo);
+            GL.ColorPointer(4, type, front.colorSize(), 0);
+        }
     }
 
-    if (pointSize > 0)
+    GL.BindBuffer(GL_ARRAY_BUFFER, front.vbo);
+    if (front.shortPoints)
     {
-        glPushAttrib(GL_POINT_BIT);
-        GL.PointSize(pointSize * fact->tao->DevicePixelRatio());
+        // Map quantized positions back into the bounding box
+        Point origin(0, 0, 0), step(0, 0, 0);
+        quantization(front, origin, step);
+        GL.PushMatrix();
+        GL.Translate(origin.x, origin.y, origin.z);
+        GL.Scale(step.x, step.y, step.z);
+        GL.LoadMatrix();
+        GL.VertexPointer(3, GL_SHORT, stride, 0);
     }
-    if (pointSprites)
+    else
     {
-        GL.Enable(GL_POINT_SPRITE);
-        GL.TexEnv(GL_POINT_SPRITE, GL_COORD_REPLACE, GL_TRUE);
-        GL.PointParameter(GL_POINT_SPRITE_COORD_ORIGIN, GL_LOWER_LEFT);
-        fact->tao->SetTextures();
+        GL.VertexPointer(3, GL_FLOAT, stride, 0);
     }
-    if (pointProgrammableSize)
-        GL.Enable(GL_VERTEX_PROGRAM_POINT_SIZE);
-
-    GL.EnableClientState(GL_VERTEX_ARRAY);
-    GL.BindBuffer(GL_ARRAY_BUFFER, vbo);
-    GL.VertexPointer(3, GL_FLOAT, sizeof(Point), 0);
-    GL.DrawArrays(GL_POINTS, 0, size());
+    if (culled)
+        drawVisible();
+    else
+        GL.DrawArrays(GL_POINTS, 0, front.uploaded);
     GL.BindBuffer(GL_ARRAY_BUFFER, 0);
-    GL.DisableClientState(GL_VERTEX_ARRAY);
-    if (colored())
-        GL.DisableClientState(GL_COLOR_ARRAY);
-
-    if (pointProgrammableSize)
-        GL.Disable(GL_VERTEX_PROGRAM_POINT_SIZE);
-    if (pointSprites)
+    if (front.shortPoints)
     {
-        GL.Disable(GL_POINT_SPRITE);
-        GL.TexEnv(GL_POINT_SPRITE, GL_COORD_REPLACE, GL_FALSE);
-        GL.PointParameter(GL_POINT_SPRITE_COORD_ORIGIN, GL_UPPER_LEFT);
+        GL.PopMatrix();
+        GL.LoadMatrix();
     }
-    if (pointSize > 0)
-        glPopAttrib();
-
 }
 
 
@@ -186,13 +237,19 @@ bool PointCloudVBO::optimize()
 
     if (useVbo())
     {
-        if (dirty)
-            updateVbo();
+        // Points can be freed only once they are all uploaded
+        if (!syncVbo())
+            return false;
         nbPoints = points.size();
-        points.clear();
+        is_colored = colors.size() != 0;
+
+        // Keep a compressed copy to restore VBOs in another GL context.
+        // The points are packed by the workers, then freed by the pack
+        packed.start(points, colors);
         optimized = true;
         IFTRACE(pointcloud)
-            debug() << "Cloud optimized\n";
+            debug() << "Cloud optimized, packing " << nbPoints
+                    << " points\n";
     }
 
     return true;
@@ -204,11 +261,14 @@ void PointCloudVBO::clear()
 //   Remove all points
 // ----------------------------------------------------------------------------
 {
-    if (size() == 0)
+    if (size() == 0 && !tree)
         return;
 
     if (optimized)
     {
+        dropIndex();
+        dropTree();
+        packed.clear();
         nbPoints = 0;
         optimized = false;
     }
@@ -218,6 +278,7 @@ void PointCloudVBO::clear()
         if (useVbo())
             updateVbo();
     }
+    reoptimize = false;
     file = "";
     nbRandom = 0;
 }
@@ -243,11 +304,13 @@ bool PointCloudVBO::loadData(text file, text sep, int xi, int yi, int zi,
 //   Load points from a file
 // ----------------------------------------------------------------------------
 {
+    prepare.storeRelease(preparedFormat());
     bool changed = PointCloud::loadData(file, sep, xi, yi, zi, colorScale,
                                         ri, gi, bi, ai, async);
     if (useVbo() && changed)
     {
-        updateVbo();
+        if (!optimized)
+            syncVbo();
 
         noOptimize = false;
         this->sep = sep;
@@ -275,6 +338,25 @@ bool PointCloudVBO::colored()
 }
 
 
+bool PointCloudVBO::save(text file)
+// ----------------------------------------------------------------------------
+//   Save the cloud in native format, unpacking it if optimized
+// ----------------------------------------------------------------------------
+//   VBOs hold quantized positions and byte colors, so they are only read
+//   back if the packed copy, which is exact, is missing or corrupt.
+{
+    checkGLContext();
+    if (!optimized)
+        return PointCloud::save(file);
+
+    point_vec pts;
+    color_vec cols;
+    if (packed.size() != nbPoints || !packed.unpack(pts, cols))
+        readBack(pts, cols);
+    return saveData(file, pts, cols);
+}
+
+
 void PointCloudVBO::checkGLContext()
 // ----------------------------------------------------------------------------
 //   Do what's needed if GL context has changed
@@ -285,12 +367,21 @@ void PointCloudVBO::checkGLContext()
         IFTRACE(pointcloud)
             debug() << "GL context changed\n";
 
-        // Re-create VBO(s)
-        genPointBuffer();
+        // Re-create VBO(s), back buffers are re-created when needed
+        front = Buffers();
+        back = Buffers();
+        ibo = iboCount = 0;
+        vao = vaoVbo = vaoColorVbo = 0;
+        genPointBuffer(front);
         if (colored())
-            genColorBuffer();
+            genColorBuffer(front);
 
-        if (optimized)
+        if (optimized && unpack())
+        {
+            IFTRACE(pointcloud)
+                debug() << "Restored optimized cloud from packed points\n";
+        }
+        else if (optimized)
         {
             IFTRACE(pointcloud)
                 debug() << "GL context changed on optimized cloud\n";
@@ -325,6 +416,32 @@ void PointCloudVBO::checkGLContext()
 }
 
 
+bool PointCloudVBO::unpack()
+// ----------------------------------------------------------------------------
+//   Upload the packed points of an optimized cloud to new VBOs
+// ----------------------------------------------------------------------------
+//   Points are unpacked in parallel and freed again once uploaded, so that
+//   the cloud stays optimized, without reading its source again.
+{
+    if (!nbPoints || packed.size() != nbPoints)
+        return false;
+
+    optimized = false;
+    if (!packed.unpack(points, colors))
+    {
+        IFTRACE(pointcloud)
+            debug() << "Packed points are corrupt\n";
+        optimized = true;
+        return false;
+    }
+    updateVbo();
+    point_vec().swap(points);
+    color_vec().swap(colors);
+    optimized = true;
+    return true;
+}
+
+
 bool PointCloudVBO::useVbo()
 // ----------------------------------------------------------------------------
 //   Should we use Vertex Buffer Objects?
@@ -351,51 +468,982 @@ void PointCloudVBO::updateVbo()
     }
 
     IFTRACE(pointcloud)
-        debug() << "Updating VBO #" << vbo << " (" << size() << " points)\n";
+        debug() << "Updating VBO #" << front.vbo << " (" << size()
+                << " points)\n";
+
+    // Nothing in the VBOs can be drawn, upload all points at once
+    size_t all = ~size_t(0);
+    releaseBuffers(front);
+    appendVbo(front, points, colors, all);
+    dirty = false;
+}
+
+
+void PointCloudVBO::appendVbo(Buffers &b,
+                              const point_vec &points,
+                              const color_vec &colors,
+                              size_t &budget)
+// ----------------------------------------------------------------------------
+//   Upload the points appended since the last upload, within budget bytes
+// ----------------------------------------------------------------------------
+//   VBOs are allocated for all points at once, then filled over as many
+//   frames as the budget requires. Only the points uploaded are drawn.
+//   Reallocating a VBO or changing the quantization box makes the points
+//   already uploaded unusable, they are then uploaded again from the start.
+{
+    XL_ASSERT(!optimized);
+
+    if (QThread::currentThread() != qApp->thread())
+        return;
+
+    unsigned n = points.size();
+    if (b.uploaded > n)
+        b.uploaded = n;
+    if (b.vbo == 0)
+        genPointBuffer(b);
+    if (b.uploaded == 0)
+    {
+        // Capacities are counted in items of the previous format
+        bool interleave = interleaved && colors.size();
+        if (b.shortPoints != compactPoints ||
+            b.byteColors != compactColors ||
+            b.interleaved != interleave)
+            b.capacity = b.colorCapacity = 0;
+        b.shortPoints = compactPoints;
+        b.byteColors = compactColors;
+        b.interleaved = interleave;
+        b.loose = false;
+    }
 
-    GL.BindBuffer(GL_ARRAY_BUFFER, vbo);
-    GL.BufferData(GL_ARRAY_BUFFER, size()*sizeof(Point), &points[0].x,
-                 GL_STATIC_DRAW);
+    unsigned first = b.uploaded, colorFirst = b.uploaded;
+    bool separateColors = !b.interleaved && colors.size();
+    GL.BindBuffer(GL_ARRAY_BUFFER, b.vbo);
+    if (growBuffer(b.capacity, b.stride(), n))
+        first = 0;
+    if (separateColors)
+    {
+        if (b.colorVbo == 0)
+            genColorBuffer(b);
+        GL.BindBuffer(GL_ARRAY_BUFFER, b.colorVbo);
+        if (growBuffer(b.colorCapacity, b.colorSize(), n))
+            colorFirst = 0;
+    }
     GL.BindBuffer(GL_ARRAY_BUFFER, 0);
 
-    if (colored())
+    // If the quantization box changed, all positions must be converted again
+    if (b.shortPoints && !fitBox(b, points, first))
+        first = 0;
+
+    unsigned start = qMin(first, colorFirst);
+    size_t itemSize = b.stride() + (separateColors ? b.colorSize() : 0);
+    unsigned end = n;
+    if (budget / itemSize < n - start)
+        end = start + budget / itemSize;
+    budget -= (end - start) * itemSize;
+
+    IFTRACE(pointcloud)
+        debug() << "Uploading points " << start << " to " << end
+                << " to VBO #" << b.vbo << " (" << n << " points)\n";
+
+    if (b.interleaved)
     {
-        if (colorVbo == 0)
-            genColorBuffer();
+        uploadVertices(b, points, colors, first, end);
+    }
+    else
+    {
+        uploadPoints(b, points, first, end);
+        if (separateColors)
+            uploadColors(b, colors, qMin(colorFirst, end), end);
+    }
+    b.uploaded = end;
+
+    // Vertices prepared by the loader are released once uploaded
+    while (!b.prepared.isEmpty() &&
+           b.prepared.first().first + b.prepared.first().count() <= end)
+        b.prepared.removeFirst();
+}
 
-        IFTRACE(pointcloud)
-            debug() << "Updating VBO #" << colorVbo << " (" << size()
-                    << " colors)\n";
 
-        GL.BindBuffer(GL_ARRAY_BUFFER, colorVbo);
-        GL.BufferData(GL_ARRAY_BUFFER, size()*sizeof(Color), &colors[0].r,
-                     GL_STATIC_DRAW);
-        GL.BindBuffer(GL_ARRAY_BUFFER, 0);
+static inline GLshort quantize(float v, float origin, float step)
+// ----------------------------------------------------------------------------
+//   Convert a coordinate to a 16-bit integer in the quantization box
+// ----------------------------------------------------------------------------
+{
+    float q = (v - origin) / step;
+    q = q < 0 ? q - 0.5f : q + 0.5f;
+    if (q > 32767.0f)
+        return 32767;
+    if (q < -32767.0f)
+        return -32767;
+    return (GLshort) q;
+}
+
+
+static inline GLubyte toByte(float v)
+// ----------------------------------------------------------------------------
+//   Convert a color component in [0.0, 1.0] to an unsigned byte
+// ----------------------------------------------------------------------------
+{
+    if (v <= 0.0f)
+        return 0;
+    if (v >= 1.0f)
+        return 255;
+    return (GLubyte) (v * 255.0f + 0.5f);
+}
+
+
+void PointCloudVBO::quantization(const Buffers &b, Point &origin, Point &step)
+// ----------------------------------------------------------------------------
+//   Position represented by quantized value q is origin + q * step
+// ----------------------------------------------------------------------------
+{
+    origin = Point((b.lo.x + b.hi.x) / 2,
+                   (b.lo.y + b.hi.y) / 2,
+                   (b.lo.z + b.hi.z) / 2);
+    step = Point((b.hi.x - b.lo.x) / (2 * QUANTUM),
+                 (b.hi.y - b.lo.y) / (2 * QUANTUM),
+                 (b.hi.z - b.lo.z) / (2 * QUANTUM));
+
+    // Flat boxes: any non-zero step will do
+    if (step.x <= 0)
+        step.x = 1;
+    if (step.y <= 0)
+        step.y = 1;
+    if (step.z <= 0)
+        step.z = 1;
+}
+
+
+bool PointCloudVBO::fitBox(Buffers &b, const point_vec &points,
+                           unsigned first)
+// ----------------------------------------------------------------------------
+//   Make sure the quantization box contains the points from 'first' on
+// ----------------------------------------------------------------------------
+//   Returns false if the box changed, meaning that all points must be
+//   quantized again. A box that grows is enlarged by some margin so that
+//   this happens only a few times during a progressive load; it is
+//   marked loose so that it can be tightened once the load is complete.
+{
+    unsigned n = points.size();
+    if (first >= n)
+        return true;
+
+    Point lo = points[first], hi = lo;
+    for (unsigned i = first + 1; i < n; i++)
+    {
+        const Point &p = points[i];
+        lo.x = qMin(lo.x, p.x); hi.x = qMax(hi.x, p.x);
+        lo.y = qMin(lo.y, p.y); hi.y = qMax(hi.y, p.y);
+        lo.z = qMin(lo.z, p.z); hi.z = qMax(hi.z, p.z);
     }
-    dirty = false;
+
+    bool loading = loadInProgress();
+    if (first > 0)
+    {
+        if (lo.x >= b.lo.x && lo.y >= b.lo.y && lo.z >= b.lo.z &&
+            hi.x <= b.hi.x && hi.y <= b.hi.y && hi.z <= b.hi.z)
+            return true;
+        lo = Point(qMin(lo.x, b.lo.x), qMin(lo.y, b.lo.y), qMin(lo.z, b.lo.z));
+        hi = Point(qMax(hi.x, b.hi.x), qMax(hi.y, b.hi.y), qMax(hi.z, b.hi.z));
+    }
+    if (first > 0 || loading)
+    {
+        Point margin((hi.x - lo.x) / 4, (hi.y - lo.y) / 4, (hi.z - lo.z) / 4);
+        lo = Point(lo.x - margin.x, lo.y - margin.y, lo.z - margin.z);
+        hi = Point(hi.x + margin.x, hi.y + margin.y, hi.z + margin.z);
+    }
+    b.lo = lo;
+    b.hi = hi;
+    b.loose = loading;
+
+    IFTRACE(pointcloud)
+        debug() << "Quantization box (" << lo.x << ", " << lo.y << ", "
+                << lo.z << ") - (" << hi.x << ", " << hi.y << ", "
+                << hi.z << ")\n";
+    return false;
+}
+
+
+void PointCloudVBO::uploadPoints(Buffers &b, const point_vec &points,
+                                 unsigned first, unsigned count)
+// ----------------------------------------------------------------------------
+//   Upload positions from 'first' to 'count', quantized if needed
+// ----------------------------------------------------------------------------
+{
+    size_t itemSize = b.pointSize();
+    GL.BindBuffer(GL_ARRAY_BUFFER, b.vbo);
+    if (first < count)
+    {
+        if (!b.shortPoints)
+        {
+            size_t n = 0;
+            for (size_t i = first; i < count; i += n)
+            {
+                n = count - i;
+                const Point *p = points.span(i, n);
+                GL.BufferSubData(GL_ARRAY_BUFFER, i * itemSize, n * itemSize,
+                                 p);
+            }
+        }
+        else
+        {
+            // Convert by slices to bound temporary memory
+            Point origin(0, 0, 0), step(0, 0, 0);
+            quantization(b, origin, step);
+            std::vector<char> data;
+            for (unsigned i = first; i < count; i += UPLOAD_SLICE)
+            {
+                unsigned m = qMin((unsigned) UPLOAD_SLICE, count - i);
+                char *dst = beginWrite(data, i * itemSize, m * itemSize);
+                encodePoints(dst, itemSize, points, i, m, true, origin, step);
+                endWrite(data, dst, i * itemSize, m * itemSize);
+            }
+        }
+    }
+    GL.BindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+void PointCloudVBO::uploadColors(Buffers &b, const color_vec &colors,
+                                 unsigned first, unsigned count)
+// ----------------------------------------------------------------------------
+//   Upload colors from 'first' to 'count', as bytes if needed
+// ----------------------------------------------------------------------------
+{
+    size_t itemSize = b.colorSize();
+    GL.BindBuffer(GL_ARRAY_BUFFER, b.colorVbo);
+    if (first < count)
+    {
+        if (!b.byteColors)
+        {
+            size_t n = 0;
+            for (size_t i = first; i < count; i += n)
+            {
+                n = count - i;
+                const Color *c = colors.span(i, n);
+                GL.BufferSubData(GL_ARRAY_BUFFER, i * itemSize, n * itemSize,
+                                 c);
+            }
+        }
+        else
+        {
+            std::vector<char> data;
+            for (unsigned i = first; i < count; i += UPLOAD_SLICE)
+            {
+                unsigned m = qMin((unsigned) UPLOAD_SLICE, count - i);
+                char *dst = beginWrite(data, i * itemSize, m * itemSize);
+                encodeColors(dst, itemSize, colors, i, m, true);
+                endWrite(data, dst, i * itemSize, m * itemSize);
+            }
+        }
+    }
+    GL.BindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+void PointCloudVBO::uploadVertices(Buffers &b,
+                                   const point_vec &points,
+                                   const color_vec &colors,
+                                   unsigned first, unsigned count)
+// ----------------------------------------------------------------------------
+//   Upload interleaved positions and colors from 'first' to 'count'
+// ----------------------------------------------------------------------------
+//   Vertices already interleaved by the loader are uploaded as they are when
+//   they follow the data in the VBO, possibly over several frames. Others
+//   are converted here by slices.
+{
+    size_t stride = b.stride();
+    GL.BindBuffer(GL_ARRAY_BUFFER, b.vbo);
+
+    int format = b.byteColors ? BYTE_COLORS : FLOAT_COLORS;
+    for (int p = 0; p < b.prepared.size() && first < count; p++)
+    {
+        const Prepared &prep = b.prepared[p];
+        unsigned m = prep.count();
+        if (b.shortPoints || prep.format != format || prep.first > first)
+            break;
+        if (prep.first + m <= first)
+            continue;
+        unsigned skip = first - prep.first;
+        m = qMin(m - skip, count - first);
+        GL.BufferSubData(GL_ARRAY_BUFFER, first * stride, m * stride,
+                         prep.vertices.constData() + skip * stride);
+        first += m;
+    }
+
+    if (first < count)
+    {
+        Point origin(0, 0, 0), step(0, 0, 0);
+        if (b.shortPoints)
+            quantization(b, origin, step);
+        std::vector<char> data;
+        for (unsigned i = first; i < count; i += UPLOAD_SLICE)
+        {
+            unsigned m = qMin((unsigned) UPLOAD_SLICE, count - i);
+            char *dst = beginWrite(data, i * stride, m * stride);
+            encodePoints(dst, stride, points, i, m,
+                         b.shortPoints, origin, step);
+            encodeColors(dst + b.pointSize(), stride, colors, i, m,
+                         b.byteColors);
+            endWrite(data, dst, i * stride, m * stride);
+        }
+    }
+    GL.BindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+void PointCloudVBO::encodePoints(char *dst, size_t stride,
+                                 const point_vec &points,
+                                 unsigned first, unsigned count,
+                                 bool quantized, Point origin, Point step)
+// ----------------------------------------------------------------------------
+//   Write positions 'stride' bytes apart, as floats or quantized
+// ----------------------------------------------------------------------------
+{
+    for (unsigned i = first; i < first + count; i++, dst += stride)
+    {
+        const Point &p = points[i];
+        if (quantized)
+        {
+            GLshort q[3] = { quantize(p.x, origin.x, step.x),
+                             quantize(p.y, origin.y, step.y),
+                             quantize(p.z, origin.z, step.z) };
+            memcpy(dst, q, sizeof(q));
+        }
+        else
+        {
+            memcpy(dst, &p, sizeof(p));
+        }
+    }
+}
+
+
+void PointCloudVBO::encodeColors(char *dst, size_t stride,
+                                 const color_vec &colors,
+                                 unsigned first, unsigned count,
+                                 bool bytes)
+// ----------------------------------------------------------------------------
+//   Write colors 'stride' bytes apart, as floats or bytes
+// ----------------------------------------------------------------------------
+{
+    for (unsigned i = first; i < first + count; i++, dst += stride)
+    {
+        const Color &c = colors[i];
+        if (bytes)
+        {
+            GLubyte rgba[4] = { toByte(c.r), toByte(c.g),
+                                toByte(c.b), toByte(c.a) };
+            memcpy(dst, rgba, sizeof(rgba));
+        }
+        else
+        {
+            memcpy(dst, &c, sizeof(c));
+        }
+    }
+}
+
+
+int PointCloudVBO::preparedFormat()
+// ----------------------------------------------------------------------------
+//   Vertices the loader can interleave with the current settings
+// ----------------------------------------------------------------------------
+//   Quantized positions depend on the bounding box of the cloud, which is
+//   only known when uploading, so they are always converted here.
+{
+    if (!interleaved || compactPoints || !useVbo())
+        return NOT_PREPARED;
+    return compactColors ? BYTE_COLORS : FLOAT_COLORS;
+}
+
+
+bool PointCloudVBO::growBuffer(unsigned &allocated, size_t itemSize,
+                               unsigned count)
+// ----------------------------------------------------------------------------
+//   Make room for 'count' items in the bound VBO, true if it was reallocated
+// ----------------------------------------------------------------------------
+//   Growing a VBO loses its contents, so its size is doubled each time
+//   (or set to the expected size of the load) to upload each item once or
+//   twice at most during a progressive load.
+{
+    if (count <= allocated)
+        return false;
+
+    // Clouds modified by the document are hinted as such to the driver
+    allocated = qMax(qMax(count, 2 * allocated), expected);
+    GL.BufferData(GL_ARRAY_BUFFER, allocated * itemSize, NULL,
+                  noOptimize ? GL_DYNAMIC_DRAW : GL_STATIC_DRAW);
+    return true;
+}
+
+
+char *PointCloudVBO::beginWrite(std::vector<char> &data,
+                                size_t offset, size_t size)
+// ----------------------------------------------------------------------------
+//   Where to convert data for a range of the bound VBO
+// ----------------------------------------------------------------------------
+//   The range is mapped when possible, so that data is converted directly
+//   into the buffer. Its previous contents are invalidated, which lets the
+//   driver avoid waiting for draws still using them.
+{
+    if (PointCloudFactory::instance()->mapRangeSupported)
+    {
+        void *dst = glMapBufferRange(GL_ARRAY_BUFFER, offset, size,
+                                     GL_MAP_WRITE_BIT |
+                                     GL_MAP_INVALIDATE_RANGE_BIT);
+        if (dst)
+            return (char *) dst;
+    }
+    data.resize(size);
+    return &data[0];
+}
+
+
+void PointCloudVBO::endWrite(std::vector<char> &data, char *dst,
+                             size_t offset, size_t size)
+// ----------------------------------------------------------------------------
+//   Send data converted after beginWrite() to the bound VBO
+// ----------------------------------------------------------------------------
+{
+    if (data.empty() || dst != &data[0])
+    {
+        // Mapped buffers may be lost, e.g. on a change of screen mode
+        if (!glUnmapBuffer(GL_ARRAY_BUFFER))
+            dirty = true;
+        return;
+    }
+    GL.BufferSubData(GL_ARRAY_BUFFER, offset, size, dst);
+}
+
+
+void PointCloudVBO::readBack(point_vec &pts, color_vec &cols)
+// ----------------------------------------------------------------------------
+//   Read the points of an optimized cloud back from VBOs
+// ----------------------------------------------------------------------------
+{
+    pts.clear();
+    cols.clear();
+    pts.resize(nbPoints, Point(0, 0, 0));
+    cols.resize(is_colored ? nbPoints : 0);
+    if (!nbPoints)
+        return;
+
+    size_t stride = front.stride();
+    std::vector<char> data(nbPoints * stride);
+    GL.BindBuffer(GL_ARRAY_BUFFER, front.vbo);
+    glGetBufferSubData(GL_ARRAY_BUFFER, 0, data.size(), &data[0]);
+
+    Point origin(0, 0, 0), step(0, 0, 0);
+    if (front.shortPoints)
+        quantization(front, origin, step);
+    const char *src = &data[0];
+    for (unsigned i = 0; i < nbPoints; i++, src += stride)
+    {
+        if (front.shortPoints)
+        {
+            GLshort q[3];
+            memcpy(q, src, sizeof(q));
+            pts[i] = Point(origin.x + q[0] * step.x,
+                           origin.y + q[1] * step.y,
+                           origin.z + q[2] * step.z);
+        }
+        else
+        {
+            memcpy(&pts[i], src, sizeof(Point));
+        }
+    }
+
+    if (is_colored)
+    {
+        src = &data[front.pointSize()];
+        if (!front.interleaved)
+        {
+            stride = front.colorSize();
+            data.resize(nbPoints * stride);
+            GL.BindBuffer(GL_ARRAY_BUFFER, front.colorVbo);
+            glGetBufferSubData(GL_ARRAY_BUFFER, 0, data.size(), &data[0]);
+            src = &data[0];
+        }
+        for (unsigned i = 0; i < nbPoints; i++, src += stride)
+        {
+            if (front.byteColors)
+            {
+                GLubyte c[4];
+                memcpy(c, src, sizeof(c));
+                cols[i] = Color(c[0] / 255.0f, c[1] / 255.0f,
+                                c[2] / 255.0f, c[3] / 255.0f);
+            }
+            else
+            {
+                memcpy(&cols[i], src, sizeof(Color));
+            }
+        }
+    }
+    GL.BindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+bool PointCloudVBO::uploadIndex()
+// ----------------------------------------------------------------------------
+//   Upload the octree order of the points as an index buffer, if needed
+// ----------------------------------------------------------------------------
+{
+    if (iboCount == octree->count)
+        return iboCount != 0;
+    if (octree->count > front.uploaded || octree->nodes.empty())
+        return false;
+
+    IFTRACE(pointcloud)
+        debug() << "Uploading octree order of " << octree->count
+                << " points\n";
+    if (!ibo)
+        GL.GenBuffers(1, &ibo);
+
+    // Subsamples of inner nodes follow the order, see refine()
+    size_t size = octree->count * sizeof(GLuint);
+    size_t samples = octree->samples.size() * sizeof(GLuint);
+    GL.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+    GL.BufferData(GL_ELEMENT_ARRAY_BUFFER, size + samples, NULL,
+                  GL_STATIC_DRAW);
+    GL.BufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, size, &octree->order[0]);
+    if (samples)
+        GL.BufferSubData(GL_ELEMENT_ARRAY_BUFFER, size, samples,
+                         &octree->samples[0]);
+    GL.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    iboCount = octree->count;
+    return true;
+}
+
+
+bool PointCloudVBO::cull()
+// ----------------------------------------------------------------------------
+//   Collect the ranges of ibo that are in the view frustum
+// ----------------------------------------------------------------------------
+//   Nodes entirely inside a plane do not test it again for their children,
+//   and adjacent ranges are merged.
+{
+    view.load(pointSize);
+
+    // Points added since the index was built have their own bounds
+    unsigned n = front.uploaded;
+    tailVisible = iboCount < n;
+    unsigned mask = PointCloudView::ALL_PLANES;
+    if (tailVisible && !optimized && tailScanned >= n)
+        tailVisible = view.clip(mask, tailLo, tailHi);
+
+    drawCounts.clear();
+    drawOffsets.clear();
+    if (pointBudget)
+    {
+        unsigned tail = tailVisible ? n - iboCount : 0;
+        if (tail < pointBudget)
+            refine(pointBudget - tail);
+    }
+    else
+    {
+        cullNode(0, PointCloudView::ALL_PLANES);
+    }
+    return true;
 }
 
 
-void PointCloudVBO::genPointBuffer()
+void PointCloudVBO::refine(unsigned budget)
+// ----------------------------------------------------------------------------
+//   Collect visible ranges at a level of detail that fits in the budget
+// ----------------------------------------------------------------------------
+//   Inner nodes are first drawn with their subsample. The node with the
+//   largest spacing between its points on screen is refined next, i.e.
+//   its subsample is replaced with its visible children, as long as this
+//   fits in the budget and points are spaced more than a point size.
+{
+    const std::vector<PointCloudOctree::Node> &nodes = octree->nodes;
+    unsigned mask = PointCloudView::ALL_PLANES;
+    if (!view.clip(mask, nodes[0].lo, nodes[0].hi))
+        return;
+    if (!nodes[0].children)
+    {
+        // Leaves are shuffled, any prefix is a subsample
+        addRange(nodes[0].first, qMin(nodes[0].count, budget));
+        return;
+    }
+
+    unsigned used = nodes[0].samples;
+    lodQueue.clear();
+    lodQueue.push_back(Refinement(nodeError(nodes[0]), 0, mask));
+    while (!lodQueue.empty())
+    {
+        std::pop_heap(lodQueue.begin(), lodQueue.end());
+        Refinement top = lodQueue.back();
+        lodQueue.pop_back();
+        const PointCloudOctree::Node &node = nodes[top.node];
+
+        // Cost of drawing the visible children instead of the subsample
+        unsigned masks[8], cost = 0;
+        if (top.error >= view.spacing)
+        {
+            for (unsigned c = 0; c < node.children; c++)
+            {
+                const PointCloudOctree::Node &child =
+                    nodes[node.firstChild + c];
+                masks[c] = top.mask;
+                if (!view.clip(masks[c], child.lo, child.hi))
+                    masks[c] = ~0U;
+                else
+                    cost += child.children ? child.samples : child.count;
+            }
+        }
+        if (top.error < view.spacing || used - node.samples + cost > budget)
+        {
+            addRange(iboCount + node.sample, qMin(node.samples, budget));
+            continue;
+        }
+
+        used = used - node.samples + cost;
+        for (unsigned c = 0; c < node.children; c++)
+        {
+            unsigned id = node.firstChild + c;
+            const PointCloudOctree::Node &child = nodes[id];
+            if (masks[c] == ~0U)
+                continue;
+            if (!child.children)
+            {
+                addRange(child.first, child.count);
+                continue;
+            }
+            lodQueue.push_back(Refinement(nodeError(child), id, masks[c]));
+            std::push_heap(lodQueue.begin(), lodQueue.end());
+        }
+    }
+}
+
+
+void PointCloudVBO::addRange(unsigned first, unsigned count)
+// ----------------------------------------------------------------------------
+//   Add a range of ibo to draw, extending the last range if possible
+// ----------------------------------------------------------------------------
+{
+    size_t last = drawCounts.size();
+    if (last && ((size_t) drawOffsets[last-1] / sizeof(GLuint) +
+                 drawCounts[last-1] == first))
+    {
+        drawCounts[last-1] += count;
+        return;
+    }
+    drawCounts.push_back(count);
+    drawOffsets.push_back((const GLvoid *) (first * sizeof(GLuint)));
+}
+
+
+void PointCloudVBO::cullNode(unsigned node, unsigned mask)
+// ----------------------------------------------------------------------------
+//   Add the visible parts of a node, testing only the planes in mask
+// ----------------------------------------------------------------------------
+{
+    const PointCloudOctree::Node &nd = octree->nodes[node];
+    if (!view.clip(mask, nd.lo, nd.hi))
+        return;
+
+    if (mask && nd.children)
+    {
+        for (unsigned c = 0; c < nd.children; c++)
+            cullNode(nd.firstChild + c, mask);
+        return;
+    }
+
+    // Children ranges are consecutive, and are merged by addRange()
+    addRange(nd.first, nd.count);
+}
+
+
+void PointCloudVBO::drawVisible()
+// ----------------------------------------------------------------------------
+//   Draw the visible octree ranges in one call, then the tail if visible
+// ----------------------------------------------------------------------------
+{
+    if (!drawCounts.empty())
+    {
+        GL.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+        glMultiDrawElements(GL_POINTS, &drawCounts[0], GL_UNSIGNED_INT,
+                            &drawOffsets[0], drawCounts.size());
+        GL.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+    if (tailVisible)
+        GL.DrawArrays(GL_POINTS, iboCount, front.uploaded - iboCount);
+}
+
+
+bool PointCloudVBO::useShaders(bool documentProgram)
+// ----------------------------------------------------------------------------
+//   Draw with shaders, unless the document set its own
+// ----------------------------------------------------------------------------
+{
+    PointCloudFactory * fact = PointCloudFactory::instance();
+    if (!shaders || !fact->shadersSupported || documentProgram)
+        return false;
+    return fact->shader->ready();
+}
+
+
+void PointCloudVBO::drawShaders()
+// ----------------------------------------------------------------------------
+//   Draw the VBOs through the VAO of the cloud and the shared program
+// ----------------------------------------------------------------------------
+//   Quantized positions are decoded and points are sized by the shaders,
+//   so that no matrix or point attribute has to be pushed for the draw.
+//   The program is bound and sprites are set up by beginStyle().
+{
+    PointCloudFactory * fact = PointCloudFactory::instance();
+    if (!culled)
+        view.load(pointSize);
+
+    bindVao();
+
+    GLfloat size = pointSize * fact->tao->DevicePixelRatio();
+    if (pointSize <= 0)
+        glGetFloatv(GL_POINT_SIZE, &size);
+    Point origin(0, 0, 0), step(1, 1, 1);
+    if (front.shortPoints)
+        quantization(front, origin, step);
+    fact->shader->uniforms(view.m, origin, step, size, pointSprites);
+
+    if (culled)
+        drawVisible();
+    else
+        GL.DrawArrays(GL_POINTS, 0, front.uploaded);
+}
+
+
+void PointCloudVBO::bindVao()
+// ----------------------------------------------------------------------------
+//   Bind the VAO, setting it up again if VBOs or their layout changed
+// ----------------------------------------------------------------------------
+{
+    bool hasColors = colored();
+    int layout = ((front.shortPoints ? 1 : 0) | (front.byteColors ? 2 : 0) |
+                  (front.interleaved ? 4 : 0) | (hasColors ? 8 : 0));
+    if (!vao)
+        glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    if (vaoVbo == front.vbo && vaoColorVbo == front.colorVbo &&
+        vaoLayout == layout)
+        return;
+
+    IFTRACE(pointcloud)
+        debug() << "Setting up VAO #" << vao << " for VBO #" << front.vbo
+                << "\n";
+    size_t stride = front.stride();
+    GL.BindBuffer(GL_ARRAY_BUFFER, front.vbo);
+    glVertexAttribPointer(PointCloudShader::POSITION, 3,
+                          front.shortPoints ? GL_SHORT : GL_FLOAT, GL_FALSE,
+                          stride, 0);
+    glEnableVertexAttribArray(PointCloudShader::POSITION);
+    if (hasColors)
+    {
+        GLenum type = front.byteColors ? GL_UNSIGNED_BYTE : GL_FLOAT;
+        GLboolean normalized = front.byteColors ? GL_TRUE : GL_FALSE;
+        if (front.interleaved)
+        {
+            glVertexAttribPointer(PointCloudShader::COLOR, 4, type, normalized,
+                                  stride, (const void *) front.pointSize());
+        }
+        else
+        {
+            GL.BindBuffer(GL_ARRAY_BUFFER, front.colorVbo);
+            glVertexAttribPointer(PointCloudShader::COLOR, 4, type, normalized,
+                                  front.colorSize(), 0);
+        }
+        glEnableVertexAttribArray(PointCloudShader::COLOR);
+    }
+    else
+    {
+        glDisableVertexAttribArray(PointCloudShader::COLOR);
+    }
+    GL.BindBuffer(GL_ARRAY_BUFFER, 0);
+    vaoVbo = front.vbo;
+    vaoColorVbo = front.colorVbo;
+    vaoLayout = layout;
+}
+
+
+void PointCloudVBO::indexChanged()
+// ----------------------------------------------------------------------------
+//   The octree was replaced or dropped, release the old order
+// ----------------------------------------------------------------------------
+{
+    if (!iboCount)
+        return;
+    GL.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+    GL.BufferData(GL_ELEMENT_ARRAY_BUFFER, 0, NULL, GL_STATIC_DRAW);
+    GL.BindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    iboCount = 0;
+}
+
+
+bool PointCloudVBO::syncVbo()
+// ----------------------------------------------------------------------------
+//   Bring VBOs up to date with points loaded or modified so far
+// ----------------------------------------------------------------------------
+//   At most uploadBudget MB are sent per frame, so that large loads do not
+//   stall drawing. Returns true when all points are in front buffers.
+{
+    prepare.storeRelease(preparedFormat());
+    fetchBatches();
+
+    size_t budget = uploadBudget ? size_t(uploadBudget) << 20 : ~size_t(0);
+    if (dirty)
+        updateVbo();
+    else if (front.uploaded < points.size())
+        appendVbo(front, points, colors, budget);
+
+    if (shadowing)
+    {
+        if (back.uploaded < backPoints.size())
+            appendVbo(back, backPoints, backColors, budget);
+    }
+    else if (!optimized && front.uploaded && stale(front))
+    {
+        // Convert all points into back buffers while front ones are drawn
+        if (back.uploaded && stale(back))
+            back.uploaded = 0;
+        appendVbo(back, points, colors, budget);
+        if (back.uploaded == points.size())
+        {
+            IFTRACE(pointcloud)
+                debug() << "Swapping VBOs converted to new format\n";
+            std::swap(front, back);
+            releaseBuffers(back);
+        }
+    }
+    return front.uploaded == points.size() && !stale(front);
+}
+
+
+bool PointCloudVBO::stale(const Buffers &b)
+// ----------------------------------------------------------------------------
+//   VBOs in another format than set, or with a box enlarged during a load
+// ----------------------------------------------------------------------------
+{
+    bool interleave = interleaved && colors.size();
+    return (b.shortPoints != compactPoints ||
+            b.byteColors != compactColors ||
+            b.interleaved != interleave ||
+            (b.loose && !loadInProgress()));
+}
+
+
+void PointCloudVBO::prepareBatch(Batch *batch)
+// ----------------------------------------------------------------------------
+//   Interleave positions and colors of a batch (loader thread)
+// ----------------------------------------------------------------------------
+{
+    int format = prepare.loadAcquire();
+    unsigned n = batch->points.size();
+    if (format == NOT_PREPARED || n == 0 || batch->colors.size() != n)
+        return;
+
+    bool bytes = format == BYTE_COLORS;
+    size_t pointSize = sizeof(Point);
+    size_t stride = Prepared::stride(format);
+    batch->vertices.resize(n * stride);
+    char *dst = batch->vertices.data();
+    encodePoints(dst, stride, batch->points, 0, n,
+                 false, Point(0, 0, 0), Point(1, 1, 1));
+    encodeColors(dst + pointSize, stride, batch->colors, 0, n, bytes);
+    batch->format = format;
+}
+
+
+void PointCloudVBO::batchFetched(Batch *batch, unsigned first, bool back)
+// ----------------------------------------------------------------------------
+//   Keep vertices interleaved by the loader until they are uploaded
+// ----------------------------------------------------------------------------
+{
+    Buffers &b = back ? this->back : front;
+    if (batch->reset)
+        b.prepared.clear();
+    if (batch->vertices.isEmpty())
+        return;
+    b.prepared.append(Prepared(first, batch->vertices, batch->format));
+}
+
+
+void PointCloudVBO::dataAppended(unsigned first)
+// ----------------------------------------------------------------------------
+//   Points from 'first' on were replaced by a loader
+// ----------------------------------------------------------------------------
+{
+    if (first < front.uploaded)
+        front.uploaded = first;
+}
+
+
+void PointCloudVBO::backReset()
+// ----------------------------------------------------------------------------
+//   A reload into back buffers started
+// ----------------------------------------------------------------------------
+{
+    back.uploaded = 0;
+    back.prepared.clear();
+}
+
+
+void PointCloudVBO::dataSwapped()
+// ----------------------------------------------------------------------------
+//   A reload completed, show back buffers and release the previous ones
+// ----------------------------------------------------------------------------
+{
+    if (optimized)
+    {
+        // Optimize the new points again once they are all uploaded
+        optimized = false;
+        nbPoints = 0;
+        packed.clear();
+        reoptimize = true;
+    }
+    std::swap(front, back);
+    releaseBuffers(back);
+}
+
+
+void PointCloudVBO::genPointBuffer(Buffers &b)
 // ----------------------------------------------------------------------------
 //   Allocate new VBO for point coordinates
 // ----------------------------------------------------------------------------
 {
-    GL.GenBuffers(1, &vbo);
+    GL.GenBuffers(1, &b.vbo);
     IFTRACE(pointcloud)
-        debug() << "Allocated VBO #" << vbo << " for point coordinates\n";
+        debug() << "Allocated VBO #" << b.vbo << " for point coordinates\n";
 }
 
 
-void PointCloudVBO::genColorBuffer()
+void PointCloudVBO::genColorBuffer(Buffers &b)
 // ----------------------------------------------------------------------------
 //   Allocate new VBO for colors
 // ----------------------------------------------------------------------------
 {
-    XL_ASSERT(colored());
-    GL.GenBuffers(1, &colorVbo);
+    GL.GenBuffers(1, &b.colorVbo);
     IFTRACE(pointcloud)
-        debug() << "Allocated VBO #" << colorVbo << " for colors\n";
+        debug() << "Allocated VBO #" << b.colorVbo << " for colors\n";
+}
+
+
+void PointCloudVBO::releaseBuffers(Buffers &b)
+// ----------------------------------------------------------------------------
+//   Free the storage of VBOs, but keep them for later use
+// ----------------------------------------------------------------------------
+{
+    GLuint buffers[2] = { b.vbo, b.colorVbo };
+    for (int i = 0; i < 2; i++)
+    {
+        if (!buffers[i])
+            continue;
+        IFTRACE(pointcloud)
+            debug() << "Releasing storage of VBO #" << buffers[i] << "\n";
+        GL.BindBuffer(GL_ARRAY_BUFFER, buffers[i]);
+        GL.BufferData(GL_ARRAY_BUFFER, 0, NULL, GL_STATIC_DRAW);
+    }
+    GL.BindBuffer(GL_ARRAY_BUFFER, 0);
+    b.uploaded = b.capacity = b.colorCapacity = 0;
+    b.prepared.clear();
 }
 
 
@@ -404,14 +1452,31 @@ void PointCloudVBO::delBuffers()
 //   Release VBO(s)
 // ----------------------------------------------------------------------------
 {
-    IFTRACE(pointcloud)
-        debug() << "Releasing VBO #" << vbo << "\n";
-    GL.DeleteBuffers(1, &vbo);
-    if (colorVbo)
+    Buffers *sets[2] = { &front, &back };
+    for (int i = 0; i < 2; i++)
+    {
+        GLuint buffers[2] = { sets[i]->vbo, sets[i]->colorVbo };
+        for (int j = 0; j < 2; j++)
+        {
+            if (!buffers[j])
+                continue;
+            IFTRACE(pointcloud)
+                debug() << "Releasing VBO #" << buffers[j] << "\n";
+            GL.DeleteBuffers(1, &buffers[j]);
+        }
+        *sets[i] = Buffers();
+    }
+    if (ibo)
     {
         IFTRACE(pointcloud)
-            debug() << "Releasing VBO #" << colorVbo << "\n";
-        GL.DeleteBuffers(1, &colorVbo);
+            debug() << "Releasing index buffer #" << ibo << "\n";
+        GL.DeleteBuffers(1, &ibo);
+        ibo = iboCount = 0;
+    }
+    if (vao)
+    {
+        glDeleteVertexArrays(1, &vao);
+        vao = vaoVbo = vaoColorVbo = 0;
     }
 }
 
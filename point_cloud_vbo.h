@@ -40,7 +40,12 @@
 // *****************************************************************************
 
 #include "point_cloud.h"
+#include "point_cloud_index.h"
+#include "point_cloud_pack.h"
+#include "point_cloud_view.h"
 #include <QGLContext>
+#include <QList>
+#include <vector>
 
 
 class PointCloudVBO : public PointCloud
@@ -55,10 +60,13 @@ public:
 public:
     virtual unsigned  size();
     virtual bool      addPoint(const Point &p, Color c = Color());
+    virtual bool      addPoints(point_vec &p, color_vec &c);
     virtual void      removePoints(unsigned n);
-    virtual void      draw();
+    virtual bool      prepareDraw();
+    virtual Style     style(bool documentProgram);
+    virtual void      drawStyled(const Style &style);
     virtual bool      optimize();
-    virtual bool      isOptimized() { return optimized; }
+    virtual bool      isOptimized() { return optimized || tree; }
     virtual void      clear();
     virtual bool      randomPoints(unsigned n, bool colored);
     virtual bool      loadData(text file, text sep, int xi, int yi, int zi,
@@ -67,28 +75,156 @@ public:
                                float bi = -1.0, float ai = -1.0,
                                bool async = false);
     virtual bool      colored();
+    virtual bool      save(text file);
+
+protected:
+    typedef PointCloudView::Refinement Refinement;
+
+    // Layout of vertices prepared by the loader, see prepareBatch()
+    enum { NOT_PREPARED, FLOAT_COLORS, BYTE_COLORS };
+
+    struct Prepared
+    {
+        Prepared(unsigned first, const QByteArray &vertices, int format)
+            : first(first), vertices(vertices), format(format) {}
+        static size_t stride(int format)
+        {
+            return sizeof(Point) + (format == BYTE_COLORS
+                                    ? 4 * sizeof(GLubyte) : sizeof(Color));
+        }
+        unsigned   count() const { return vertices.size() / stride(format); }
+        unsigned   first;       // Index of the first point in vertices
+        QByteArray vertices;    // Points and colors interleaved by the loader
+        int        format;      // FLOAT_COLORS or BYTE_COLORS
+    };
+
+    struct Buffers
+    {
+        Buffers()
+            : vbo(0), colorVbo(0), uploaded(0), capacity(0), colorCapacity(0),
+              shortPoints(false), byteColors(false), interleaved(false),
+              loose(false), lo(0, 0, 0), hi(0, 0, 0) {}
+        size_t pointSize() const
+        {
+            return shortPoints ? 3 * sizeof(GLshort) : sizeof(Point);
+        }
+        size_t colorSize() const
+        {
+            return byteColors ? 4 * sizeof(GLubyte) : sizeof(Color);
+        }
+        size_t stride() const
+        {
+            return interleaved ? pointSize() + colorSize() : pointSize();
+        }
+        GLuint   vbo, colorVbo;
+        unsigned uploaded;      // Points already in VBOs, drawn from 0
+        unsigned capacity;      // Points allocated in vbo
+        unsigned colorCapacity; // Colors allocated in colorVbo
+        bool     shortPoints;   // vbo holds GLshort positions within lo..hi
+        bool     byteColors;    // Colors are GLubyte RGBA
+        bool     interleaved;   // vbo holds colors after each position
+        bool     loose;         // lo..hi was enlarged during a load
+        Point    lo, hi;        // Quantization box when shortPoints is set
+        QList<Prepared> prepared; // Vertices from loader not uploaded yet
+    };
+
+protected:
+    // Points converted per BufferSubData call, largest quantized value
+    enum { UPLOAD_SLICE = 65536, QUANTUM = 32767 };
 
 protected:
     void  checkGLContext();
+    bool  unpack();
     bool  useVbo();
     void  updateVbo();
-    void  genPointBuffer();
-    void  genColorBuffer();
+    void  appendVbo(Buffers &b,
+                    const point_vec &points, const color_vec &colors,
+                    size_t &budget);
+    bool  stale(const Buffers &b);
+    bool  fitBox(Buffers &b, const point_vec &points, unsigned first);
+    void  uploadPoints(Buffers &b, const point_vec &points,
+                       unsigned first, unsigned count);
+    void  uploadColors(Buffers &b, const color_vec &colors,
+                       unsigned first, unsigned count);
+    void  uploadVertices(Buffers &b,
+                         const point_vec &points, const color_vec &colors,
+                         unsigned first, unsigned count);
+    int   preparedFormat();
+    bool  growBuffer(unsigned &allocated, size_t itemSize, unsigned count);
+    char *beginWrite(std::vector<char> &data, size_t offset, size_t size);
+    void  endWrite(std::vector<char> &data, char *dst,
+                   size_t offset, size_t size);
+    static void quantization(const Buffers &b, Point &origin, Point &step);
+    static void encodePoints(char *dst, size_t stride,
+                             const point_vec &points,
+                             unsigned first, unsigned count,
+                             bool quantized, Point origin, Point step);
+    static void encodeColors(char *dst, size_t stride,
+                             const color_vec &colors,
+                             unsigned first, unsigned count,
+                             bool bytes);
+    void  readBack(point_vec &points, color_vec &colors);
+    bool  uploadIndex();
+    bool  cull();
+    void  cullNode(unsigned node, unsigned mask);
+    void  refine(unsigned budget);
+    void  addRange(unsigned first, unsigned count);
+    GLfloat nodeError(const PointCloudOctree::Node &node)
+    {
+        return view.error(node.lo, node.hi,
+                          node.children ? node.samples : node.count);
+    }
+    void  drawVisible();
+    bool  useShaders(bool documentProgram);
+    void  drawShaders();
+    void  bindVao();
+    bool  syncVbo();
+    void  genPointBuffer(Buffers &b);
+    void  genColorBuffer(Buffers &b);
+    void  releaseBuffers(Buffers &b);
     void  delBuffers();
-    bool  dontOptimize() { return (noOptimize || loadInProgress()); }
+    bool  dontOptimize()
+    {
+        return (noOptimize || loadInProgress() || indexing);
+    }
+    virtual void prepareBatch(Batch *batch);
+    virtual void batchFetched(Batch *batch, unsigned first, bool back);
+    virtual void dataAppended(unsigned first);
+    virtual void backReset();
+    virtual void dataSwapped();
+    virtual void indexChanged();
 
 
 protected:
     virtual std::ostream &  debug();
 
 protected:
-    GLuint              vbo, colorVbo;
+    Buffers             front;      // VBOs for points and colors
+    Buffers             back;       // VBOs for backPoints and backColors
     bool                dirty;      // Point data modified, VBOs not in sync
     bool                optimized;  // Point data only in VBOs
     bool                noOptimize; // Data would be lost if context changes
+    bool                reoptimize; // Optimize again after a reload
     unsigned            nbPoints;   // When optimized == true
     bool                is_colored; // When optimized == true
+    PointCloudPack      packed;     // Compressed points, when optimized
     const QGLContext *  context;
+    QAtomicInt          prepare;    // Format for prepareBatch(), or 0
+
+    // Culling of octree nodes, see cull()
+    PointCloudView      view;
+    GLuint              ibo;        // Point indices in octree order
+    unsigned            iboCount;   // Indices in ibo, 0 if not uploaded
+    bool                tailVisible; // Points not in the octree are seen
+    bool                culled;     // Only visible nodes are drawn
+    std::vector<GLsizei>        drawCounts;  // Visible ranges of ibo
+    std::vector<const GLvoid *> drawOffsets;
+    std::vector<Refinement>     lodQueue;    // Heap of nodes to refine
+
+    // Vertex array object and the buffers it was set up for, see bindVao()
+    GLuint              vao;
+    GLuint              vaoVbo, vaoColorVbo;
+    int                 vaoLayout;
 
     // To re-create cloud from file
     text  sep;
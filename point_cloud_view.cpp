@@ -0,0 +1,121 @@
+// *****************************************************************************
+// point_cloud_view.cpp                                            Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Frustum and screen-space metrics of the current view of a cloud
+//
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include "point_cloud_view.h"
+#include "point_cloud_factory.h"
+#include "tao/graphic_state.h"
+#include <float.h>
+#include <math.h>
+
+
+void PointCloudView::load(float pointSize)
+// ----------------------------------------------------------------------------
+//   Read the current matrices and viewport
+// ----------------------------------------------------------------------------
+{
+    GLfloat mv[16], proj[16];
+    GL.LoadMatrix();
+    glGetFloatv(GL_MODELVIEW_MATRIX, mv);
+    glGetFloatv(GL_PROJECTION_MATRIX, proj);
+    for (int c = 0; c < 4; c++)
+        for (int r = 0; r < 4; r++)
+            m[4*c+r] = (proj[r]    * mv[4*c]   + proj[4+r]  * mv[4*c+1] +
+                        proj[8+r]  * mv[4*c+2] + proj[12+r] * mv[4*c+3]);
+
+    // Left, right, bottom, top, near, far: row 3 plus or minus rows 0..2
+    for (int p = 0; p < 6; p++)
+    {
+        int row = p / 2;
+        GLfloat sign = (p & 1) ? -1.0f : 1.0f;
+        for (int c = 0; c < 4; c++)
+            planes[p][c] = m[4*c+3] + sign * m[4*c+row];
+    }
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    pixels = sqrtf(m[1]*m[1] + m[5]*m[5] + m[9]*m[9]) * viewport[3] / 2;
+    depth = sqrtf(m[3]*m[3] + m[7]*m[7] + m[11]*m[11]);
+    spacing = pointSize > 0 ? pointSize : 1;
+    spacing *= PointCloudFactory::instance()->tao->DevicePixelRatio();
+}
+
+
+bool PointCloudView::clip(unsigned &mask,
+                          const Point &lo, const Point &hi) const
+// ----------------------------------------------------------------------------
+//   Return false if the box is outside, remove planes it is entirely inside
+// ----------------------------------------------------------------------------
+{
+    for (int p = 0; p < 6; p++)
+    {
+        if (!(mask & (1 << p)))
+            continue;
+        const GLfloat *pl = planes[p];
+
+        // Corner farthest along the plane normal, then the nearest one
+        GLfloat outer = (pl[0] * (pl[0] > 0 ? hi.x : lo.x) +
+                         pl[1] * (pl[1] > 0 ? hi.y : lo.y) +
+                         pl[2] * (pl[2] > 0 ? hi.z : lo.z) + pl[3]);
+        if (outer < 0)
+            return false;
+        GLfloat inner = (pl[0] * (pl[0] > 0 ? lo.x : hi.x) +
+                         pl[1] * (pl[1] > 0 ? lo.y : hi.y) +
+                         pl[2] * (pl[2] > 0 ? lo.z : hi.z) + pl[3]);
+        if (inner >= 0)
+            mask &= ~(1 << p);
+    }
+    return true;
+}
+
+
+GLfloat PointCloudView::error(const Point &lo, const Point &hi,
+                              unsigned count) const
+// ----------------------------------------------------------------------------
+//   Estimated spacing in pixels between count points drawn in a box
+// ----------------------------------------------------------------------------
+//   The box is seen at the depth of its nearest bounding sphere point.
+//   Points are assumed to lie on surfaces, so that their spacing decreases
+//   like the square root of their number.
+{
+    Point c((lo.x + hi.x) / 2, (lo.y + hi.y) / 2, (lo.z + hi.z) / 2);
+    Point d(hi.x - lo.x, hi.y - lo.y, hi.z - lo.z);
+    GLfloat size = sqrtf(d.x * d.x + d.y * d.y + d.z * d.z);
+    GLfloat w = (m[3] * c.x + m[7] * c.y + m[11] * c.z + m[15] -
+                 depth * size / 2);
+    if (w <= FLT_EPSILON)
+        return FLT_MAX;
+    return pixels * size / w / sqrtf(count ? count : 1);
+}
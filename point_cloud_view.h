@@ -0,0 +1,78 @@
+#ifndef POINT_CLOUD_VIEW_H
+#define POINT_CLOUD_VIEW_H
+// *****************************************************************************
+// point_cloud_view.h                                              Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Frustum and screen-space metrics of the current view of a cloud
+//
+//
+//
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include "point_cloud.h"
+
+
+struct PointCloudView
+// ----------------------------------------------------------------------------
+//    Current view of a cloud, used to cull and select levels of detail
+// ----------------------------------------------------------------------------
+//    Frustum planes are extracted from projection * modelview, so that
+//    boxes are tested in cloud coordinates. Plane masks let the children
+//    of a box skip the planes the box is entirely inside.
+{
+    typedef PointCloud::Point   Point;
+
+    enum { ALL_PLANES = 0x3F };
+
+    // Node waiting to be refined, nodes with the largest error go first
+    struct Refinement
+    {
+        Refinement(GLfloat error, unsigned node, unsigned mask)
+            : error(error), node(node), mask(mask) {}
+        bool operator<(const Refinement &o) const { return error < o.error; }
+        GLfloat  error;         // Spacing of drawn points in pixels
+        unsigned node;          // Index of the node
+        unsigned mask;          // Frustum planes the node straddles
+    };
+
+public:
+    void        load(float pointSize);
+    bool        clip(unsigned &mask, const Point &lo, const Point &hi) const;
+    GLfloat     error(const Point &lo, const Point &hi, unsigned count) const;
+
+public:
+    GLfloat     m[16];          // Projection * modelview
+    GLfloat     planes[6][4];   // Left, right, bottom, top, near, far
+    GLfloat     pixels;         // Pixels per unit of the cloud at w = 1
+    GLfloat     depth;          // Largest change of w per unit of the cloud
+    GLfloat     spacing;        // Pixels between points with no visible gap
+};
+
+#endif // POINT_CLOUD_VIEW_H
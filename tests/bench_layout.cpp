@@ -0,0 +1,252 @@
+// *****************************************************************************
+// bench_layout.cpp                                                Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Compare the split and interleaved VBO layouts of PointCloudVBO.
+//
+//    Uploads and draws the same random cloud with positions and colors in
+//    two VBOs, or interleaved in one, with float or quantized short
+//    positions and float or byte colors, as PointCloudVBO does.
+//    Meant for Mesa llvmpipe:
+//        LIBGL_ALWAYS_SOFTWARE=1 GALLIUM_DRIVER=llvmpipe ./bench_layout [points]
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#define GL_GLEXT_PROTOTYPES
+#include <QElapsedTimer>
+#include <QGuiApplication>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+#include <GL/gl.h>
+#include <GL/glext.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+enum { POINTS = 4000000, RUNS = 5, FRAMES = 20 };
+enum { WIDTH = 1024, HEIGHT = 768, QUANTUM = 32767 };
+static size_t count = POINTS;
+
+
+struct Layout
+// ----------------------------------------------------------------------------
+//   One way to store positions and colors in VBOs
+// ----------------------------------------------------------------------------
+{
+    const char *name;
+    bool        interleaved;
+    bool        shortPoints;
+    bool        byteColors;
+    size_t pointSize() const
+    {
+        return 3 * (shortPoints ? sizeof(GLshort) : sizeof(float));
+    }
+    size_t colorSize() const { return byteColors ? 4 : 4 * sizeof(float); }
+    size_t stride() const
+    {
+        return pointSize() + (interleaved ? colorSize() : 0);
+    }
+};
+
+
+static void encode(const Layout &l, const std::vector<float> &xyz,
+                   const std::vector<float> &rgba,
+                   std::vector<char> &vertices, std::vector<char> &colors)
+// ----------------------------------------------------------------------------
+//   Lay out the data as it would be uploaded
+// ----------------------------------------------------------------------------
+{
+    size_t stride = l.stride(), psize = l.pointSize(), csize = l.colorSize();
+    vertices.resize(count * stride);
+    colors.resize(l.interleaved ? 0 : count * csize);
+    for (size_t i = 0; i < count; i++)
+    {
+        char *p = &vertices[i * stride];
+        if (l.shortPoints)
+            for (int k = 0; k < 3; k++)
+                ((GLshort *) p)[k] = GLshort(xyz[3 * i + k] * QUANTUM);
+        else
+            memcpy(p, &xyz[3 * i], 3 * sizeof(float));
+        char *c = l.interleaved
+            ? p + psize
+            : &colors[i * csize];
+        if (l.byteColors)
+            for (int k = 0; k < 4; k++)
+                c[k] = char(rgba[4 * i + k] * 255);
+        else
+            memcpy(c, &rgba[4 * i], 4 * sizeof(float));
+    }
+}
+
+
+static double upload(const Layout &l, GLuint vbo[2],
+                     const std::vector<char> &vertices,
+                     const std::vector<char> &colors)
+// ----------------------------------------------------------------------------
+//   Upload the data, return the time in ms
+// ----------------------------------------------------------------------------
+{
+    QElapsedTimer timer;
+    timer.start();
+    glBindBuffer(GL_ARRAY_BUFFER, vbo[0]);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size(), &vertices[0],
+                 GL_STATIC_DRAW);
+    if (!l.interleaved)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, vbo[1]);
+        glBufferData(GL_ARRAY_BUFFER, colors.size(), &colors[0],
+                     GL_STATIC_DRAW);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glFinish();
+    return timer.nsecsElapsed() / 1e6;
+}
+
+
+static double draw(const Layout &l, GLuint vbo[2])
+// ----------------------------------------------------------------------------
+//   Draw FRAMES frames, return the time per frame in ms
+// ----------------------------------------------------------------------------
+{
+    GLenum type = l.byteColors ? GL_UNSIGNED_BYTE : GL_FLOAT;
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    if (l.interleaved)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, vbo[0]);
+        glColorPointer(4, type, l.stride(), (const void *) l.pointSize());
+    }
+    else
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, vbo[1]);
+        glColorPointer(4, type, l.colorSize(), 0);
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, vbo[0]);
+    glLoadIdentity();
+    if (l.shortPoints)
+    {
+        // Map quantized positions back into the unit cube
+        glScalef(1.0f / QUANTUM, 1.0f / QUANTUM, 1.0f / QUANTUM);
+        glVertexPointer(3, GL_SHORT, l.stride(), 0);
+    }
+    else
+    {
+        glVertexPointer(3, GL_FLOAT, l.stride(), 0);
+    }
+    glFinish();
+
+    QElapsedTimer timer;
+    timer.start();
+    for (int f = 0; f < FRAMES; f++)
+    {
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glDrawArrays(GL_POINTS, 0, count);
+    }
+    glFinish();
+    double ms = timer.nsecsElapsed() / 1e6 / FRAMES;
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    glDisableClientState(GL_COLOR_ARRAY);
+    return ms;
+}
+
+
+int main(int argc, char **argv)
+// ----------------------------------------------------------------------------
+//   Time each layout and print a table
+// ----------------------------------------------------------------------------
+{
+    QGuiApplication app(argc, argv);
+    if (argc > 1)
+        count = strtoul(argv[1], NULL, 10);
+    QSurfaceFormat format;
+    format.setProfile(QSurfaceFormat::CompatibilityProfile);
+    QOpenGLContext context;
+    context.setFormat(format);
+    QOffscreenSurface surface;
+    surface.setFormat(format);
+    surface.create();
+    if (!context.create() || !context.makeCurrent(&surface))
+    {
+        fprintf(stderr, "Cannot create an OpenGL context\n");
+        return 1;
+    }
+    QOpenGLFramebufferObject fbo(WIDTH, HEIGHT,
+                                 QOpenGLFramebufferObject::Depth);
+    fbo.bind();
+    glViewport(0, 0, WIDTH, HEIGHT);
+    glEnable(GL_DEPTH_TEST);
+    printf("Renderer: %s\n", (const char *) glGetString(GL_RENDERER));
+
+    std::vector<float> xyz(3 * count), rgba(4 * count);
+    srand(42);
+    for (size_t i = 0; i < xyz.size(); i++)
+        xyz[i] = 2.0f * rand() / RAND_MAX - 1.0f;
+    for (size_t i = 0; i < rgba.size(); i++)
+        rgba[i] = float(rand()) / RAND_MAX;
+
+    static const Layout layouts[] =
+    {
+        { "split, float/float",         false, false, false },
+        { "interleaved, float/float",   true,  false, false },
+        { "split, float/byte",          false, false, true  },
+        { "interleaved, float/byte",    true,  false, true  },
+        { "split, short/byte",          false, true,  true  },
+        { "interleaved, short/byte",    true,  true,  true  },
+    };
+    printf("%zu points, best of %d runs, %d frames per draw run\n",
+           count, RUNS, FRAMES);
+    printf("%-28s %12s %12s %14s\n",
+           "Layout", "Upload ms", "Frame ms", "Mpoints/s");
+    for (size_t i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++)
+    {
+        const Layout &l = layouts[i];
+        std::vector<char> vertices, colors;
+        encode(l, xyz, rgba, vertices, colors);
+
+        GLuint vbo[2];
+        glGenBuffers(2, vbo);
+        double up = 0, frame = 0;
+        for (int r = 0; r < RUNS; r++)
+        {
+            double u = upload(l, vbo, vertices, colors);
+            double f = draw(l, vbo);
+            if (!r || u < up)
+                up = u;
+            if (!r || f < frame)
+                frame = f;
+        }
+        glDeleteBuffers(2, vbo);
+        printf("%-28s %12.1f %12.1f %14.1f\n",
+               l.name, up, frame, count / frame / 1000.0);
+        fflush(stdout);
+    }
+    fbo.release();
+    return 0;
+}
@@ -0,0 +1,38 @@
+# ******************************************************************************
+# bench_layout.pro                                                 Tao3D project
+# ******************************************************************************
+#
+# File description:
+# Benchmark of split and interleaved VBO layouts
+#
+#
+#
+#
+#
+#
+# ******************************************************************************
+# This software is licensed under the GNU General Public License v3
+# ******************************************************************************
+# This file is part of Tao3D
+#
+# Tao3D is free software: you can r redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Tao3D is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with Tao3D, in a file named COPYING.
+# If not, see <https://www.gnu.org/licenses/>.
+# ******************************************************************************
+
+
+include(tests.pri)
+
+QT      += gui opengl
+TARGET   = bench_layout
+SOURCES  = bench_layout.cpp
@@ -0,0 +1,248 @@
+// *****************************************************************************
+// bench_load.cpp                                                  Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Time text cloud loads before and after pre-sizing from sampled lines
+//
+//    Loads the same temporary file three ways: the former per-line loop,
+//    then the block parser of loadFromStream without and with the size
+//    estimated by PointCloudParser::estimateLines.
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include "point_cloud_parser.h"
+#include <QElapsedTimer>
+#include <QFile>
+#include <QString>
+#include <QStringList>
+#include <QTemporaryFile>
+#include <QTextStream>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+typedef PointCloud::LoadDataParm        LoadDataParm;
+typedef PointCloud::Point               Point;
+typedef PointCloud::Color               Color;
+typedef PointCloud::point_vec           point_vec;
+typedef PointCloud::color_vec           color_vec;
+
+enum { LINES = 2000000, RUNS = 5, BLOCK_SIZE = 1 << 20 };
+
+
+struct FormerCloud
+// ----------------------------------------------------------------------------
+//   Storage and per-point bookkeeping of the former loader
+// ----------------------------------------------------------------------------
+{
+    FormerCloud(): loaded(0.0) {}
+    virtual ~FormerCloud() {}
+    virtual bool loadInProgress() { return loaded >= 0 && loaded < 1.0; }
+    virtual bool colored() { return colors.size() != 0; }
+    virtual unsigned size()
+    {
+        if (loadInProgress())
+            return 0;
+        if (colored() && points.size() != colors.size())
+            fprintf(stderr, "Points and colors differ in size\n");
+        return points.size();
+    }
+
+    std::vector<Point>  points;
+    std::vector<Color>  colors;
+    double              loaded;
+};
+
+
+static size_t formerLoad(QFile &file, const LoadDataParm &parm)
+// ----------------------------------------------------------------------------
+//   The former loadFromStream: QTextStream, split, toFloat, no reserve
+// ----------------------------------------------------------------------------
+{
+    FormerCloud cloud;
+    QTextStream t(&file);
+    QString line;
+    QString separator = QString::fromStdString(parm.sep);
+    double sz = file.bytesAvailable();
+    double pos = 0.0;
+    do
+    {
+        line = t.readLine();
+        pos += line.size() + 1;
+        if (sz)
+            cloud.loaded = pos / sz;
+        QStringList values = line.split(separator);
+        if (values.size() < 6)
+            continue;
+        bool xok, yok, zok, rok, gok, bok;
+        float x = values[parm.xi-1].toFloat(&xok);
+        float y = values[parm.yi-1].toFloat(&yok);
+        float z = values[parm.zi-1].toFloat(&zok);
+        float r = values[int(parm.ri)-1].toFloat(&rok) * parm.colorScale;
+        float g = values[int(parm.gi)-1].toFloat(&gok) * parm.colorScale;
+        float b = values[int(parm.bi)-1].toFloat(&bok) * parm.colorScale;
+        cloud.size();
+        if (xok && yok && zok && rok && gok && bok)
+        {
+            cloud.colors.push_back(Color(r, g, b, -parm.ai));
+            cloud.points.push_back(Point(x, y, z));
+        }
+        cloud.size();
+    }
+    while (!line.isNull());
+    return cloud.points.size();
+}
+
+
+static size_t blockLoad(QFile &file, const LoadDataParm &parm, bool estimate,
+                        size_t &expected)
+// ----------------------------------------------------------------------------
+//   The current loadFromStream, with batches appended as fetchBatches does
+// ----------------------------------------------------------------------------
+{
+    PointCloudParser parser(parm);
+    point_vec points, batchPoints;
+    color_vec colors, batchColors;
+    QByteArray buffer;
+    int kept = 0;
+    double sz = file.bytesAvailable();
+    bool first = true;
+    expected = 0;
+    for (;;)
+    {
+        buffer.resize(kept + BLOCK_SIZE);
+        qint64 n = file.read(buffer.data() + kept, BLOCK_SIZE);
+        bool atEnd = n <= 0;
+        if (n < 0)
+            n = 0;
+
+        const char *begin = buffer.constData();
+        const char *end = begin + kept + n;
+        const char *stop = atEnd ? end : PointCloudParser::lastLine(begin, end);
+        if (first && estimate)
+        {
+            expected = PointCloudParser::estimateLines(begin, stop, sz);
+            points.reserve(expected);
+            colors.reserve(expected);
+        }
+        first = false;
+        const char *done = parser.parse(begin, stop,
+                                        batchPoints, batchColors);
+        kept = end - done;
+        memmove(buffer.data(), done, kept);
+
+        // Hand the batch over, as publish() and fetchBatches() do
+        points.append(batchPoints);
+        colors.append(batchColors);
+        point_vec().swap(batchPoints);
+        color_vec().swap(batchColors);
+        if (atEnd)
+            break;
+    }
+    return points.size();
+}
+
+
+static void writeExport(QFile &file, unsigned lines)
+// ----------------------------------------------------------------------------
+//   Write lines like those of our scanner exports
+// ----------------------------------------------------------------------------
+{
+    unsigned seed = 42;
+    char line[128];
+    for (unsigned i = 0; i < lines; i++)
+    {
+        float c[3];
+        unsigned rgb[3];
+        for (int k = 0; k < 3; k++)
+        {
+            seed = seed * 1103515245 + 12345;
+            c[k] = ((seed >> 8) % 2000000) / 1000.0f - 1000.0f;
+            seed = seed * 1103515245 + 12345;
+            rgb[k] = (seed >> 16) % 256;
+        }
+        int n = snprintf(line, sizeof(line), "%.6f %.6f %.6f %u %u %u\n",
+                         c[0], c[1], c[2], rgb[0], rgb[1], rgb[2]);
+        file.write(line, n);
+    }
+    file.flush();
+}
+
+
+int main()
+// ----------------------------------------------------------------------------
+//   Time each way of loading the same file and print the results
+// ----------------------------------------------------------------------------
+{
+    QTemporaryFile file;
+    if (!file.open())
+    {
+        fprintf(stderr, "Cannot create a temporary file\n");
+        return 1;
+    }
+    writeExport(file, LINES);
+    double mb = file.size() / 1048576.0;
+    LoadDataParm parm("", " ", 1, 2, 3, 1.0 / 255, 4, 5, 6, -1.0);
+
+    static const char *names[3] =
+    {
+        "Former loop",
+        "Parser, no estimate",
+        "Parser, estimate",
+    };
+    qint64 best[3] = { 0, 0, 0 };
+    size_t expected = 0;
+    for (int run = 0; run < RUNS; run++)
+    {
+        for (int way = 0; way < 3; way++)
+        {
+            file.seek(0);
+            QElapsedTimer timer;
+            timer.start();
+            size_t count = way == 0
+                ? formerLoad(file, parm)
+                : blockLoad(file, parm, way == 2, expected);
+            qint64 elapsed = timer.nsecsElapsed();
+            if (count != LINES)
+            {
+                fprintf(stderr, "%s loaded %zu points instead of %u\n",
+                        names[way], count, (unsigned) LINES);
+                return 1;
+            }
+            if (!run || elapsed < best[way])
+                best[way] = elapsed;
+        }
+    }
+
+    printf("%u lines, %.1f MB, best of %d runs, %zu points expected\n",
+           (unsigned) LINES, mb, RUNS, expected);
+    for (int way = 0; way < 3; way++)
+        printf("%-22s %8.1f ms  %7.1f MB/s  %6.1f ns/line  %5.1fx\n",
+               names[way], best[way] / 1e6, mb / (best[way] / 1e9),
+               double(best[way]) / LINES, double(best[0]) / best[way]);
+    return 0;
+}
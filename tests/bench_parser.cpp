@@ -0,0 +1,180 @@
+// *****************************************************************************
+// bench_parser.cpp                                                Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Compare PointCloudParser with the former QString::toFloat loader.
+//
+//    Both parse the same generated scanner export (decimal X Y Z, integer
+//    R G B from 0 to 255). The parsed values are checked to be identical,
+//    then the best of several runs is printed for each path.
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include "point_cloud_parser.h"
+#include <QElapsedTimer>
+#include <QString>
+#include <QStringList>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+typedef PointCloud::LoadDataParm        LoadDataParm;
+typedef PointCloud::Point               Point;
+typedef PointCloud::Color               Color;
+typedef PointCloud::point_vec           point_vec;
+typedef PointCloud::color_vec           color_vec;
+
+enum { LINES = 1000000, RUNS = 5 };
+
+
+static std::string scannerExport(unsigned lines)
+// ----------------------------------------------------------------------------
+//   Generate lines like those of our scanner exports
+// ----------------------------------------------------------------------------
+{
+    std::string data;
+    data.reserve(lines * 48);
+    unsigned seed = 42;
+    char line[128];
+    for (unsigned i = 0; i < lines; i++)
+    {
+        float c[3];
+        unsigned rgb[3];
+        for (int k = 0; k < 3; k++)
+        {
+            seed = seed * 1103515245 + 12345;
+            c[k] = ((seed >> 8) % 2000000) / 1000.0f - 1000.0f;
+            seed = seed * 1103515245 + 12345;
+            rgb[k] = (seed >> 16) % 256;
+        }
+        snprintf(line, sizeof(line), "%.6f %.6f %.6f %u %u %u\n",
+                 c[0], c[1], c[2], rgb[0], rgb[1], rgb[2]);
+        data += line;
+    }
+    return data;
+}
+
+
+static void qstringParse(const std::string &data, const LoadDataParm &parm,
+                         point_vec &points, color_vec &colors)
+// ----------------------------------------------------------------------------
+//   The former loader: split each line, then QString::toFloat per field
+// ----------------------------------------------------------------------------
+{
+    QString separator = QString::fromStdString(parm.sep);
+    const char *p = data.data(), *end = p + data.size();
+    while (p < end)
+    {
+        const char *eol = (const char *) memchr(p, '\n', end - p);
+        if (!eol)
+            eol = end;
+        QString line = QString::fromLatin1(p, eol - p);
+        p = eol + 1;
+
+        QStringList values = line.split(separator);
+        if (values.size() < 6)
+            continue;
+        bool xok, yok, zok, rok, gok, bok;
+        float x = values[parm.xi-1].toFloat(&xok);
+        float y = values[parm.yi-1].toFloat(&yok);
+        float z = values[parm.zi-1].toFloat(&zok);
+        float r = values[int(parm.ri)-1].toFloat(&rok) * parm.colorScale;
+        float g = values[int(parm.gi)-1].toFloat(&gok) * parm.colorScale;
+        float b = values[int(parm.bi)-1].toFloat(&bok) * parm.colorScale;
+        if (xok && yok && zok && rok && gok && bok)
+        {
+            points.push_back(Point(x, y, z));
+            colors.push_back(Color(r, g, b, -parm.ai));
+        }
+    }
+}
+
+
+static bool same(const point_vec &p1, const color_vec &c1,
+                 const point_vec &p2, const color_vec &c2)
+// ----------------------------------------------------------------------------
+//   Check that two loads gave bitwise identical points and colors
+// ----------------------------------------------------------------------------
+{
+    if (p1.size() != p2.size() || c1.size() != c2.size())
+        return false;
+    for (size_t i = 0; i < p1.size(); i++)
+        if (memcmp(&p1[i], &p2[i], sizeof(Point)))
+            return false;
+    for (size_t i = 0; i < c1.size(); i++)
+        if (memcmp(&c1[i], &c2[i], sizeof(Color)))
+            return false;
+    return true;
+}
+
+
+int main()
+// ----------------------------------------------------------------------------
+//   Time both paths on the same data and print the results
+// ----------------------------------------------------------------------------
+{
+    std::string data = scannerExport(LINES);
+    LoadDataParm parm("", " ", 1, 2, 3, 1.0 / 255, 4, 5, 6, -1.0);
+    const char *begin = data.data(), *end = begin + data.size();
+
+    qint64 best[2] = { 0, 0 };
+    for (int run = 0; run < RUNS; run++)
+    {
+        point_vec p1, p2;
+        color_vec c1, c2;
+        QElapsedTimer timer;
+
+        timer.start();
+        qstringParse(data, parm, p1, c1);
+        qint64 reference = timer.nsecsElapsed();
+
+        timer.start();
+        PointCloudParser parser(parm);
+        parser.parse(begin, end, p2, c2);
+        qint64 parsed = timer.nsecsElapsed();
+
+        if (p2.size() != LINES || !same(p1, c1, p2, c2))
+        {
+            fprintf(stderr, "Parsed values differ from QString::toFloat\n");
+            return 1;
+        }
+        if (!run || reference < best[0])
+            best[0] = reference;
+        if (!run || parsed < best[1])
+            best[1] = parsed;
+    }
+
+    double mb = data.size() / 1048576.0;
+    printf("%u lines, %.1f MB, best of %d runs\n", LINES, mb, RUNS);
+    printf("QString::toFloat   %8.1f ms  %7.1f MB/s  %6.1f ns/line\n",
+           best[0] / 1e6, mb / (best[0] / 1e9), double(best[0]) / LINES);
+    printf("PointCloudParser   %8.1f ms  %7.1f MB/s  %6.1f ns/line\n",
+           best[1] / 1e6, mb / (best[1] / 1e9), double(best[1]) / LINES);
+    printf("Speedup            %8.1fx\n", double(best[0]) / best[1]);
+    return 0;
+}
@@ -0,0 +1,258 @@
+// *****************************************************************************
+// test_batches.cpp                                                Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Stress the handoff of loaded points between loader threads and draw.
+//
+//    The main thread starts loads, reloads, interrupts and appends to the
+//    files of a cloud at random, while reading it as draw() does. Points must
+//    always come from a single file, with colors matching them. Once the
+//    loads settle, the cloud must hold exactly the points of its file.
+//    Build with CONFIG+=tsan to check the handoff with ThreadSanitizer.
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include "point_cloud.h"
+#include "point_cloud_factory.h"
+#include "test_check.h"
+#include <QCoreApplication>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QThread>
+#include <stdio.h>
+#include <string.h>
+
+typedef PointCloud::Point               Point;
+typedef PointCloud::Color               Color;
+typedef PointCloud::point_vec           point_vec;
+typedef PointCloud::color_vec           color_vec;
+
+enum
+{
+    LINES       = 200000,       // Initial lines of each file
+    APPENDED    = 1000,         // Lines appended at once
+    ITERATIONS  = 3000,         // Random operations
+    SAMPLES     = 64,           // Points checked after each operation
+    TIMEOUT     = 60000         // ms to wait for the last load
+};
+
+static const float colorScale = 1.0f / 255;
+
+struct StressCloud : PointCloud
+// ----------------------------------------------------------------------------
+//   Expose what the module uses internally
+// ----------------------------------------------------------------------------
+{
+    StressCloud() : PointCloud("stress") {}
+    using PointCloud::reload;
+    using PointCloud::fetchBatches;
+    using PointCloud::loadInProgress;
+    const point_vec &   drawnPoints()   { return points; }
+    const color_vec &   drawnColors()   { return colors; }
+    text                currentFile()   { return file; }
+};
+
+
+static void *newFileMonitor(void (*)(std::string, std::string, void *),
+                            void (*)(std::string, std::string, void *),
+                            void (*)(std::string, std::string, void *),
+                            void *, std::string)
+// ----------------------------------------------------------------------------
+//   Files are reloaded explicitly by the test, not by a monitor
+// ----------------------------------------------------------------------------
+{
+    static int monitor;
+    return &monitor;
+}
+static void fileMonitorAddPath(void *, std::string) {}
+static void fileMonitorRemoveAllPaths(void *) {}
+static void deleteFileMonitor(void *) {}
+
+
+static void appendLines(text path, unsigned first, unsigned count, int marker)
+// ----------------------------------------------------------------------------
+//   Lines "i marker 0 r g b", so that each point tells where it comes from
+// ----------------------------------------------------------------------------
+{
+    QFile f(QString::fromStdString(path));
+    f.open(QIODevice::WriteOnly | QIODevice::Append);
+    QByteArray data;
+    char line[64];
+    for (unsigned i = first; i < first + count; i++)
+    {
+        snprintf(line, sizeof(line), "%u %d 0 %u %u %u\n",
+                 i, marker, i % 256, (i / 256) % 256, (i * 7) % 256);
+        data.append(line, strlen(line));
+    }
+    f.write(data);
+}
+
+
+static bool pointOk(const Point &p, const Color &c, unsigned i, int marker)
+// ----------------------------------------------------------------------------
+//   Check that point i is the one written for it in a file
+// ----------------------------------------------------------------------------
+{
+    return (p.x == float(i) && p.y == float(marker) && p.z == 0.0f &&
+            c.r == float(i % 256) * colorScale &&
+            c.g == float((i / 256) % 256) * colorScale &&
+            c.b == float((i * 7) % 256) * colorScale);
+}
+
+
+static void checkCloud(StressCloud &cloud, unsigned &seed)
+// ----------------------------------------------------------------------------
+//   What draw() sees is consistent, whatever the loads in progress
+// ----------------------------------------------------------------------------
+{
+    unsigned n = cloud.size();
+    bool colored = cloud.colored();
+    const point_vec &points = cloud.drawnPoints();
+    const color_vec &colors = cloud.drawnColors();
+    CHECK(points.size() == n);
+    if (!n)
+        return;
+    CHECK(colored && colors.size() == n);
+    if (!colored || colors.size() != n)
+        return;
+
+    // All points come from the same file, the one with the marker of point 0
+    int marker = int(points[0].y);
+    CHECK(marker == 1 || marker == 2);
+    for (unsigned s = 0; s < SAMPLES; s++)
+    {
+        seed = seed * 1103515245 + 12345;
+        unsigned i = s == 0 ? n - 1 : (seed >> 8) % n;
+        if (!pointOk(points[i], colors[i], i, marker))
+        {
+            CHECK(!"Point mixed from another file or load");
+            return;
+        }
+    }
+}
+
+
+int main(int argc, char **argv)
+// ----------------------------------------------------------------------------
+//   Hammer one cloud with random operations, then check its final state
+// ----------------------------------------------------------------------------
+{
+    QCoreApplication app(argc, argv);
+    TestFactory factory;
+    factory.api.newFileMonitor = newFileMonitor;
+    factory.api.fileMonitorAddPath = fileMonitorAddPath;
+    factory.api.fileMonitorRemoveAllPaths = fileMonitorRemoveAllPaths;
+    factory.api.deleteFileMonitor = deleteFileMonitor;
+    factory.start();
+
+    QDir dir(QDir::tempPath());
+    text files[2];
+    unsigned lines[2];
+    for (int f = 0; f < 2; f++)
+    {
+        QString name = QString("test_batches_%1_%2.txt")
+            .arg(QCoreApplication::applicationPid()).arg(f + 1);
+        files[f] = +dir.absoluteFilePath(name);
+        QFile::remove(+files[f]);
+        lines[f] = LINES * (f + 1);
+        appendLines(files[f], 0, lines[f], f + 1);
+    }
+
+    {
+        StressCloud cloud;
+        cloud.folder = +dir.absolutePath();
+        unsigned seed = 1;
+        int current = 0;
+        cloud.loadData(files[current], " ", 1, 2, 3, colorScale,
+                       4, 5, 6, -1.0, true);
+
+        for (int i = 0; i < ITERATIONS; i++)
+        {
+            seed = seed * 1103515245 + 12345;
+            switch ((seed >> 16) % 6)
+            {
+            case 0:
+                // Switch to the other file
+                current = 1 - current;
+                cloud.loadData(files[current], " ", 1, 2, 3, colorScale,
+                               4, 5, 6, -1.0, true);
+                break;
+            case 1:
+                cloud.reload();
+                break;
+            case 2:
+                cloud.interrupt();
+                break;
+            case 3:
+                // Lines added to a file, loaded by the next reload
+                appendLines(files[current], lines[current], APPENDED,
+                            current + 1);
+                lines[current] += APPENDED;
+                break;
+            default:
+                // Let loaders run for a while
+                QThread::usleep((seed >> 4) % 2000);
+                break;
+            }
+            checkCloud(cloud, seed);
+        }
+
+        // Reload completely, then wait for the load to be fetched
+        cloud.interrupt();
+        cloud.loaded = 0.0;
+        cloud.reload();
+        QElapsedTimer timer;
+        timer.start();
+        bool fetched = false;
+        do
+        {
+            fetched = cloud.fetchBatches();
+            if (!fetched)
+                QThread::usleep(1000);
+        } while ((cloud.loaded < 1.0 || fetched) && timer.elapsed() < TIMEOUT);
+        CHECK(cloud.loaded == 1.0f);
+
+        CHECK(cloud.currentFile() == files[current]);
+        CHECK(cloud.size() == lines[current]);
+        const point_vec &points = cloud.drawnPoints();
+        const color_vec &colors = cloud.drawnColors();
+        CHECK(colors.size() == points.size());
+        for (unsigned i = 0; i < points.size() && i < colors.size(); i++)
+        {
+            if (!pointOk(points[i], colors[i], i, current + 1))
+            {
+                CHECK(!"Final points differ from the file");
+                break;
+            }
+        }
+    }
+
+    factory.stop();
+    for (int f = 0; f < 2; f++)
+        QFile::remove(+files[f]);
+
+    return testResult("batch handoff");
+}
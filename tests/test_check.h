@@ -0,0 +1,90 @@
+#ifndef TEST_CHECK_H
+#define TEST_CHECK_H
+// *****************************************************************************
+// test_check.h                                                    Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Checks shared by the point cloud tests
+//
+//    Tests count failed checks instead of stopping at the first one, then
+//    report them from main() with testResult().
+//
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+
+#include "point_cloud_factory.h"
+#include <stdio.h>
+#include <string.h>
+
+static int failures = 0;
+#define CHECK(cond)                                                     \
+    do { if (!(cond)) {                                                 \
+        fprintf(stderr, "%s:%d: check failed: %s\n",                    \
+                __FILE__, __LINE__, #cond);                             \
+        failures++; } } while (0)
+
+
+struct TestFactory
+// ----------------------------------------------------------------------------
+//   The module factory, with an API that tests fill only as they need
+// ----------------------------------------------------------------------------
+{
+    TestFactory()
+    {
+        memset(&api, 0, sizeof(api));
+    }
+    PointCloudFactory *start()
+    {
+        return PointCloudFactory::instance(&api);
+    }
+    void stop()
+    {
+        PointCloudFactory *fact = PointCloudFactory::instance();
+        fact->downloads.stopAll();
+        fact->pool.stopAll();
+        fact->indexes.stopAll();
+        fact->workers.stopAll();
+    }
+
+    Tao::ModuleApi api;
+};
+
+
+static inline int testResult(const char *name)
+// ----------------------------------------------------------------------------
+//   Report the failed checks, return the exit status of the test
+// ----------------------------------------------------------------------------
+{
+    if (failures)
+        fprintf(stderr, "%d check(s) failed\n", failures);
+    else
+        printf("All %s tests passed\n", name);
+    return failures != 0;
+}
+
+#endif // TEST_CHECK_H
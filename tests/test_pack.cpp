@@ -0,0 +1,252 @@
+// *****************************************************************************
+// test_pack.cpp                                                   Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Check that packed clouds are restored exactly
+//
+//    Packs and unpacks random values, including NaNs, infinities and
+//    denormals, with clouds ending on partial blocks, colored or not, and
+//    checks that every bit comes back. Also stops packs in progress.
+//
+//
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include "point_cloud_pack.h"
+#include "point_cloud_factory.h"
+#include "test_check.h"
+#include <QCoreApplication>
+#include <limits>
+#include <stdio.h>
+#include <string.h>
+
+typedef PointCloud::Point               Point;
+typedef PointCloud::Color               Color;
+typedef PointCloud::point_vec           point_vec;
+typedef PointCloud::color_vec           color_vec;
+
+enum { BLOCK = point_vec::BLOCK };
+
+
+struct TestPack : PointCloudPack
+// ----------------------------------------------------------------------------
+//   Expose the packed blocks, to corrupt them
+// ----------------------------------------------------------------------------
+{
+    void corrupt(size_t b) { pointBlocks[b] = QByteArray("corrupt"); }
+};
+
+
+static float randomFloat(unsigned &seed, int kind)
+// ----------------------------------------------------------------------------
+//   Random bits, or coordinates of nearby points, or special values
+// ----------------------------------------------------------------------------
+{
+    seed = seed * 1103515245 + 12345;
+    quint32 bits = seed;
+    seed = seed * 1103515245 + 12345;
+    bits ^= seed >> 16;
+    float value;
+    switch (kind % 8)
+    {
+    case 0:                                     // Any bits: NaNs, denormals
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    case 1:                                     // NaN with a payload
+        bits = 0x7fc00000 | (bits & 0x003fffff) | (bits & 0x80000000);
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    case 2:
+        value = std::numeric_limits<float>::infinity();
+        return (bits & 1) ? value : -value;
+    case 3:
+        return (bits & 1) ? 0.0f : -0.0f;
+    default:                                    // Scanned coordinates
+        return (bits % 2000000) / 1000.0f - 1000.0f;
+    }
+}
+
+
+static void randomCloud(unsigned n, bool colored, unsigned seed,
+                        point_vec &points, color_vec &colors)
+// ----------------------------------------------------------------------------
+//   Fill a cloud with n random points
+// ----------------------------------------------------------------------------
+{
+    points.clear();
+    colors.clear();
+    for (unsigned i = 0; i < n; i++)
+    {
+        int kind = seed % 13;
+        float x = randomFloat(seed, kind);
+        float y = randomFloat(seed, kind);
+        float z = randomFloat(seed, kind);
+        points.push_back(Point(x, y, z));
+        if (colored)
+        {
+            float r = randomFloat(seed, kind + 1);
+            float g = randomFloat(seed, kind + 2);
+            float b = randomFloat(seed, kind + 3);
+            float a = randomFloat(seed, kind + 4);
+            colors.push_back(Color(r, g, b, a));
+        }
+    }
+}
+
+
+static bool same(const point_vec &p1, const color_vec &c1,
+                 const point_vec &p2, const color_vec &c2)
+// ----------------------------------------------------------------------------
+//   Check that two clouds are bitwise identical
+// ----------------------------------------------------------------------------
+{
+    if (p1.size() != p2.size() || c1.size() != c2.size())
+        return false;
+    for (size_t i = 0; i < p1.size(); i++)
+        if (memcmp(&p1[i], &p2[i], sizeof(Point)))
+            return false;
+    for (size_t i = 0; i < c1.size(); i++)
+        if (memcmp(&c1[i], &c2[i], sizeof(Color)))
+            return false;
+    return true;
+}
+
+
+static void testEncode()
+// ----------------------------------------------------------------------------
+//   Values come back bit for bit, whatever their count and stride
+// ----------------------------------------------------------------------------
+{
+    static const size_t counts[] = { 0, 1, 2, 3, 4, 5, 7, 1000, 12345 };
+    unsigned seed = 1;
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+    {
+        for (size_t stride = 1; stride <= 4; stride++)
+        {
+            size_t n = counts[c];
+            std::vector<float> values(n + 1), decoded(n + 1, 42.0f);
+            for (size_t i = 0; i < n; i++)
+                values[i] = randomFloat(seed, i);
+            QByteArray data = PointCloudPack::encode(&values[0], n, stride);
+            CHECK(PointCloudPack::decode(data, &decoded[0], n, stride));
+            CHECK(!memcmp(&values[0], &decoded[0], n * sizeof(float)));
+            CHECK(decoded[n] == 42.0f);
+            if (n)
+                CHECK(!PointCloudPack::decode(data, &decoded[0], n-1, stride));
+        }
+    }
+    float value;
+    CHECK(!PointCloudPack::decode(QByteArray("corrupt"), &value, 1, 1));
+}
+
+
+static void testPack()
+// ----------------------------------------------------------------------------
+//   Clouds come back bit for bit, including partial first and last blocks
+// ----------------------------------------------------------------------------
+{
+    static const unsigned counts[] =
+    {
+        0, 1, 255, 256, 257, BLOCK - 1, BLOCK, BLOCK + 1, 3 * BLOCK + 123
+    };
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+    {
+        for (int colored = 0; colored < 2; colored++)
+        {
+            unsigned n = counts[c];
+            point_vec points, source, unpacked;
+            color_vec colors, sourceColors, unpackedColors;
+            randomCloud(n, colored, 7 * c + colored, points, colors);
+            source = points;
+            sourceColors = colors;
+
+            PointCloudPack pack;
+            pack.start(source, sourceColors);
+            CHECK(source.empty() && sourceColors.empty());
+            CHECK(pack.size() == n);
+            CHECK(pack.unpack(unpacked, unpackedColors));
+            CHECK(same(points, colors, unpacked, unpackedColors));
+            CHECK(!pack.packing());
+
+            // Unpacking again gives the same result
+            CHECK(pack.unpack(unpacked, unpackedColors));
+            CHECK(same(points, colors, unpacked, unpackedColors));
+        }
+    }
+}
+
+
+static void testStop()
+// ----------------------------------------------------------------------------
+//   Packs in progress can be dropped or replaced, corrupt ones are detected
+// ----------------------------------------------------------------------------
+{
+    point_vec points, source, unpacked;
+    color_vec colors, sourceColors, unpackedColors;
+    randomCloud(16 * BLOCK + 5, true, 99, points, colors);
+
+    TestPack pack;
+    for (int i = 0; i <= 20; i++)
+    {
+        source = points;
+        sourceColors = colors;
+        pack.start(source, sourceColors);
+        if (i % 2)
+            pack.clear();
+    }
+    CHECK(pack.size() == points.size());
+    pack.wait();
+    CHECK(!pack.packing());
+    CHECK(pack.bytes() > 0);
+    CHECK(pack.unpack(unpacked, unpackedColors));
+    CHECK(same(points, colors, unpacked, unpackedColors));
+
+    pack.corrupt(3);
+    CHECK(!pack.unpack(unpacked, unpackedColors));
+    CHECK(unpacked.empty() && unpackedColors.empty());
+
+    pack.clear();
+    CHECK(pack.size() == 0);
+    CHECK(pack.unpack(unpacked, unpackedColors));
+    CHECK(unpacked.empty() && unpackedColors.empty());
+}
+
+
+int main(int argc, char **argv)
+// ----------------------------------------------------------------------------
+//   Run all the tests
+// ----------------------------------------------------------------------------
+{
+    QCoreApplication app(argc, argv);
+    TestFactory factory;
+    factory.start();
+
+    testEncode();
+    testPack();
+    testStop();
+
+    factory.stop();
+    return testResult("pack");
+}
@@ -0,0 +1,46 @@
+# ******************************************************************************
+# test_pack.pro                                                    Tao3D project
+# ******************************************************************************
+#
+# File description:
+# Round-trip test of packed clouds
+#
+#
+#
+#
+#
+#
+# ******************************************************************************
+# This software is licensed under the GNU General Public License v3
+# ******************************************************************************
+# This file is part of Tao3D
+#
+# Tao3D is free software: you can r redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Tao3D is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with Tao3D, in a file named COPYING.
+# If not, see <https://www.gnu.org/licenses/>.
+# ******************************************************************************
+
+
+include(tests.pri)
+
+QT      += network opengl
+TARGET   = test_pack
+SOURCES  = test_pack.cpp \
+           $$MODSRC/point_cloud.cpp $$MODSRC/point_cloud_vbo.cpp \
+           $$MODSRC/point_cloud_factory.cpp $$MODSRC/point_cloud_file.cpp \
+           $$MODSRC/point_cloud_las.cpp $$MODSRC/point_cloud_parser.cpp \
+           $$MODSRC/point_cloud_ply.cpp $$MODSRC/point_cloud_stream.cpp \
+           $$MODSRC/point_cloud_index.cpp $$MODSRC/point_cloud_view.cpp \
+           $$MODSRC/point_cloud_tree.cpp $$MODSRC/point_cloud_shader.cpp \
+           $$MODSRC/point_cloud_pack.cpp
+HEADERS += $$MODSRC/point_cloud_stream.h
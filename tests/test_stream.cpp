@@ -0,0 +1,298 @@
+// *****************************************************************************
+// test_stream.cpp                                                 Tao3D project
+// *****************************************************************************
+//
+// File description:
+//
+//    Download a cloud from a local throttled HTTP server.
+//
+//    A QTcpServer stands in for a web server, sending a generated text
+//    cloud in small slices. A loader in a pool thread reads it through
+//    PointCloudStream and parses it as PointCloud::loadFromStream does.
+//    The test checks that parsing started before the download ended, that
+//    the points match the file, and that interrupting a download returns.
+//
+//
+// *****************************************************************************
+// This software is licensed under the GNU General Public License v3
+// *****************************************************************************
+// This file is part of Tao3D
+//
+// Tao3D is free software: you can r redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// Tao3D is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with Tao3D, in a file named COPYING.
+// If not, see <https://www.gnu.org/licenses/>.
+// *****************************************************************************
+
+
+#include "point_cloud_parser.h"
+#include "point_cloud_stream.h"
+#include "test_check.h"
+#include "thread_pool.h"
+#include <QAtomicInt>
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include <QThread>
+#include <QTimer>
+#include <QUrl>
+#include <stdio.h>
+#include <string.h>
+
+typedef PointCloud::LoadDataParm        LoadDataParm;
+typedef PointCloud::point_vec           point_vec;
+typedef PointCloud::color_vec           color_vec;
+
+// About 2 MB sent at 64 KB every 10 ms, so the download takes ~0.3 s
+enum { LINES = 50000, SLICE = 65536, PERIOD = 10, TIMEOUT = 30000 };
+
+
+static QByteArray fixture()
+// ----------------------------------------------------------------------------
+//   A colored text cloud, as served to the loader
+// ----------------------------------------------------------------------------
+{
+    QByteArray data;
+    char line[96];
+    for (int i = 0; i < LINES; i++)
+    {
+        snprintf(line, sizeof(line), "%d.25 %d.5 -%d.125 %d %d %d\n",
+                 i, i % 977, i % 313, i % 256, (i * 7) % 256, (i * 13) % 256);
+        data.append(line, strlen(line));
+    }
+    return data;
+}
+
+
+class ThrottledServer : public QObject
+// ----------------------------------------------------------------------------
+//   Serve one body over HTTP/1.0, a slice at a time
+// ----------------------------------------------------------------------------
+{
+    Q_OBJECT
+
+public:
+    ThrottledServer(const QByteArray &body) : body(body), socket(NULL), sent(0)
+    {
+        connect(&server, SIGNAL(newConnection()), this, SLOT(accept()));
+        connect(&timer, SIGNAL(timeout()), this, SLOT(send()));
+        server.listen(QHostAddress::LocalHost);
+    }
+    QUrl url()
+    {
+        return QUrl(QString("http://127.0.0.1:%1/cloud.txt")
+                    .arg(server.serverPort()));
+    }
+
+public slots:
+    void accept()
+    {
+        socket = server.nextPendingConnection();
+        socket->write(QString("HTTP/1.0 200 OK\r\n"
+                              "Content-Type: text/plain\r\n"
+                              "Content-Length: %1\r\n\r\n")
+                      .arg(body.size()).toLatin1());
+        timer.start(PERIOD);
+    }
+    void send()
+    {
+        int n = qMin(int(SLICE), body.size() - sent.loadAcquire());
+        socket->write(body.constData() + sent.loadAcquire(), n);
+        sent.fetchAndAddRelease(n);
+        if (sent.loadAcquire() == body.size())
+        {
+            timer.stop();
+            socket->disconnectFromHost();
+        }
+    }
+
+public:
+    QByteArray  body;
+    QTcpServer  server;
+    QTcpSocket *socket;
+    QTimer      timer;
+    QAtomicInt  sent;           // Bytes of body written to the socket
+};
+
+
+struct StreamLoader : Runnable
+// ----------------------------------------------------------------------------
+//   Read and parse a stream in blocks, like PointCloud::loadFromStream
+// ----------------------------------------------------------------------------
+{
+    StreamLoader(ThrottledServer &server)
+        : stream(NULL), server(server), sentAtFirstPoints(-1),
+          finished(0) {}
+    virtual void run()
+    {
+        LoadDataParm parm("", " ", 1, 2, 3, 1.0 / 255, 4, 5, 6, -1.0);
+        PointCloudParser parser(parm);
+        QByteArray buffer;
+        int kept = 0;
+        for (;;)
+        {
+            buffer.resize(kept + SLICE);
+            qint64 n = stream->read(buffer.data() + kept, SLICE);
+            bool atEnd = n <= 0;
+            if (n < 0)
+                n = 0;
+            const char *begin = buffer.constData();
+            const char *end = begin + kept + n;
+            const char *stop = atEnd ? end
+                : PointCloudParser::lastLine(begin, end);
+            const char *done = parser.parse(begin, stop, points, colors);
+            if (sentAtFirstPoints < 0 && points.size())
+                sentAtFirstPoints = server.sent.loadAcquire();
+            kept = end - done;
+            memmove(buffer.data(), done, kept);
+            if (atEnd || interrupted())
+                break;
+        }
+        finished.storeRelease(1);
+    }
+
+    PointCloudStream *  stream;
+    ThrottledServer &   server;
+    point_vec           points;
+    color_vec           colors;
+    int                 sentAtFirstPoints;
+    QAtomicInt          finished;
+};
+
+
+static bool waitFor(QAtomicInt &flag)
+// ----------------------------------------------------------------------------
+//   Run the event loop, which receives the data, until flag is set
+// ----------------------------------------------------------------------------
+{
+    QElapsedTimer timer;
+    timer.start();
+    while (!flag.loadAcquire())
+    {
+        if (timer.elapsed() > TIMEOUT)
+            return false;
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    }
+    return true;
+}
+
+
+static void testDownload(QNetworkAccessManager &network, ThreadPool &downloads)
+// ----------------------------------------------------------------------------
+//   Parsing overlaps the download and gives the points of the file
+// ----------------------------------------------------------------------------
+{
+    QByteArray body = fixture();
+    ThrottledServer server(body);
+    StreamLoader loader(server);
+    loader.stream = new PointCloudStream(network.get(QNetworkRequest(
+                                                         server.url())),
+                                         &loader);
+    downloads.start(&loader);
+    CHECK(waitFor(loader.finished));
+
+    CHECK(loader.sentAtFirstPoints >= 0);
+    CHECK(loader.sentAtFirstPoints < body.size());
+
+    LoadDataParm parm("", " ", 1, 2, 3, 1.0 / 255, 4, 5, 6, -1.0);
+    PointCloudParser parser(parm);
+    point_vec points;
+    color_vec colors;
+    parser.parse(body.constData(), body.constData() + body.size(),
+                 points, colors);
+    CHECK(loader.points.size() == size_t(LINES));
+    CHECK(loader.points.size() == points.size());
+    CHECK(loader.colors.size() == colors.size());
+    for (size_t i = 0; i < points.size() && i < loader.points.size(); i++)
+    {
+        if (memcmp(&points[i], &loader.points[i], sizeof(points[i])) ||
+            memcmp(&colors[i], &loader.colors[i], sizeof(colors[i])))
+        {
+            CHECK(!"Downloaded points differ from the file");
+            break;
+        }
+    }
+    delete loader.stream;
+}
+
+
+static void testInterrupt(QNetworkAccessManager &network,
+                          ThreadPool &downloads)
+// ----------------------------------------------------------------------------
+//   Interrupting a loader waiting for data stops it
+// ----------------------------------------------------------------------------
+{
+    ThrottledServer server(fixture());
+    StreamLoader loader(server);
+    loader.stream = new PointCloudStream(network.get(QNetworkRequest(
+                                                         server.url())),
+                                         &loader);
+    downloads.start(&loader);
+
+    // Let some data arrive, then stop serving it
+    QElapsedTimer timer;
+    timer.start();
+    while (server.sent.loadAcquire() < SLICE && timer.elapsed() < TIMEOUT)
+        QCoreApplication::processEvents(QEventLoop::AllEvents, 10);
+    server.timer.stop();
+
+    timer.start();
+    loader.interrupt();
+    CHECK(timer.elapsed() < 1000);
+    CHECK(loader.points.size() < size_t(LINES));
+    delete loader.stream;
+}
+
+
+static void testError(QNetworkAccessManager &network, ThreadPool &downloads)
+// ----------------------------------------------------------------------------
+//   A failed download ends reads and reports the error of the reply
+// ----------------------------------------------------------------------------
+{
+    // Nothing listens on the port any longer, the connection is refused
+    ThrottledServer server(fixture());
+    QUrl url = server.url();
+    server.server.close();
+
+    StreamLoader loader(server);
+    loader.stream = new PointCloudStream(network.get(QNetworkRequest(url)),
+                                         &loader);
+    downloads.start(&loader);
+    CHECK(waitFor(loader.finished));
+    CHECK(loader.points.size() == 0);
+    CHECK(!loader.stream->error().isEmpty());
+    delete loader.stream;
+}
+
+
+int main(int argc, char **argv)
+// ----------------------------------------------------------------------------
+//   Run the tests
+// ----------------------------------------------------------------------------
+{
+    QCoreApplication app(argc, argv);
+    QNetworkAccessManager network;
+    ThreadPool downloads(2);
+
+    testDownload(network, downloads);
+    testInterrupt(network, downloads);
+    testError(network, downloads);
+    downloads.stopAll();
+
+    return testResult("stream");
+}
+
+#include "test_stream.moc"
@@ -0,0 +1,51 @@
+# ******************************************************************************
+# tests.pri                                                        Tao3D project
+# ******************************************************************************
+#
+# File description:
+# Common settings for the standalone tests and benchmarks of PointCloud
+#
+# Each program is a console application linking only the module sources it
+# exercises. Tests return a non-zero status on failure, benchmarks print
+# their timings.
+#
+#
+# ******************************************************************************
+# This software is licensed under the GNU General Public License v3
+# ******************************************************************************
+# This file is part of Tao3D
+#
+# Tao3D is free software: you can r redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Tao3D is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with Tao3D, in a file named COPYING.
+# If not, see <https://www.gnu.org/licenses/>.
+# ******************************************************************************
+
+include(../../../main.pri)
+
+TEMPLATE     = app
+CONFIG      += console thread
+CONFIG      -= app_bundle
+QT          += core
+MODSRC       = $$PWD/..
+DEPENDPATH  += $$MODSRC
+INCLUDEPATH += $$PWD $$MODSRC \
+               $$TAOTOPSRC/tao/include $$TAOTOPSRC/tao/include/tao \
+               $$TAOTOPSRC/libxlr
+HEADERS     += $$PWD/test_check.h
+LIBS        += -L$$TAOTOPSRC/libxlr/$$DESTDIR -lxlr
+
+# Build with ThreadSanitizer: qmake CONFIG+=tsan
+tsan {
+    QMAKE_CXXFLAGS += -fsanitize=thread -g -O1
+    QMAKE_LFLAGS   += -fsanitize=thread
+}
@@ -0,0 +1,45 @@
+# ******************************************************************************
+# tests.pro                                                        Tao3D project
+# ******************************************************************************
+#
+# File description:
+# Standalone tests and benchmarks of the PointCloud module
+#
+# Not part of the module build. Build with "qmake && make" in this
+# directory, then run the test_* programs (non-zero status on failure)
+# and the bench_* programs (timings on standard output).
+#
+# ******************************************************************************
+# This software is licensed under the GNU General Public License v3
+# ******************************************************************************
+# This file is part of Tao3D
+#
+# Tao3D is free software: you can r redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# Tao3D is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with Tao3D, in a file named COPYING.
+# If not, see <https://www.gnu.org/licenses/>.
+# ******************************************************************************
+
+TEMPLATE = subdirs
+
+SUBDIRS += bench_parser
+bench_parser.file = bench_parser.pro
+SUBDIRS += test_stream
+test_stream.file = test_stream.pro
+SUBDIRS += test_batches
+test_batches.file = test_batches.pro
+SUBDIRS += bench_layout
+bench_layout.file = bench_layout.pro
+SUBDIRS += bench_load
+bench_load.file = bench_load.pro
+SUBDIRS += test_pack
+test_pack.file = test_pack.pro
@@ -37,6 +37,7 @@
 // If not, see <https://www.gnu.org/licenses/>.
 // *****************************************************************************
 
+#include <QAtomicInt>
 #include <QList>
 #include <QMutex>
 #include <QRunnable>
@@ -62,11 +63,12 @@ public:
 
 public:
     void start(Runnable * runnable);
+    int  maxThreadCount() const { return maxThreads; }
 
     void stopAll()
     {
         QMutexLocker locker(&mutex);
-        runQueue.empty();
+        runQueue.clear();
         isExiting = true;
         while (!threads.isEmpty())
         {
@@ -100,28 +102,36 @@ class Runnable : public QRunnable
     friend class ThreadPool;
 
 public:
-    Runnable() : QRunnable(), running(false), isInterrupted(false), pool(0) {}
+    Runnable() : QRunnable(), running(false), isInterrupted(0), pool(0) {}
     ~Runnable() { interrupt(); }
 
 public:
     virtual void run() = 0;
 
-    bool interrupted() { return isInterrupted; }
+    bool interrupted() { return isInterrupted.loadAcquire(); }
 
     void interrupt()
     {
+        // Take the task off the queue if it did not start. The pool is
+        // locked first, in the same order as ThreadPool::start()
         QMutexLocker locker(&mutex);
-        if (pool)
+        ThreadPool *queued = pool;
+        locker.unlock();
+        if (queued)
         {
-            QMutexLocker poolLocker(&pool->mutex);
-            if (pool->runQueue.removeOne(this))
+            QMutexLocker poolLocker(&queued->mutex);
+            if (queued->runQueue.removeOne(this))
                 return;
         }
+
+        // Tasks taken off the queue are marked running at once, so that
+        // they are waited for even if run() did not begin yet
+        locker.relock();
         if (running)
         {
-            isInterrupted = true;
+            isInterrupted.storeRelease(1);
             notRunning.wait(&mutex);
-            isInterrupted = false;
+            isInterrupted.storeRelease(0);
             running = false;
         }
      }
@@ -142,7 +152,8 @@ protected:
     }
 
 protected:
-    bool            running, isInterrupted;
+    bool            running;
+    QAtomicInt      isInterrupted;  // Read by run() without the mutex
     QMutex          mutex;
     QWaitCondition  notRunning;
     ThreadPool *    pool;
@@ -204,6 +215,11 @@ protected:
     {
         ThreadPool::run_queue &q = pool->runQueue;
         Runnable * r = !q.isEmpty() ? q.takeFirst() : NULL;
+        if (r)
+        {
+            QMutexLocker locker(&r->mutex);
+            r->running = true;
+        }
         return r;
     }
 
@@ -231,6 +247,7 @@ inline void ThreadPool::start(Runnable *runnable)
 
     if (runQueue.contains(runnable) || runnable->running)
         return;
+    runnable->pool = this;
 
     if (idleThreads == 0 && threads.size() < maxThreads)
     {